@@ -36,6 +36,12 @@ static void run_script(conf_doc_t* doc, uint32_t times) {
       const char* user = conf_node_get_child_value_str(iter, "user", "admin");
       const char* password = conf_node_get_child_value_str(iter, "password", "admin");
       int port = conf_node_get_child_value_int32(iter, "port", 2121);
+      int max_sessions = conf_node_get_child_value_int32(iter, "max_sessions", 1);
+      bool_t lazy_read = conf_node_get_child_value_bool(iter, "lazy_read", FALSE);
+      bool_t stream_write = conf_node_get_child_value_bool(iter, "stream_write", FALSE);
+      int cache_size = conf_node_get_child_value_int32(iter, "cache_size", 0);
+      int stat_cache_ttl = conf_node_get_child_value_int32(iter, "stat_cache_ttl", 0);
+      int transfer_buffer_size = conf_node_get_child_value_int32(iter, "transfer_buffer_size", 0);
 
       if (fs != NULL) {
         iter = iter->next;
@@ -43,6 +49,18 @@ static void run_script(conf_doc_t* doc, uint32_t times) {
       }
 
       fs = ftp_fs_create(host, port, user, password);
+      if (fs != NULL) {
+        ftp_fs_set_max_sessions(fs, max_sessions);
+        ftp_fs_set_lazy_read(fs, lazy_read);
+        ftp_fs_set_stream_write(fs, stream_write);
+        if (cache_size > 0) {
+          ftp_fs_set_cache(fs, NULL, cache_size);
+        }
+        ftp_fs_set_stat_cache_ttl(fs, stat_cache_ttl);
+        if (transfer_buffer_size > 0) {
+          ftp_fs_set_transfer_buffer_size(fs, transfer_buffer_size);
+        }
+      }
       log_debug("create: %s:%d %s %s\n", host, port, user, password);
       iter = iter->next;
       continue;
@@ -233,6 +251,18 @@ static void run_script(conf_doc_t* doc, uint32_t times) {
       if (to_file != NULL) {
          fs_file_close(to_file);
       }
+    } else if (tk_str_eq(name, "download_resume")) {
+      const char* remote = conf_node_get_child_value_str(iter, "remote", NULL);
+      const char* local = conf_node_get_child_value_str(iter, "local", NULL);
+      int32_t verify_size = conf_node_get_child_value_int32(iter, "verify", 0);
+      ret_t ret = ftp_fs_download_file_resume(fs, remote, local, verify_size);
+      log_debug("download_resume %s => %s %s\n", remote, local, ret_code_to_name(ret));
+    } else if (tk_str_eq(name, "upload_resume")) {
+      const char* remote = conf_node_get_child_value_str(iter, "remote", NULL);
+      const char* local = conf_node_get_child_value_str(iter, "local", NULL);
+      int32_t verify_size = conf_node_get_child_value_int32(iter, "verify", 0);
+      ret_t ret = ftp_fs_upload_file_resume(fs, local, remote, verify_size);
+      log_debug("upload_resume %s => %s %s\n", local, remote, ret_code_to_name(ret));
     } else if (tk_str_eq(name, "stat")) {
       fs_stat_info_t info;
       const char* name = conf_node_get_child_value_str(iter, "name", NULL);
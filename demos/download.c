@@ -29,12 +29,13 @@ int main(int argc, char* argv[]) {
   int port = 2121;
   const char* user = "admin";
   const char* password = "admin";
+  uint32_t segments = 1;
   fs_t* fs = NULL;
 
   platform_prepare();
 
   if (argc < 7) {
-    log_debug("Usage: %s remote_file local_file host port user password\n", argv[0]);
+    log_debug("Usage: %s remote_file local_file host port user password [segments]\n", argv[0]);
     log_debug("ex: %s %s %s %s %d %s %s\n", argv[0], remote_file, local_file, host, port, user, password);
     return 0;
   } else {
@@ -44,13 +45,20 @@ int main(int argc, char* argv[]) {
     port = tk_atoi(argv[4]);
     user = argv[5];
     password = argv[6];
+    segments = argc > 7 ? tk_atoi(argv[7]) : 1;
   }
 
   tk_socket_init();
 
   fs = ftp_fs_create(host, port, user, password);
   if (fs != NULL) {
-    ret_t ret = ftp_fs_download_file(fs, remote_file, local_file);
+    ret_t ret = RET_OK;
+    if (segments > 1) {
+      ftp_fs_set_max_sessions(fs, segments);
+      ret = ftp_fs_download_file_parallel(fs, remote_file, local_file, segments);
+    } else {
+      ret = ftp_fs_download_file(fs, remote_file, local_file);
+    }
     log_debug("ret=%s\n", ret_code_to_name(ret));
     ftp_fs_destroy(fs);
   } else {
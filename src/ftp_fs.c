@@ -19,6 +19,18 @@
  *
  */
 
+#if defined(LINUX) && !defined(FTP_FS_WITHOUT_ZERO_COPY)
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif /*_GNU_SOURCE*/
+#define FTP_FS_WITH_ZERO_COPY 1
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#endif /*LINUX*/
+
 #include "tkc/buffer.h"
 #include "tkc/darray.h"
 #include "tkc/fs.h"
@@ -26,64 +38,484 @@
 #include "tkc/path.h"
 #include "tkc/tokenizer.h"
 #include "tkc/utils.h"
+#include "tkc/mutex.h"
+#include "tkc/cond.h"
+#include "tkc/thread.h"
+#include "tkc/time_now.h"
+#include "tkc/socket_helper.h"
+#include "tkc/crc.h"
+#include "tkc/sha256.h"
+#include "miniz/miniz.h"
 #include "streams/inet/iostream_tcp.h"
 
 #include "ftp_fs.h"
 
 #define FTP_CMD_MAX_SIZE (MAX_PATH + 32)
 #define FTP_BUF_MAX_SIZE 1024
+#define FTP_FS_ABORT_TIMEOUT 5000
+#define FTP_FS_ABORT_DRAIN_TIMEOUT 200
+#define FTP_HASH_MAX_SIZE (TK_SHA256_HASH_LEN * 2 + 1)
+
+#ifdef WIN32
+#define FTP_SHUT_RDWR SD_BOTH
+#else
+#define FTP_SHUT_RDWR SHUT_RDWR
+#endif /*WIN32*/
+
+/*一个已登录的控制连接，同一时刻只被一个调用者使用。*/
+typedef struct _ftp_session_t {
+  ftp_fs_t* ftp_fs;
+  tk_iostream_t* ios;
+  tk_iostream_t* data_ios;
+  int data_port;
+  bool_t busy;
+  bool_t broken;
+  /*客户端记录的服务器端状态，状态不变的命令(CWD/TYPE)不再发送。*/
+  char cwd[MAX_PATH + 1];
+  bool_t binary;
+  /*还没有计入ftp_fs->round_trips的命令往返次数。*/
+  uint32_t round_trips;
+  int last_error_code;
+  char last_error_message[256];
+
+  /*控制连接上已经收到但还没有处理的数据。*/
+  char rbuf[FTP_BUF_MAX_SIZE];
+  uint32_t rbuf_offset;
+  uint32_t rbuf_len;
+  /*最近一次完整的回复(包括多行回复的所有行)，以'\0'结尾。*/
+  wbuffer_t reply;
+  /*正在解析的回复：是否已经开始、多行回复的回复码和当前行的开始位置。*/
+  bool_t reply_partial;
+  int32_t reply_multi;
+  uint32_t reply_line_start;
+
+  /*数据传输用的缓冲区，大小由ftp_fs->transfer_buffer_size决定，zbuffer用于压缩和解压。*/
+  uint8_t* buffer;
+  uint32_t buffer_size;
+  uint8_t* zbuffer;
+  uint32_t zbuffer_size;
+
+  /*当前是否处于MODE Z，以及下一次数据传输是否需要压缩(在ftp_session_pasv中切换)。*/
+  bool_t mode_z;
+  bool_t compress_next;
+
+  /*传输进度回调，返回RET_STOP时中止传输。*/
+  ftp_fs_on_progress_t on_progress;
+  void* on_progress_ctx;
+  uint64_t progress_done;
+  uint64_t progress_total;
+
+  /*传输时同步计算的校验值，hash_algo是用OPTS HASH选择的算法。*/
+  ftp_fs_hash_type_t hash_type;
+  uint32_t crc32;
+  tk_sha256_t sha256;
+  ftp_fs_hash_type_t hash_algo;
+} ftp_session_t;
+
+/*连接时用FEAT查询的服务器扩展。*/
+typedef enum _ftp_feature_t {
+  FTP_FEATURE_REST_STREAM = 1,
+  FTP_FEATURE_HASH_CRC32 = 1 << 1,
+  FTP_FEATURE_HASH_SHA256 = 1 << 2,
+  FTP_FEATURE_XCRC = 1 << 3,
+  FTP_FEATURE_XSHA256 = 1 << 4,
+  FTP_FEATURE_MODE_Z = 1 << 5,
+  /*支持MLST的服务器也支持MLSD(RFC3659)。*/
+  FTP_FEATURE_MLST = 1 << 6,
+  FTP_FEATURE_SIZE = 1 << 7,
+  FTP_FEATURE_MDTM = 1 << 8,
+  FTP_FEATURE_EPSV = 1 << 9,
+  FTP_FEATURE_MLSD = 1 << 10,
+} ftp_feature_t;
+
+static ret_t ftp_session_pasv(ftp_session_t* s);
+static ret_t ftp_session_read_reply(ftp_session_t* s, int32_t* code);
+static ret_t ftp_session_cmd(ftp_session_t* s, const char* cmd, int32_t* ret_code, char* ret_data,
+                             uint32_t ret_data_size);
+static bool_t ftp_session_has_feature(ftp_session_t* s, uint32_t feature);
+static ret_t ftp_session_disable_feature(ftp_session_t* s, uint32_t feature);
+
+static ret_t ftp_path_normalize(const char* cwd, const char* name, char* result, uint32_t size) {
+  tokenizer_t t;
+  uint32_t len = 0;
+  char path[2 * MAX_PATH + 2] = {0};
+  return_value_if_fail(name != NULL && result != NULL && size > 1, RET_BAD_PARAMS);
 
-static ret_t ftp_fs_pasv(ftp_fs_t* ftp_fs);
-static ret_t ftp_fs_cmd(ftp_fs_t* ftp_fs, const char* cmd, int32_t* ret_code, char* ret_data,
-                        uint32_t ret_data_size);
+  if (name[0] == '/' || cwd == NULL) {
+    tk_snprintf(path, sizeof(path), "/%s", name);
+  } else {
+    tk_snprintf(path, sizeof(path), "%s/%s", cwd, name);
+  }
 
-static ret_t ftp_fs_expect226(ftp_fs_t* ftp_fs) {
-  char buf[FTP_BUF_MAX_SIZE] = {0};
-  int32_t ret = tk_iostream_read(ftp_fs->ios, buf, sizeof(buf) - 1);
-  return_value_if_fail(ret > 0, RET_IO);
+  result[0] = '\0';
+  tokenizer_init(&t, path, strlen(path), "/");
+  while (tokenizer_has_more(&t)) {
+    const char* p = tokenizer_next(&t);
+    if (p == NULL || *p == '\0' || tk_str_eq(p, ".")) {
+      continue;
+    }
+
+    if (tk_str_eq(p, "..")) {
+      char* last = strrchr(result, '/');
+      if (last != NULL) {
+        *last = '\0';
+      }
+      len = strlen(result);
+    } else if (len + strlen(p) + 1 < size) {
+      tk_snprintf(result + len, size - len, "/%s", p);
+      len = strlen(result);
+    }
+  }
+  tokenizer_deinit(&t);
+
+  if (result[0] == '\0') {
+    tk_strncpy(result, "/", size - 1);
+  }
+
+  return RET_OK;
+}
+
+/*取绝对路径的上级目录，根目录没有上级目录(结果为空字符串)。*/
+static ret_t ftp_path_get_parent(const char* path, char* parent, uint32_t size) {
+  const char* last = NULL;
+  return_value_if_fail(path != NULL && parent != NULL && size > 1, RET_BAD_PARAMS);
+
+  parent[0] = '\0';
+  last = strrchr(path, '/');
+  return_value_if_fail(last != NULL && last[1] != '\0', RET_FAIL);
+
+  if (last == path) {
+    tk_strncpy(parent, "/", size - 1);
+  } else {
+    tk_strncpy(parent, path, tk_min_int(last - path, size - 1));
+  }
+
+  return RET_OK;
+}
+
+static ret_t ftp_session_expect226(ftp_session_t* s) {
+  int32_t code = 0;
+  ret_t ret = ftp_session_read_reply(s, &code);
+  return_value_if_fail(ret == RET_OK, ret);
 
-  buf[ret] = '\0';
-  ret = tk_atoi(buf);
-  if (ret >= 200 && ret < 300) {
+  if (code >= 200 && code < 300) {
     return RET_OK;
   } else {
     return RET_FAIL;
   }
 }
 
-static ret_t fs_ftp_binary_mode(ftp_fs_t* ftp_fs) {
+static ret_t ftp_session_binary_mode(ftp_session_t* s) {
   char cmd[FTP_CMD_MAX_SIZE] = {0};
-  return_value_if_fail(ftp_fs != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(s != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(!s->binary, RET_OK);
 
   tk_snprintf(cmd, sizeof(cmd), "TYPE I\r\n");
-  return ftp_fs_cmd(ftp_fs, cmd, NULL, NULL, 0);
+  return_value_if_fail(ftp_session_cmd(s, cmd, NULL, NULL, 0) == RET_OK, RET_FAIL);
+  s->binary = TRUE;
+
+  return RET_OK;
+}
+
+static uint8_t* ftp_session_get_buffer(ftp_session_t* s, uint32_t* size) {
+  uint32_t buffer_size = s->ftp_fs->transfer_buffer_size;
+
+  if (s->buffer == NULL || s->buffer_size != buffer_size) {
+    TKMEM_FREE(s->buffer);
+    s->buffer = TKMEM_ALLOC(buffer_size);
+    s->buffer_size = s->buffer != NULL ? buffer_size : 0;
+  }
+  *size = s->buffer_size;
+
+  return s->buffer;
+}
+
+static uint8_t* ftp_session_get_zbuffer(ftp_session_t* s, uint32_t* size) {
+  uint32_t buffer_size = s->ftp_fs->transfer_buffer_size;
+
+  if (s->zbuffer == NULL || s->zbuffer_size != buffer_size) {
+    TKMEM_FREE(s->zbuffer);
+    s->zbuffer = TKMEM_ALLOC(buffer_size);
+    s->zbuffer_size = s->zbuffer != NULL ? buffer_size : 0;
+  }
+  *size = s->zbuffer_size;
+
+  return s->zbuffer;
+}
+
+/*
+ * 关闭数据连接。其它线程可能在ftp_fs_abort_transfer中关闭正在使用的数据连接，
+ * 所以data_ios的修改都要持有data_mutex，关闭socket放在锁外面。
+ */
+static ret_t ftp_session_close_data(ftp_session_t* s) {
+  tk_iostream_t* data_ios = NULL;
+
+  tk_mutex_lock(s->ftp_fs->data_mutex);
+  data_ios = s->data_ios;
+  s->data_ios = NULL;
+  tk_mutex_unlock(s->ftp_fs->data_mutex);
+  TK_OBJECT_UNREF(data_ios);
+
+  return RET_OK;
+}
+
+static ret_t ftp_session_open_data(ftp_session_t* s, const char* host, int port) {
+  tk_iostream_t* data_ios = tk_iostream_tcp_create_client(host, port);
+  return_value_if_fail(data_ios != NULL, RET_IO);
+
+  tk_mutex_lock(s->ftp_fs->data_mutex);
+  s->data_ios = data_ios;
+  tk_mutex_unlock(s->ftp_fs->data_mutex);
+
+  return RET_OK;
+}
+
+typedef ret_t (*ftp_data_write_t)(void* ctx, const uint8_t* data, uint32_t size);
+
+/*MODE Z：从数据连接读取deflate(zlib格式)的数据，解压后交给write，直到数据结束或者连接关闭。*/
+static ret_t ftp_session_inflate_data(ftp_session_t* s, ftp_data_write_t write, void* ctx) {
+  mz_stream zs;
+  int zret = MZ_OK;
+  ret_t ret = RET_OK;
+  uint32_t in_size = 0;
+  uint32_t out_size = 0;
+  uint8_t* in = ftp_session_get_zbuffer(s, &in_size);
+  uint8_t* out = ftp_session_get_buffer(s, &out_size);
+  return_value_if_fail(in != NULL && out != NULL, RET_OOM);
+
+  memset(&zs, 0x00, sizeof(zs));
+  return_value_if_fail(mz_inflateInit(&zs) == MZ_OK, RET_FAIL);
+
+  while (ret == RET_OK && zret != MZ_STREAM_END) {
+    int32_t n = tk_iostream_read(s->data_ios, in, in_size);
+    break_if_fail(n > 0);
+
+    zs.next_in = in;
+    zs.avail_in = n;
+    do {
+      uint32_t len = 0;
+      zs.next_out = out;
+      zs.avail_out = out_size;
+      zret = mz_inflate(&zs, MZ_SYNC_FLUSH);
+      if (zret != MZ_OK && zret != MZ_STREAM_END && zret != MZ_BUF_ERROR) {
+        log_warn("inflate failed: %d\n", zret);
+        ret = RET_FAIL;
+        break;
+      }
+
+      len = out_size - zs.avail_out;
+      if (len > 0) {
+        ret = write(ctx, out, len);
+      }
+    } while (ret == RET_OK && zret != MZ_STREAM_END && (zs.avail_in > 0 || zs.avail_out == 0));
+  }
+  mz_inflateEnd(&zs);
+
+  return ret;
+}
+
+static ret_t ftp_data_write_to_wbuffer(void* ctx, const uint8_t* data, uint32_t size) {
+  return wbuffer_write_binary((wbuffer_t*)ctx, data, size);
 }
 
-static ret_t ftp_fs_read_data(ftp_fs_t* ftp_fs, wbuffer_t* wb) {
+static ret_t ftp_session_read_data(ftp_session_t* s, wbuffer_t* wb) {
   int32_t ret = 0;
-  char buf[FTP_BUF_MAX_SIZE] = {0};
-  return_value_if_fail(ftp_fs != NULL && wb != NULL, RET_BAD_PARAMS);
+  uint8_t* buf = NULL;
+  uint32_t buf_size = 0;
+  return_value_if_fail(s != NULL && wb != NULL, RET_BAD_PARAMS);
+
+  buf = ftp_session_get_buffer(s, &buf_size);
+  if (buf == NULL) {
+    ftp_session_close_data(s);
+    return RET_OOM;
+  }
 
-  while ((ret = tk_iostream_read(ftp_fs->data_ios, buf, sizeof(buf) - 1)) > 0) {
-    if (wbuffer_write_binary(wb, buf, ret) != RET_OK) {
-      TK_OBJECT_UNREF(ftp_fs->data_ios);
-      return RET_OOM;
+  if (s->mode_z) {
+    if (ftp_session_inflate_data(s, ftp_data_write_to_wbuffer, wb) != RET_OK) {
+      ftp_session_close_data(s);
+      return RET_FAIL;
+    }
+  } else {
+    while ((ret = tk_iostream_read(s->data_ios, buf, buf_size)) > 0) {
+      if (wbuffer_write_binary(wb, buf, ret) != RET_OK) {
+        ftp_session_close_data(s);
+        return RET_OOM;
+      }
     }
   }
 
-  TK_OBJECT_UNREF(ftp_fs->data_ios);
+  ftp_session_close_data(s);
+
+  return ftp_session_expect226(s);
+}
+
+static ret_t ftp_session_cwd(ftp_session_t* s, const char* path) {
+  ret_t ret = RET_FAIL;
+  char cmd[FTP_CMD_MAX_SIZE] = {0};
+  char abs_path[MAX_PATH + 1] = {0};
+  return_value_if_fail(s != NULL && path != NULL, RET_BAD_PARAMS);
+
+  /*已经在这个目录中时不需要再切换。*/
+  ftp_path_normalize(s->cwd, path, abs_path, sizeof(abs_path));
+  return_value_if_fail(!tk_str_eq(abs_path, s->cwd), RET_OK);
+
+  tk_snprintf(cmd, sizeof(cmd), "CWD %s\r\n", path);
+  ret = ftp_session_cmd(s, cmd, NULL, NULL, 0);
+  if (ret == RET_OK) {
+    tk_strncpy(s->cwd, abs_path, sizeof(s->cwd) - 1);
+  }
 
-  return ftp_fs_expect226(ftp_fs);
+  return ret;
 }
 
 typedef enum _ftp_list_method_t { FTP_LIST_METHOD_MLSD, FTP_LIST_METHOD_LIST } ftp_list_method_t;
 
+typedef struct _ftp_stat_entry_t {
+  char path[MAX_PATH + 1];
+  fs_stat_info_t info;
+  ret_t ret;
+  uint64_t expire;
+} ftp_stat_entry_t;
+
+/*UTC日期转换为秒数(1970-01-01起)。*/
+static uint64_t ftp_time_make(int32_t year, int32_t mon, int32_t day, int32_t hour, int32_t min,
+                              int32_t sec) {
+  int64_t days = 0;
+  int32_t era = 0;
+  uint32_t yoe = 0;
+  uint32_t doy = 0;
+  uint32_t doe = 0;
+  return_value_if_fail(year >= 1970 && mon >= 1 && mon <= 12 && day >= 1 && day <= 31, 0);
+
+  year -= mon <= 2;
+  era = year / 400;
+  yoe = (uint32_t)(year - era * 400);
+  doy = (153 * (mon + (mon > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  days = (int64_t)era * 146097 + (int64_t)doe - 719468;
+
+  return (uint64_t)(days * 86400 + hour * 3600 + min * 60 + sec);
+}
+
+static int32_t ftp_time_get_year(uint64_t t) {
+  int64_t days = (int64_t)(t / 86400) + 719468;
+  int64_t era = days / 146097;
+  uint32_t doe = (uint32_t)(days - era * 146097);
+  uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  uint32_t mp = (5 * doy + 2) / 153;
+  int32_t year = (int32_t)(yoe + era * 400);
+
+  return mp < 10 ? year : year + 1;
+}
+
+//20231026082500 or 20231026082500.123
+static uint64_t ftp_time_parse_mlsd(const char* str) {
+  int32_t year = 0;
+  int32_t mon = 0;
+  int32_t day = 0;
+  int32_t hour = 0;
+  int32_t min = 0;
+  int32_t sec = 0;
+  return_value_if_fail(str != NULL, 0);
+
+  if (tk_sscanf(str, "%4d%2d%2d%2d%2d%2d", &year, &mon, &day, &hour, &min, &sec) != 6) {
+    return 0;
+  }
+
+  return ftp_time_make(year, mon, day, hour, min, sec);
+}
+
+//Oct 26 08:25 or Oct 26 2022，没有年份时取最近的一年。
+static uint64_t ftp_time_parse_list(const char* smon, const char* sday, const char* syear) {
+  uint32_t i = 0;
+  int32_t mon = 0;
+  int32_t hour = 0;
+  int32_t min = 0;
+  uint64_t t = 0;
+  uint64_t now = time_now_s();
+  static const char* s_months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                   "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+  return_value_if_fail(smon != NULL && sday != NULL && syear != NULL, 0);
+
+  for (i = 0; i < ARRAY_SIZE(s_months); i++) {
+    if (tk_str_ieq(smon, s_months[i])) {
+      mon = i + 1;
+      break;
+    }
+  }
+  return_value_if_fail(mon > 0, 0);
+
+  if (strchr(syear, ':') != NULL) {
+    int32_t year = ftp_time_get_year(now);
+    if (tk_sscanf(syear, "%d:%d", &hour, &min) != 2) {
+      return 0;
+    }
+
+    t = ftp_time_make(year, mon, tk_atoi(sday), hour, min, 0);
+    if (t > now + 86400) {
+      t = ftp_time_make(year - 1, mon, tk_atoi(sday), hour, min, 0);
+    }
+  } else {
+    t = ftp_time_make(tk_atoi(syear), mon, tk_atoi(sday), 0, 0, 0);
+  }
+
+  return t;
+}
+
+//-rw-r--r--
+static uint16_t ftp_mode_parse_list(const char* str) {
+  uint32_t i = 0;
+  uint16_t mode = 0;
+  return_value_if_fail(str != NULL && strlen(str) >= 10, 0);
+
+  for (i = 0; i < 9; i++) {
+    if (str[i + 1] != '-') {
+      mode |= 1 << (8 - i);
+    }
+  }
+
+  return mode;
+}
+
+/*MLSD的perm只描述当前用户的权限，映射到owner的rwx上。*/
+static uint16_t ftp_mode_parse_perm(const char* str, bool_t is_dir) {
+  uint16_t mode = 0;
+  return_value_if_fail(str != NULL, 0);
+
+  if (strpbrk(str, is_dir ? "l" : "r") != NULL) {
+    mode |= 0400;
+  }
+  if (strpbrk(str, is_dir ? "cmdf" : "wadf") != NULL) {
+    mode |= 0200;
+  }
+  if (is_dir && strchr(str, 'e') != NULL) {
+    mode |= 0100;
+  }
+
+  return mode;
+}
+
+static uint16_t ftp_hash_unique(const char* str) {
+  uint32_t hash = 2166136261u;
+  return_value_if_fail(str != NULL, 0);
+
+  while (*str) {
+    hash = (hash ^ (uint8_t)(*str++)) * 16777619u;
+  }
+
+  return (uint16_t)((hash >> 16) ^ (hash & 0xffff));
+}
+
 //-rw-r--r-- 1 501 20          785 Oct 26 08:25 README.md
-static fs_item_t* fs_item_parse_list(fs_item_t* item, const char* line) {
+static fs_item_t* fs_item_parse_list(fs_item_t* item, fs_stat_info_t* info, const char* line) {
   tokenizer_t t;
   const char* p = NULL;
-  return_value_if_fail(item != NULL, NULL);
+  char smon[8] = {0};
+  char sday[8] = {0};
+  return_value_if_fail(item != NULL && info != NULL, NULL);
 
+  memset(info, 0x00, sizeof(*info));
   tokenizer_init(&t, line, tk_strlen(line), " ");
   return_value_if_fail(line != NULL && *line != '\0', NULL);
 
@@ -93,46 +525,53 @@ static fs_item_t* fs_item_parse_list(fs_item_t* item, const char* line) {
   item->is_dir = p[0] == 'd';
   item->is_reg_file = p[0] == '-';
   item->is_link = p[0] == 'l';
+  info->mode = ftp_mode_parse_list(p);
 
-  p = tokenizer_next(&t); // 1
-  return_value_if_fail(p != NULL, item);
-
-  p = tokenizer_next(&t); // 501
-  return_value_if_fail(p != NULL, item);
-
-  p = tokenizer_next(&t); // 20
-  return_value_if_fail(p != NULL, item);
+  info->nlink = tokenizer_next_int(&t, 0); // 1
+  info->uid = tokenizer_next_int(&t, 0);   // 501
+  info->gid = tokenizer_next_int(&t, 0);   // 20
 
   p = tokenizer_next(&t); // 785
   return_value_if_fail(p != NULL, item);
+  info->size = tk_atoul(p);
 
   p = tokenizer_next(&t); // Oct
   return_value_if_fail(p != NULL, item);
+  tk_strncpy(smon, p, sizeof(smon) - 1);
 
   p = tokenizer_next(&t); // 26
   return_value_if_fail(p != NULL, item);
+  tk_strncpy(sday, p, sizeof(sday) - 1);
 
   p = tokenizer_next(&t); // 08:25
   return_value_if_fail(p != NULL, item);
+  info->mtime = ftp_time_parse_list(smon, sday, p);
 
   p = tokenizer_next(&t); // README.md
   return_value_if_fail(p != NULL, item);
 
   tk_strncpy(item->name, p, sizeof(item->name)-1);
+  info->is_dir = item->is_dir;
+  info->is_reg_file = item->is_reg_file;
+  info->is_link = item->is_link;
 
   tokenizer_deinit(&t);
 
   return item;
 }
 
-static fs_item_t* fs_item_parse_mlsd(fs_item_t* item, const char* line) {
+//type=file;size=785;modify=20231026082500;perm=adfrw;unique=801g3a2b; README.md
+static fs_item_t* fs_item_parse_mlsd(fs_item_t* item, fs_stat_info_t* info, const char* line) {
   tokenizer_t t;
   char skey[128] = {0};
   char svalue[128] = {0};
-  
-  return_value_if_fail(item != NULL, NULL);
+  char sperm[32] = {0};
+  bool_t has_mode = FALSE;
+
+  return_value_if_fail(item != NULL && info != NULL, NULL);
   return_value_if_fail(line != NULL && *line != '\0', NULL);
 
+  memset(info, 0x00, sizeof(*info));
   tokenizer_init(&t, line, strlen(line), ";");
   while (tokenizer_has_more(&t)) {
     const char* kv = tokenizer_next(&t);
@@ -143,7 +582,7 @@ static fs_item_t* fs_item_parse_mlsd(fs_item_t* item, const char* line) {
 
         tk_strncpy(skey, kv, len);
         tk_strncpy(svalue, p + 1, sizeof(svalue) - 1);
-        if (tk_str_eq(skey, "type")) {
+        if (tk_str_ieq(skey, "type")) {
           if (strstr(svalue, "dir")) {
             item->is_dir = TRUE;
           } else if (strstr(svalue, "file")) {
@@ -151,6 +590,23 @@ static fs_item_t* fs_item_parse_mlsd(fs_item_t* item, const char* line) {
           } else {
             item->is_link = TRUE;
           }
+        } else if (tk_str_ieq(skey, "size") || tk_str_ieq(skey, "sizd")) {
+          info->size = tk_atoul(svalue);
+        } else if (tk_str_ieq(skey, "modify")) {
+          info->mtime = ftp_time_parse_mlsd(svalue);
+        } else if (tk_str_ieq(skey, "create")) {
+          info->ctime = ftp_time_parse_mlsd(svalue);
+        } else if (tk_str_ieq(skey, "perm")) {
+          tk_strncpy(sperm, svalue, sizeof(sperm) - 1);
+        } else if (tk_str_ieq(skey, "unique")) {
+          info->ino = ftp_hash_unique(svalue);
+        } else if (tk_str_ieq(skey, "unix.mode")) {
+          info->mode = (uint16_t)tk_strtol(svalue, NULL, 8);
+          has_mode = TRUE;
+        } else if (tk_str_ieq(skey, "unix.uid")) {
+          info->uid = tk_atoi(svalue);
+        } else if (tk_str_ieq(skey, "unix.gid")) {
+          info->gid = tk_atoi(svalue);
         }
       } else {
         kv++;
@@ -160,51 +616,123 @@ static fs_item_t* fs_item_parse_mlsd(fs_item_t* item, const char* line) {
   }
   tokenizer_deinit(&t);
 
+  info->is_dir = item->is_dir;
+  info->is_reg_file = item->is_reg_file;
+  info->is_link = item->is_link;
+  if (!has_mode) {
+    info->mode = ftp_mode_parse_perm(sperm, item->is_dir);
+  }
+
   return item;
 }
 
-static ret_t ftp_fs_cmd_list(ftp_fs_t* ftp_fs, const char* path, darray_t* items) {
+/*按压缩策略决定一次传输是否压缩，filename为NULL表示列目录，size为0表示长度未知。*/
+static bool_t ftp_fs_should_compress(ftp_fs_t* ftp_fs, const char* filename, uint64_t size) {
+  tokenizer_t t;
+  bool_t ret = FALSE;
+  const char* ext = NULL;
+
+  if (ftp_fs->compress != FTP_FS_COMPRESS_AUTO) {
+    return ftp_fs->compress == FTP_FS_COMPRESS_ALWAYS;
+  } else if (filename == NULL) {
+    return TRUE;
+  } else if (size > 0 && size < ftp_fs->compress_min_size) {
+    return FALSE;
+  }
+
+  ext = strrchr(filename, '.');
+  if (ext == NULL || strchr(ext, '/') != NULL) {
+    return FALSE;
+  }
+
+  tokenizer_init(&t, ftp_fs->compress_exts, strlen(ftp_fs->compress_exts), ", ");
+  while (!ret && tokenizer_has_more(&t)) {
+    ret = tk_str_ieq(tokenizer_next(&t), ext + 1);
+  }
+  tokenizer_deinit(&t);
+
+  return ret;
+}
+
+/*stats不为NULL时，为列表中的每一项生成stat记录(路径为绝对路径)。*/
+static ret_t ftp_session_cmd_list(ftp_session_t* s, const char* path, darray_t* items,
+                                  darray_t* stats) {
   wbuffer_t wb;
   char cmd[FTP_CMD_MAX_SIZE] = {0};
   ret_t ret = RET_FAIL;
   char buf[FTP_BUF_MAX_SIZE] = {0};
-  ftp_list_method_t method = FTP_LIST_METHOD_MLSD;
+  char dir[MAX_PATH + 1] = {0};
+  ftp_list_method_t method = FTP_LIST_METHOD_LIST;
 
   return_value_if_fail(path != NULL && items != NULL, RET_BAD_PARAMS);
-  return_value_if_fail(fs_change_dir((fs_t*)ftp_fs, path) == RET_OK, RET_FAIL);
-  return_value_if_fail(ftp_fs_pasv(ftp_fs) == RET_OK, RET_FAIL);
+  ftp_path_normalize(s->cwd, path, dir, sizeof(dir));
+
+  /*
+   * MLSD的参数不是目录时会失败，不需要先CWD(也就不用在下次取出连接时再CWD回来)；
+   * LIST的参数是文件时也会成功，所以要先用CWD确认是目录。
+   */
+  if (ftp_session_has_feature(s, FTP_FEATURE_MLSD)) {
+    method = FTP_LIST_METHOD_MLSD;
+  } else {
+    return_value_if_fail(ftp_session_cwd(s, dir) == RET_OK, RET_FAIL);
+  }
 
-  tk_snprintf(cmd, sizeof(cmd), "MLSD %s\r\n", path);
-  ret = ftp_fs_cmd(ftp_fs, cmd, NULL, buf, sizeof(buf) - 1);
+  s->compress_next = ftp_fs_should_compress(s->ftp_fs, NULL, 0);
+  return_value_if_fail(ftp_session_pasv(s) == RET_OK, RET_FAIL);
+
+  tk_snprintf(cmd, sizeof(cmd), "%s %s\r\n", method == FTP_LIST_METHOD_MLSD ? "MLSD" : "LIST", dir);
+  ret = ftp_session_cmd(s, cmd, NULL, buf, sizeof(buf) - 1);
   if (ret != RET_OK) {
-    tk_snprintf(cmd, sizeof(cmd), "LIST %s\r\n", path);
-    ret = ftp_fs_cmd(ftp_fs, cmd, NULL, buf, sizeof(buf) - 1);
-    method = FTP_LIST_METHOD_LIST;
+    ftp_session_close_data(s);
+    /*
+     * 500/502/504表示服务器不认识MLSD，记住结果，以后直接用LIST。
+     * 参数不是目录时服务器回复501/550，只是这次列目录失败，不能因此关闭MLSD。
+     */
+    if (method == FTP_LIST_METHOD_MLSD && !s->broken &&
+        (s->last_error_code == 500 || s->last_error_code == 502 || s->last_error_code == 504)) {
+      ftp_session_disable_feature(s, FTP_FEATURE_MLSD);
+      return ftp_session_cmd_list(s, path, items, stats);
+    }
+    return ret;
   }
-  return_value_if_fail(ret == RET_OK, ret);
 
   wbuffer_init_extendable(&wb);
-  if (ftp_fs_read_data(ftp_fs, &wb) == RET_OK) {
+  if (ftp_session_read_data(s, &wb) == RET_OK) {
     tokenizer_t t;
     tokenizer_init(&t, (const char*)(wb.data), wb.cursor, "\r\n");
     while (tokenizer_has_more(&t)) {
       const char* line = tokenizer_next(&t);
       if (line != NULL) {
+        fs_stat_info_t info;
         fs_item_t* item = fs_item_create();
         break_if_fail(item != NULL);
-        
+
         switch(method) {
           case FTP_LIST_METHOD_MLSD:
-            item = fs_item_parse_mlsd(item, line);
+            item = fs_item_parse_mlsd(item, &info, line);
             break;
           case FTP_LIST_METHOD_LIST:
-            item = fs_item_parse_list(item, line);
+            item = fs_item_parse_list(item, &info, line);
             break;
-          default: 
+          default:
             break;
         }
         if (item != NULL) {
           darray_push(items, item);
+
+          /*跳过.和..，以及带路径的cdir/pdir项。*/
+          if (stats != NULL && item->name[0] != '\0' && !tk_str_eq(item->name, ".") &&
+              !tk_str_eq(item->name, "..") && strchr(item->name, '/') == NULL) {
+            ftp_stat_entry_t* entry = TKMEM_ZALLOC(ftp_stat_entry_t);
+            if (entry != NULL) {
+              ftp_path_normalize(dir, item->name, entry->path, sizeof(entry->path));
+              entry->info = info;
+              entry->ret = RET_OK;
+              if (darray_push(stats, entry) != RET_OK) {
+                TKMEM_FREE(entry);
+              }
+            }
+          }
         }
       }
     }
@@ -215,485 +743,4583 @@ static ret_t ftp_fs_cmd_list(ftp_fs_t* ftp_fs, const char* path, darray_t* items
   return RET_OK;
 }
 
-static ret_t ftp_fs_read_until_end(ftp_fs_t* ftp_fs, char* buf, int32_t buf_len,
-                                   const char* end_mark) {
-  int32_t len = 0;
-  int32_t offset = 0;
-  int32_t available_len = buf_len;
-
-  while (strstr(buf, end_mark) == NULL) {
-    offset = tk_strlen(buf);
-    available_len = buf_len - offset;
-    if (available_len <= 0) {
-      log_warn("buf is full\n");
-      break;
+/*
+ * 按RFC959的格式从已经收到的数据中解析一个完整的回复：单行回复为"NNN text"，
+ * 多行回复从"NNN-text"开始，到同一个回复码的"NNN text"结束。属于后续回复的数据留在rbuf中，
+ * 数据不够时返回RET_BUSY，已经解析的部分留到下次继续。
+ */
+static ret_t ftp_session_parse_reply(ftp_session_t* s, int32_t* code) {
+  wbuffer_t* reply = NULL;
+  return_value_if_fail(s != NULL && code != NULL, RET_BAD_PARAMS);
+
+  reply = &(s->reply);
+  if (!s->reply_partial) {
+    reply->cursor = 0;
+    s->reply_multi = 0;
+    s->reply_line_start = 0;
+    s->reply_partial = TRUE;
+  }
+
+  while (s->rbuf_offset < s->rbuf_len) {
+    const char* start = s->rbuf + s->rbuf_offset;
+    uint32_t size = s->rbuf_len - s->rbuf_offset;
+    const char* eol = (const char*)memchr(start, '\n', size);
+
+    if (eol != NULL) {
+      size = eol - start + 1;
     }
+    if (wbuffer_write_binary(reply, start, size) != RET_OK) {
+      s->reply_partial = FALSE;
+      return RET_OOM;
+    }
+    s->rbuf_offset += size;
+
+    if (eol != NULL) {
+      const char* line = (const char*)(reply->data) + s->reply_line_start;
+      uint32_t line_len = reply->cursor - s->reply_line_start;
+      bool_t has_code = line_len >= 4 && tk_isdigit(line[0]) && tk_isdigit(line[1]) &&
+                        tk_isdigit(line[2]);
+      int32_t c = has_code ? tk_atoi(line) : 0;
+      bool_t last = FALSE;
+
+      if (s->reply_multi == 0) {
+        if (has_code) {
+          if (line[3] == '-') {
+            s->reply_multi = c;
+          } else {
+            last = TRUE;
+          }
+        } else {
+          /*回复之前的无效行，丢弃。*/
+          reply->cursor = s->reply_line_start;
+        }
+      } else {
+        last = has_code && c == s->reply_multi && line[3] != '-';
+      }
 
-    len = tk_iostream_read(ftp_fs->ios, buf + offset, available_len);
+      if (last) {
+        s->reply_partial = FALSE;
+        return_value_if_fail(wbuffer_extend_capacity(reply, reply->cursor + 1) == RET_OK,
+                             RET_OOM);
+        reply->data[reply->cursor] = '\0';
+        *code = s->reply_multi != 0 ? s->reply_multi : c;
 
-    if (len <= 0) {
-      log_warn("read failed\n");
-      break;
-    } else {
-      buf[offset + len] = '\0';
+        return RET_OK;
+      }
+      s->reply_line_start = reply->cursor;
     }
   }
 
-  return RET_OK;
+  return RET_BUSY;
 }
 
-static ret_t ftp_fs_cmd(ftp_fs_t* ftp_fs, const char* cmd, int32_t* ret_code, char* ret_data,
-                        uint32_t ret_data_size) {
-  char buf[FTP_BUF_MAX_SIZE] = {0};
-  int32_t len = strlen(cmd);
-  int32_t ret = tk_iostream_write(ftp_fs->ios, cmd, len);
-  return_value_if_fail(ret == len, RET_IO);
+static ret_t ftp_session_read_reply(ftp_session_t* s, int32_t* code) {
+  return_value_if_fail(s != NULL && code != NULL, RET_BAD_PARAMS);
 
-  ret = tk_iostream_read(ftp_fs->ios, buf, sizeof(buf) - 1);
-  return_value_if_fail(ret > 0, RET_IO);
+  while (TRUE) {
+    int32_t ret = ftp_session_parse_reply(s, code);
+    if (ret != RET_BUSY) {
+      return ret;
+    }
 
-  buf[ret] = '\0';
-  ret = tk_atoi(buf);
-  if (ret_code != NULL) {
-    *ret_code = ret;
+    ret = tk_iostream_read(s->ios, s->rbuf, sizeof(s->rbuf));
+    if (ret <= 0) {
+      s->reply_partial = FALSE;
+      s->broken = TRUE;
+      return RET_IO;
+    }
+    s->rbuf_offset = 0;
+    s->rbuf_len = ret;
+  }
+
+  return RET_FAIL;
+}
+
+/*不阻塞地读取回复，还没有收到完整的回复时返回RET_BUSY。*/
+static ret_t ftp_session_poll_reply(ftp_session_t* s, int32_t* code) {
+  int sock = TK_IOSTREAM_TCP(s->ios)->sock;
+
+  while (TRUE) {
+    int32_t ret = ftp_session_parse_reply(s, code);
+    if (ret != RET_BUSY) {
+      return ret;
+    }
+
+    if (tk_socket_wait_for_data(sock, 0) != RET_OK) {
+      return RET_BUSY;
+    }
+
+    ret = tk_iostream_read(s->ios, s->rbuf, sizeof(s->rbuf));
+    if (ret <= 0) {
+      s->reply_partial = FALSE;
+      s->broken = TRUE;
+      return RET_IO;
+    }
+    s->rbuf_offset = 0;
+    s->rbuf_len = ret;
   }
 
-  if (tk_str_start_with(buf, "213-Status of") || tk_str_start_with(buf, "213-Status follows")) {
-    ftp_fs_read_until_end(ftp_fs, buf, sizeof(buf) - 1, "213 End of status");
-  } else if (tk_str_start_with(buf, "213-Status begin")) {
-    ftp_fs_read_until_end(ftp_fs, buf, sizeof(buf) - 1, "213 Status end");
-  } else if (tk_str_start_with(buf, "212-Status begin")) {
-    ftp_fs_read_until_end(ftp_fs, buf, sizeof(buf) - 1, "212 Status end");
+  return RET_FAIL;
+}
+
+/*根据回复码设置最后的错误信息，1xx/2xx/3xx表示成功。ret_data返回回复码之后的文本。*/
+static ret_t ftp_session_check_reply(ftp_session_t* s, int32_t code, int32_t* ret_code,
+                                     char* ret_data, uint32_t ret_data_size) {
+  const char* reply = (const char*)(s->reply.data);
+
+  if (ret_code != NULL) {
+    *ret_code = code;
   }
 
   if (ret_data != NULL && ret_data_size > 0) {
-    const char* p = strchr(buf, ' ');
+    const char* p = strchr(reply, ' ');
     if (p != NULL) {
       tk_strncpy(ret_data, p + 1, ret_data_size);
     }
   }
 
-  if (ret >= 100 && ret < 400) {
-    ftp_fs->last_error_code = 0;
-    ftp_fs->last_error_message[0] = '\0';
+  if (code >= 100 && code < 400) {
+    s->last_error_code = 0;
+    s->last_error_message[0] = '\0';
     return RET_OK;
   } else {
-    ftp_fs->last_error_code = ret;
-    tk_strncpy(ftp_fs->last_error_message, buf, sizeof(ftp_fs->last_error_message) - 1);
+    s->last_error_code = code;
+    tk_strncpy(s->last_error_message, reply, sizeof(s->last_error_message) - 1);
     return RET_FAIL;
   }
 }
 
-static ret_t ftp_fs_login(ftp_fs_t* ftp_fs) {
+static ret_t ftp_session_cmd(ftp_session_t* s, const char* cmd, int32_t* ret_code, char* ret_data,
+                             uint32_t ret_data_size) {
+  int32_t code = 0;
+  int32_t len = strlen(cmd);
+  int32_t ret = tk_iostream_write(s->ios, cmd, len);
+  s->round_trips++;
+  if (ret != len) {
+    s->broken = TRUE;
+    return RET_IO;
+  }
+
+  ret = ftp_session_read_reply(s, &code);
+  if (ret != RET_OK) {
+    return ret;
+  }
+
+  return ftp_session_check_reply(s, code, ret_code, ret_data, ret_data_size);
+}
+
+static uint32_t ftp_features_parse(const char* reply) {
+  tokenizer_t t;
+  uint32_t features = 0;
+  char line[64] = {0};
+
+  tokenizer_init(&t, reply, strlen(reply), "\r\n");
+  while (tokenizer_has_more(&t)) {
+    const char* p = tokenizer_next(&t);
+    /*扩展每行一个，以空格开头。*/
+    if (p != NULL && p[0] == ' ') {
+      tk_strncpy(line, p + 1, sizeof(line) - 1);
+      tk_str_toupper(line);
+      if (tk_str_start_with(line, "REST STREAM")) {
+        features |= FTP_FEATURE_REST_STREAM;
+      } else if (tk_str_start_with(line, "HASH ")) {
+        /*HASH SHA-1;SHA-256*;MD5;CRC32，*表示当前选择的算法。*/
+        if (strstr(line, "CRC32") != NULL) {
+          features |= FTP_FEATURE_HASH_CRC32;
+        }
+        if (strstr(line, "SHA-256") != NULL) {
+          features |= FTP_FEATURE_HASH_SHA256;
+        }
+      } else if (tk_str_eq(line, "XCRC")) {
+        features |= FTP_FEATURE_XCRC;
+      } else if (tk_str_eq(line, "XSHA256")) {
+        features |= FTP_FEATURE_XSHA256;
+      } else if (tk_str_start_with(line, "MODE Z")) {
+        features |= FTP_FEATURE_MODE_Z;
+      } else if (tk_str_start_with(line, "MLST")) {
+        features |= FTP_FEATURE_MLST | FTP_FEATURE_MLSD;
+      } else if (tk_str_start_with(line, "SIZE")) {
+        features |= FTP_FEATURE_SIZE;
+      } else if (tk_str_start_with(line, "MDTM")) {
+        features |= FTP_FEATURE_MDTM;
+      } else if (tk_str_start_with(line, "EPSV")) {
+        features |= FTP_FEATURE_EPSV;
+      }
+    }
+  }
+  tokenizer_deinit(&t);
+
+  return features;
+}
+
+/*
+ * 用FEAT查询服务器支持的扩展，结果保存在ftp_fs中供所有连接使用。
+ * 建立第一个连接时就查询，这里只是在那次查询失败(如连接断开)时补上。
+ */
+static uint32_t ftp_session_load_features(ftp_session_t* s) {
+  bool_t loaded = FALSE;
+  uint32_t features = 0;
+  ftp_fs_t* ftp_fs = s->ftp_fs;
+
+  tk_mutex_lock(ftp_fs->mutex);
+  loaded = ftp_fs->features_loaded;
+  features = ftp_fs->features;
+  tk_mutex_unlock(ftp_fs->mutex);
+
+  if (!loaded) {
+    if (ftp_session_cmd(s, "FEAT\r\n", NULL, NULL, 0) == RET_OK) {
+      features = ftp_features_parse((const char*)(s->reply.data));
+    } else {
+      /*不支持FEAT的服务器先假设支持MLSD，第一次失败后就不再使用。*/
+      features = FTP_FEATURE_MLSD;
+    }
+
+    if (!s->broken) {
+      tk_mutex_lock(ftp_fs->mutex);
+      ftp_fs->features = features;
+      ftp_fs->features_loaded = TRUE;
+      tk_mutex_unlock(ftp_fs->mutex);
+    }
+  }
+
+  return features;
+}
+
+static bool_t ftp_session_has_feature(ftp_session_t* s, uint32_t feature) {
+  return (ftp_session_load_features(s) & feature) != 0;
+}
+
+/*服务器声明支持但实际上不能用的扩展(如EPSV在NAT后面不可用)，以后不再使用。*/
+static ret_t ftp_session_disable_feature(ftp_session_t* s, uint32_t feature) {
+  ftp_fs_t* ftp_fs = s->ftp_fs;
+
+  tk_mutex_lock(ftp_fs->mutex);
+  ftp_fs->features &= ~feature;
+  tk_mutex_unlock(ftp_fs->mutex);
+
+  return RET_OK;
+}
+
+static ret_t ftp_session_login(ftp_session_t* s) {
   char cmd[FTP_CMD_MAX_SIZE] = {0};
   ret_t ret = RET_FAIL;
+  ftp_fs_t* ftp_fs = s->ftp_fs;
+
   tk_snprintf(cmd, sizeof(cmd), "USER %s\r\n", ftp_fs->user);
-  ret = ftp_fs_cmd(ftp_fs, cmd, NULL, NULL, 0);
+  ret = ftp_session_cmd(s, cmd, NULL, NULL, 0);
   return_value_if_fail(ret == RET_OK, ret);
 
   tk_snprintf(cmd, sizeof(cmd), "PASS %s\r\n", ftp_fs->password);
-  ret = ftp_fs_cmd(ftp_fs, cmd, NULL, NULL, 0);
+  ret = ftp_session_cmd(s, cmd, NULL, NULL, 0);
   return_value_if_fail(ret == RET_OK, ret);
 
-  fs_ftp_binary_mode(ftp_fs);
+  ftp_session_binary_mode(s);
+
+  /*需要压缩时先用FEAT确认服务器支持MODE Z，MODE Z本身在第一个需要压缩的传输之前才发送。*/
+  if (ftp_fs->compress != FTP_FS_COMPRESS_NEVER) {
+    ftp_session_has_feature(s, FTP_FEATURE_MODE_Z);
+  }
 
   return RET_OK;
 }
 
-static ret_t ftp_fs_pasv(ftp_fs_t* ftp_fs) {
-  char cmd[FTP_CMD_MAX_SIZE] = {0};
-  ret_t ret = RET_FAIL;
-  char buf[FTP_CMD_MAX_SIZE] = {0};
+/*MODE是连接的状态，只在和需要的不同时切换。服务器不支持MODE Z时不压缩。*/
+static ret_t ftp_session_set_mode_z(ftp_session_t* s, bool_t mode_z) {
+  if (s->mode_z == mode_z || (mode_z && !ftp_session_has_feature(s, FTP_FEATURE_MODE_Z))) {
+    return RET_OK;
+  }
+
+  if (ftp_session_cmd(s, mode_z ? "MODE Z\r\n" : "MODE S\r\n", NULL, NULL, 0) == RET_OK) {
+    s->mode_z = mode_z;
+  } else if (!mode_z) {
+    /*回不到MODE S时后续按位置的传输都无法进行，丢弃这个连接。*/
+    s->broken = TRUE;
+    return RET_FAIL;
+  }
+
+  return RET_OK;
+}
+
+/*
+ * 服务器支持EPSV时用EPSV，回复中只有端口，数据连接直接连到控制连接的地址，
+ * 不会因为服务器在NAT后面返回内网地址而连不上。
+ */
+static const char* ftp_session_pasv_cmd(ftp_session_t* s) {
+  return ftp_session_has_feature(s, FTP_FEATURE_EPSV) ? "EPSV" : "PASV";
+}
+
+/*
+ * 按PASV的回复"227 Entering Passive Mode (h1,h2,h3,h4,p1,p2)"
+ * 或者EPSV的回复"229 Entering Extended Passive Mode (|||port|)"建立数据连接。
+ */
+static ret_t ftp_session_pasv_connect(ftp_session_t* s, const char* reply) {
   int ip0 = 0;
   int ip1 = 0;
   int ip2 = 0;
   int ip3 = 0;
+  int port = 0;
   int port_hi = 0;
   int port_lo = 0;
-  const char* p = NULL;
-
-  if (ftp_fs->data_ios != NULL) {
-    TK_OBJECT_UNREF(ftp_fs->data_ios);
-    ftp_fs->data_ios = NULL;
-  }
-
-  tk_snprintf(cmd, sizeof(cmd), "PASV\r\n");
-  ret = ftp_fs_cmd(ftp_fs, cmd, NULL, buf, sizeof(buf) - 1);
-  return_value_if_fail(ret == RET_OK, ret);
-
-  p = strchr(buf, '(');
+  const char* p = strchr(reply, '(');
   return_value_if_fail(p != NULL, RET_FAIL);
 
-  if (tk_sscanf(p, "(%d,%d,%d,%d,%d,%d)", &ip0, &ip1, &ip2, &ip3, &port_hi, &port_lo) == 6) {
+  if (tk_sscanf(p, "(|||%d|)", &port) == 1) {
+    s->data_port = port;
+    return ftp_session_open_data(s, s->ftp_fs->host, s->data_port);
+  } else if (tk_sscanf(p, "(%d,%d,%d,%d,%d,%d)", &ip0, &ip1, &ip2, &ip3, &port_hi, &port_lo) == 6) {
     char ip[128] = {0};
-    ftp_fs->data_port = port_hi * 256 + port_lo;
+    s->data_port = port_hi * 256 + port_lo;
     tk_snprintf(ip, sizeof(ip), "%d.%d.%d.%d", ip0, ip1, ip2, ip3);
-    ftp_fs->data_ios = tk_iostream_tcp_create_client(ip, ftp_fs->data_port);
-    return_value_if_fail(ftp_fs->data_ios != NULL, RET_IO);
-
-    return RET_OK;
+    return ftp_session_open_data(s, ip, s->data_port);
   }
 
   return RET_FAIL;
 }
 
-static ret_t ftp_fs_cmd_get_size(ftp_fs_t* ftp_fs, const char* filename, int32_t* size) {
+static ret_t ftp_session_pasv(ftp_session_t* s) {
   char cmd[FTP_CMD_MAX_SIZE] = {0};
   ret_t ret = RET_FAIL;
-  char buf[FTP_BUF_MAX_SIZE] = {0};
-  return_value_if_fail(filename != NULL && size != NULL, RET_BAD_PARAMS);
+  char buf[FTP_CMD_MAX_SIZE] = {0};
+  bool_t compress = s->compress_next;
 
-  tk_snprintf(cmd, sizeof(cmd), "SIZE %s\r\n", filename);
-  ret = ftp_fs_cmd(ftp_fs, cmd, NULL, buf, sizeof(buf) - 1);
-  return_value_if_fail(ret == RET_OK, ret);
+  ftp_session_close_data(s);
 
-  *size = tk_atoi(buf);
+  s->compress_next = FALSE;
+  return_value_if_fail(ftp_session_set_mode_z(s, compress) == RET_OK, RET_FAIL);
 
-  return RET_OK;
+  tk_snprintf(cmd, sizeof(cmd), "%s\r\n", ftp_session_pasv_cmd(s));
+  ret = ftp_session_cmd(s, cmd, NULL, buf, sizeof(buf) - 1);
+  if (ret != RET_OK && !s->broken && ftp_session_has_feature(s, FTP_FEATURE_EPSV)) {
+    ftp_session_disable_feature(s, FTP_FEATURE_EPSV);
+    ret = ftp_session_cmd(s, "PASV\r\n", NULL, buf, sizeof(buf) - 1);
+  }
+  return_value_if_fail(ret == RET_OK, ret);
+
+  return ftp_session_pasv_connect(s, buf);
 }
 
-static ret_t ftp_fs_cmd_stat(ftp_fs_t* ftp_fs, const char* filename, fs_stat_info_t* fst) {
-  char cmd[FTP_CMD_MAX_SIZE] = {0};
-  ret_t ret = RET_FAIL;
-  char buf[FTP_BUF_MAX_SIZE] = {0};
+/*
+ * MLST的结果在控制连接上返回，以空格开头的一行就是和MLSD一样的事实列表，如：
+ * 250-Listing /test.bin\r\n type=file;size=1650;modify=20231025131200; /test.bin\r\n250 End\r\n
+ */
+static ret_t ftp_session_cmd_mlst(ftp_session_t* s, const char* filename, fs_stat_info_t* fst) {
+  fs_item_t item;
+  const char* p = NULL;
+  const char* end = NULL;
+  uint32_t len = 0;
+  char cmd[FTP_CMD_MAX_SIZE] = {0};
+  char line[FTP_BUF_MAX_SIZE] = {0};
+
+  tk_snprintf(cmd, sizeof(cmd), "MLST %s\r\n", filename);
+  return_value_if_fail(ftp_session_cmd(s, cmd, NULL, NULL, 0) == RET_OK, RET_FAIL);
+
+  p = strstr((const char*)(s->reply.data), "\r\n ");
+  return_value_if_fail(p != NULL, RET_FAIL);
+  p += 3;
+  end = strstr(p, "\r\n");
+  len = sizeof(line) - 1;
+  if (end != NULL && (uint32_t)(end - p) < len) {
+    len = (uint32_t)(end - p);
+  }
+  tk_strncpy(line, p, len);
+
+  memset(&item, 0x00, sizeof(item));
+  return fs_item_parse_mlsd(&item, fst, line) != NULL ? RET_OK : RET_FAIL;
+}
+
+static ret_t ftp_session_cmd_get_size(ftp_session_t* s, const char* filename, uint64_t* size) {
+  char cmd[FTP_CMD_MAX_SIZE] = {0};
+  ret_t ret = RET_FAIL;
+  char buf[FTP_BUF_MAX_SIZE] = {0};
+  return_value_if_fail(filename != NULL && size != NULL, RET_BAD_PARAMS);
+
+  /*不支持SIZE的服务器用MLST获取长度，和SIZE一样只需要一次往返。*/
+  if (!ftp_session_has_feature(s, FTP_FEATURE_SIZE) &&
+      ftp_session_has_feature(s, FTP_FEATURE_MLST)) {
+    fs_stat_info_t st;
+    return_value_if_fail(ftp_session_cmd_mlst(s, filename, &st) == RET_OK, RET_FAIL);
+    return_value_if_fail(!st.is_dir, RET_FAIL);
+    *size = st.size;
+    return RET_OK;
+  }
+
+  tk_snprintf(cmd, sizeof(cmd), "SIZE %s\r\n", filename);
+  ret = ftp_session_cmd(s, cmd, NULL, buf, sizeof(buf) - 1);
+  return_value_if_fail(ret == RET_OK, ret);
+
+  *size = tk_atoul(buf);
+
+  return RET_OK;
+}
+
+static ret_t ftp_session_cmd_stat(ftp_session_t* s, const char* filename, fs_stat_info_t* fst) {
+  char cmd[FTP_CMD_MAX_SIZE] = {0};
+  ret_t ret = RET_FAIL;
+  char buf[FTP_BUF_MAX_SIZE] = {0};
   const char* p = NULL;
   tokenizer_t t;
+  const char* stat_cmd = s->ftp_fs->stat_cmd;
   return_value_if_fail(filename != NULL && fst != NULL, RET_BAD_PARAMS);
 
-  memset(fst, 0x00, sizeof(*fst));
+  memset(fst, 0x00, sizeof(*fst));
+
+  if (ftp_session_has_feature(s, FTP_FEATURE_MLST)) {
+    return ftp_session_cmd_mlst(s, filename, fst);
+  } else if (stat_cmd != NULL) {
+    tk_snprintf(cmd, sizeof(cmd), "%s %s\r\n", stat_cmd, filename);
+    ret = ftp_session_cmd(s, cmd, NULL, buf, sizeof(buf) - 1);
+  } else {
+    tk_snprintf(cmd, sizeof(cmd), "XSTAT %s\r\n", filename);
+    ret = ftp_session_cmd(s, cmd, NULL, buf, sizeof(buf) - 1);
+    if (ret != RET_OK) {
+      if (s->last_error_code == 500 || s->last_error_code == 502) {
+        /*记住服务器不支持XSTAT，以后直接用STAT。*/
+        tk_mutex_lock(s->ftp_fs->mutex);
+        s->ftp_fs->stat_cmd = "STAT";
+        tk_mutex_unlock(s->ftp_fs->mutex);
+        tk_snprintf(cmd, sizeof(cmd), "STAT %s\r\n", filename);
+        ret = ftp_session_cmd(s, cmd, NULL, buf, sizeof(buf) - 1);
+      } else {
+        return ret;
+      }
+    }
+  }
+  return_value_if_fail(ret == RET_OK, ret);
+
+  p = strstr(buf, "\r\n");
+  if (p != NULL && p[2]) {
+    p += strlen("\r\n");
+    // p = 213-Status of \"/test.bin\":\r\n-rw-r--r--   1 jim      staff        1650 Oct 25 13:12 test.bin\r\n213 End of status.\r\n
+    tokenizer_init(&t, p, strlen(p), " ");
+    if (tokenizer_has_more(&t)) {
+      p = tokenizer_next(&t);  // -rw-r--r--
+      if (tk_strcmp(p, "213") == 0) {
+        fst->is_dir = TRUE;
+        //空目录可能没有内容，比如："/abc":\r\n213 End of status.\r\n
+      } else {
+        fst->is_reg_file = p[0] == '-';
+        fst->is_dir = p[0] == 'd';
+        p = tokenizer_next(&t);                   // 1
+        p = tokenizer_next(&t);                   // jim
+        p = tokenizer_next(&t);                   // staff
+        fst->size = tokenizer_next_int64(&t, 0);  // 1650
+        p = tokenizer_next(&t);                   // Oct
+        p = tokenizer_next(&t);                   // 25
+        p = tokenizer_next(&t);                   // 13:12
+      }
+    }
+    tokenizer_deinit(&t);
+  } else {
+    tokenizer_init(&t, buf, strlen(buf), " ");
+    fst->size = tokenizer_next_int64(&t, 0);
+    fst->mtime = tokenizer_next_int64(&t, 0);
+    fst->ctime = tokenizer_next_int64(&t, 0);
+    fst->atime = tokenizer_next_int64(&t, 0);
+    fst->is_dir = tokenizer_next_int(&t, 0);
+    fst->is_link = tokenizer_next_int(&t, 0);
+    fst->is_reg_file = tokenizer_next_int(&t, 0);
+    fst->uid = tokenizer_next_int(&t, 0);
+    fst->gid = tokenizer_next_int(&t, 0);
+    tokenizer_deinit(&t);
+  }
+
+  return RET_OK;
+}
+
+static ret_t ftp_session_cmd_get_pwd(ftp_session_t* s, char* path, uint32_t path_size) {
+  char cmd[FTP_CMD_MAX_SIZE] = {0};
+  ret_t ret = RET_FAIL;
+  char buf[FTP_BUF_MAX_SIZE] = {0};
+  const char* p = NULL;
+  const char* pend = NULL;
+  return_value_if_fail(path != NULL && path_size > 0, RET_BAD_PARAMS);
+
+  tk_snprintf(cmd, sizeof(cmd), "PWD\r\n");
+  ret = ftp_session_cmd(s, cmd, NULL, buf, sizeof(buf) - 1);
+  return_value_if_fail(ret == RET_OK, ret);
+
+  p = strchr(buf, '"');
+  if (p != NULL) {
+    p += 1;
+    pend = strchr(p, '"');
+    if (pend != NULL) {
+      tk_strncpy(path, p, tk_min(pend - p, path_size));
+      return RET_OK;
+    }
+  }
+
+  return RET_FAIL;
+}
+
+static ret_t ftp_session_destroy(ftp_session_t* s) {
+  return_value_if_fail(s != NULL, RET_BAD_PARAMS);
+
+  TK_OBJECT_UNREF(s->data_ios);
+  TK_OBJECT_UNREF(s->ios);
+  wbuffer_deinit(&(s->reply));
+  TKMEM_FREE(s->buffer);
+  TKMEM_FREE(s->zbuffer);
+  TKMEM_FREE(s);
+
+  return RET_OK;
+}
+
+static ftp_session_t* ftp_session_create(ftp_fs_t* ftp_fs, char* welcome, uint32_t welcome_size) {
+  int32_t code = 0;
+  ftp_session_t* s = TKMEM_ZALLOC(ftp_session_t);
+  return_value_if_fail(s != NULL, NULL);
+
+  s->ftp_fs = ftp_fs;
+  wbuffer_init_extendable(&(s->reply));
+  s->ios = tk_iostream_tcp_create_client(ftp_fs->host, ftp_fs->port);
+  goto_error_if_fail(s->ios != NULL);
+
+  /*welcome message*/
+  goto_error_if_fail(ftp_session_read_reply(s, &code) == RET_OK);
+  log_debug("%s", (const char*)(s->reply.data));
+  if (welcome != NULL) {
+    tk_strncpy(welcome, (const char*)(s->reply.data), welcome_size - 1);
+  }
+
+  goto_error_if_fail(ftp_session_login(s) == RET_OK);
+  tk_strncpy(s->cwd, ftp_fs->home, sizeof(s->cwd) - 1);
+
+  return s;
+error:
+  ftp_session_destroy(s);
+
+  return NULL;
+}
+
+/*
+ * wait为FALSE时，没有空闲的连接也不能建立新连接就立即返回NULL，用于不能阻塞的调用者。
+ * reason不为NULL时返回失败原因(在锁内判断)：RET_BUSY表示连接都在使用中，RET_IO表示无法建立连接。
+ */
+static ftp_session_t* ftp_fs_checkout_ex(ftp_fs_t* ftp_fs, bool_t wait, ret_t* reason) {
+  uint32_t i = 0;
+  ftp_session_t* s = NULL;
+  char cwd[MAX_PATH + 1] = {0};
+  return_value_if_fail(ftp_fs != NULL, NULL);
+
+  if (reason != NULL) {
+    *reason = RET_OK;
+  }
+
+  tk_mutex_lock(ftp_fs->mutex);
+  while (s == NULL) {
+    for (i = 0; i < ftp_fs->sessions.size; i++) {
+      ftp_session_t* iter = (ftp_session_t*)darray_get(&ftp_fs->sessions, i);
+      if (!iter->busy) {
+        s = iter;
+        break;
+      }
+    }
+
+    if (s == NULL) {
+      if (ftp_fs->sessions.size + ftp_fs->connecting < ftp_fs->max_sessions) {
+        /*连接和登录比较耗时，不要占用锁。*/
+        ftp_fs->connecting++;
+        tk_mutex_unlock(ftp_fs->mutex);
+        s = ftp_session_create(ftp_fs, NULL, 0);
+        tk_mutex_lock(ftp_fs->mutex);
+        ftp_fs->connecting--;
+
+        if (s == NULL || darray_push(&ftp_fs->sessions, s) != RET_OK) {
+          if (s != NULL) {
+            ftp_session_destroy(s);
+            s = NULL;
+          }
+          tk_cond_broadcast(ftp_fs->cond);
+          tk_mutex_unlock(ftp_fs->mutex);
+          if (reason != NULL) {
+            *reason = RET_IO;
+          }
+          return NULL;
+        }
+      } else if (wait) {
+        tk_cond_wait(ftp_fs->cond, ftp_fs->mutex);
+      } else {
+        /*没有已经建立的连接时，等待不会有结果。*/
+        if (reason != NULL) {
+          *reason = (ftp_fs->sessions.size + ftp_fs->connecting) > 0 ? RET_BUSY : RET_IO;
+        }
+        tk_mutex_unlock(ftp_fs->mutex);
+        return NULL;
+      }
+    }
+  }
+  s->busy = TRUE;
+  tk_strncpy(cwd, ftp_fs->cwd, sizeof(cwd) - 1);
+  tk_mutex_unlock(ftp_fs->mutex);
+
+  if (cwd[0] != '\0' && !tk_str_eq(s->cwd, cwd)) {
+    ftp_session_cwd(s, cwd);
+  }
+
+  return s;
+}
+
+static ftp_session_t* ftp_fs_checkout(ftp_fs_t* ftp_fs) {
+  return ftp_fs_checkout_ex(ftp_fs, TRUE, NULL);
+}
+
+/*每个线程最后一次操作的错误，调用者需要持有锁。*/
+typedef struct _ftp_thread_error_t {
+  uint64_t thread_id;
+  int code;
+  char message[256];
+} ftp_thread_error_t;
+
+/*最多记录的线程数，超过时丢弃最早记录的线程。*/
+#define FTP_FS_MAX_THREAD_ERRORS 32
+
+static ret_t ftp_fs_set_thread_error(ftp_fs_t* ftp_fs, int code, const char* message) {
+  uint32_t i = 0;
+  uint64_t thread_id = tk_thread_self();
+  ftp_thread_error_t* error = NULL;
+
+  for (i = 0; i < ftp_fs->thread_errors.size; i++) {
+    ftp_thread_error_t* iter = (ftp_thread_error_t*)darray_get(&ftp_fs->thread_errors, i);
+    if (iter->thread_id == thread_id) {
+      error = iter;
+      break;
+    }
+  }
+
+  if (error == NULL) {
+    if (ftp_fs->thread_errors.size >= FTP_FS_MAX_THREAD_ERRORS) {
+      darray_remove_index(&ftp_fs->thread_errors, 0);
+    }
+    error = TKMEM_ZALLOC(ftp_thread_error_t);
+    return_value_if_fail(error != NULL, RET_OOM);
+    error->thread_id = thread_id;
+    if (darray_push(&ftp_fs->thread_errors, error) != RET_OK) {
+      TKMEM_FREE(error);
+      return RET_OOM;
+    }
+  }
+
+  error->code = code;
+  tk_strncpy(error->message, message, sizeof(error->message) - 1);
+
+  return RET_OK;
+}
+
+static ret_t ftp_fs_checkin(ftp_fs_t* ftp_fs, ftp_session_t* s) {
+  return_value_if_fail(ftp_fs != NULL && s != NULL, RET_BAD_PARAMS);
+
+  /*空闲的连接总是处于MODE S，其它调用者(包括非阻塞传输)不需要再检查。*/
+  if (s->mode_z && !s->broken) {
+    ftp_session_set_mode_z(s, FALSE);
+  }
+
+  tk_mutex_lock(ftp_fs->mutex);
+  ftp_fs->round_trips += s->round_trips;
+  s->round_trips = 0;
+  ftp_fs->last_error_code = s->last_error_code;
+  tk_strncpy(ftp_fs->last_error_message, s->last_error_message,
+             sizeof(ftp_fs->last_error_message) - 1);
+  ftp_fs_set_thread_error(ftp_fs, s->last_error_code, s->last_error_message);
+
+  if (s->broken) {
+    /*连接已经不可用，丢弃它，下次需要时重新建立。*/
+    darray_remove(&ftp_fs->sessions, s);
+  } else {
+    s->busy = FALSE;
+  }
+  tk_cond_broadcast(ftp_fs->cond);
+  tk_mutex_unlock(ftp_fs->mutex);
+
+  return RET_OK;
+}
+
+/*生成本进程内唯一的临时文件编号。*/
+static uint32_t ftp_fs_next_temp_id(ftp_fs_t* ftp_fs) {
+  uint32_t id = 0;
+
+  tk_mutex_lock(ftp_fs->mutex);
+  id = ++ftp_fs->temp_seq;
+  tk_mutex_unlock(ftp_fs->mutex);
+
+  return id;
+}
+
+static ret_t ftp_fs_abs_path(ftp_fs_t* ftp_fs, const char* name, char* path, uint32_t path_size) {
+  char cwd[MAX_PATH + 1] = {0};
+
+  tk_mutex_lock(ftp_fs->mutex);
+  tk_strncpy(cwd, ftp_fs->cwd, sizeof(cwd) - 1);
+  tk_mutex_unlock(ftp_fs->mutex);
+
+  return ftp_path_normalize(cwd, name, path, path_size);
+}
+
+/*stat_cache按路径排序，调用者需要持有锁。*/
+static int32_t ftp_fs_stat_cache_find(ftp_fs_t* ftp_fs, const char* path, bool_t* found) {
+  int32_t low = 0;
+  int32_t high = (int32_t)(ftp_fs->stat_cache.size) - 1;
+
+  *found = FALSE;
+  while (low <= high) {
+    int32_t mid = low + (high - low) / 2;
+    ftp_stat_entry_t* iter = (ftp_stat_entry_t*)darray_get(&ftp_fs->stat_cache, mid);
+    int result = strcmp(iter->path, path);
+
+    if (result == 0) {
+      *found = TRUE;
+      return mid;
+    } else if (result < 0) {
+      low = mid + 1;
+    } else {
+      high = mid - 1;
+    }
+  }
+
+  return low;
+}
+
+static bool_t ftp_fs_stat_cache_get(ftp_fs_t* ftp_fs, const char* path, fs_stat_info_t* fst,
+                                    ret_t* ret) {
+  int32_t index = 0;
+  bool_t found = FALSE;
+  return_value_if_fail(ftp_fs->stat_cache_ttl > 0, FALSE);
+
+  tk_mutex_lock(ftp_fs->mutex);
+  index = ftp_fs_stat_cache_find(ftp_fs, path, &found);
+  if (found) {
+    ftp_stat_entry_t* entry = (ftp_stat_entry_t*)darray_get(&ftp_fs->stat_cache, index);
+    if (entry->expire > time_now_ms()) {
+      *fst = entry->info;
+      *ret = entry->ret;
+    } else {
+      darray_remove_index(&ftp_fs->stat_cache, index);
+      found = FALSE;
+    }
+  }
+  tk_mutex_unlock(ftp_fs->mutex);
+
+  return found;
+}
+
+static ret_t ftp_fs_stat_cache_purge(ftp_fs_t* ftp_fs, uint64_t now) {
+  int32_t i = 0;
+
+  for (i = (int32_t)(ftp_fs->stat_cache.size) - 1; i >= 0; i--) {
+    ftp_stat_entry_t* iter = (ftp_stat_entry_t*)darray_get(&ftp_fs->stat_cache, i);
+    if (iter->expire <= now) {
+      darray_remove_index(&ftp_fs->stat_cache, i);
+    }
+  }
+
+  if (ftp_fs->stat_cache.size >= FTP_FS_STAT_CACHE_MAX_SIZE) {
+    darray_clear(&ftp_fs->stat_cache);
+  }
+
+  return RET_OK;
+}
+
+static ret_t ftp_fs_stat_cache_put(ftp_fs_t* ftp_fs, const char* path, const fs_stat_info_t* fst,
+                                   ret_t ret) {
+  int32_t index = 0;
+  bool_t found = FALSE;
+  ftp_stat_entry_t* entry = NULL;
+  uint64_t now = time_now_ms();
+  return_value_if_fail(ftp_fs->stat_cache_ttl > 0, RET_OK);
+
+  tk_mutex_lock(ftp_fs->mutex);
+  if (ftp_fs->stat_cache.size >= FTP_FS_STAT_CACHE_MAX_SIZE) {
+    ftp_fs_stat_cache_purge(ftp_fs, now);
+  }
+
+  index = ftp_fs_stat_cache_find(ftp_fs, path, &found);
+  if (found) {
+    entry = (ftp_stat_entry_t*)darray_get(&ftp_fs->stat_cache, index);
+  } else {
+    entry = TKMEM_ZALLOC(ftp_stat_entry_t);
+    if (entry != NULL) {
+      tk_strncpy(entry->path, path, sizeof(entry->path) - 1);
+      if (darray_insert(&ftp_fs->stat_cache, index, entry) != RET_OK) {
+        TKMEM_FREE(entry);
+      }
+    }
+  }
+
+  if (entry != NULL) {
+    if (fst != NULL) {
+      entry->info = *fst;
+    } else {
+      memset(&(entry->info), 0x00, sizeof(entry->info));
+    }
+    entry->ret = ret;
+    entry->expire = now + ftp_fs->stat_cache_ttl;
+  }
+  tk_mutex_unlock(ftp_fs->mutex);
+
+  return RET_OK;
+}
+
+/*删除path以及它下面所有文件的缓存。*/
+static ret_t ftp_fs_stat_cache_invalidate(ftp_fs_t* ftp_fs, const char* name) {
+  int32_t i = 0;
+  uint32_t len = 0;
+  char path[MAX_PATH + 1] = {0};
+  return_value_if_fail(ftp_fs->stat_cache_ttl > 0 && name != NULL, RET_OK);
+
+  ftp_fs_abs_path(ftp_fs, name, path, sizeof(path));
+  len = strlen(path);
+
+  tk_mutex_lock(ftp_fs->mutex);
+  for (i = (int32_t)(ftp_fs->stat_cache.size) - 1; i >= 0; i--) {
+    ftp_stat_entry_t* iter = (ftp_stat_entry_t*)darray_get(&ftp_fs->stat_cache, i);
+    if (strncmp(iter->path, path, len) == 0 &&
+        (iter->path[len] == '\0' || iter->path[len] == '/' || len == 1)) {
+      darray_remove_index(&ftp_fs->stat_cache, i);
+    }
+  }
+  tk_mutex_unlock(ftp_fs->mutex);
+
+  return RET_OK;
+}
+
+/*known_dirs按路径排序，保存本次会话中确认存在或者创建过的远程目录(绝对路径)，调用者需要持有锁。*/
+static int32_t ftp_fs_known_dir_find(ftp_fs_t* ftp_fs, const char* path, bool_t* found) {
+  int32_t low = 0;
+  int32_t high = (int32_t)(ftp_fs->known_dirs.size) - 1;
+
+  *found = FALSE;
+  while (low <= high) {
+    int32_t mid = low + (high - low) / 2;
+    int result = strcmp((const char*)darray_get(&ftp_fs->known_dirs, mid), path);
+
+    if (result == 0) {
+      *found = TRUE;
+      return mid;
+    } else if (result < 0) {
+      low = mid + 1;
+    } else {
+      high = mid - 1;
+    }
+  }
+
+  return low;
+}
+
+static bool_t ftp_fs_known_dir_has(ftp_fs_t* ftp_fs, const char* path) {
+  bool_t found = FALSE;
+  return_value_if_fail(!tk_str_eq(path, "/"), TRUE);
+
+  tk_mutex_lock(ftp_fs->mutex);
+  ftp_fs_known_dir_find(ftp_fs, path, &found);
+  tk_mutex_unlock(ftp_fs->mutex);
+
+  return found;
+}
+
+/*目录存在时它的上级目录也都存在，一起记录下来。*/
+static ret_t ftp_fs_known_dir_add(ftp_fs_t* ftp_fs, const char* path) {
+  char dir[MAX_PATH + 1] = {0};
+  char parent[MAX_PATH + 1] = {0};
+
+  tk_strncpy(dir, path, sizeof(dir) - 1);
+  tk_mutex_lock(ftp_fs->mutex);
+  if (ftp_fs->known_dirs.size >= FTP_FS_KNOWN_DIRS_MAX_SIZE) {
+    darray_clear(&ftp_fs->known_dirs);
+  }
+
+  while (!tk_str_eq(dir, "/")) {
+    bool_t found = FALSE;
+    int32_t index = ftp_fs_known_dir_find(ftp_fs, dir, &found);
+    char* str = NULL;
+    break_if_fail(!found);
+
+    str = tk_strdup(dir);
+    break_if_fail(str != NULL);
+    if (darray_insert(&ftp_fs->known_dirs, index, str) != RET_OK) {
+      TKMEM_FREE(str);
+      break;
+    }
+
+    break_if_fail(ftp_path_get_parent(dir, parent, sizeof(parent)) == RET_OK);
+    tk_strncpy(dir, parent, sizeof(dir) - 1);
+  }
+  tk_mutex_unlock(ftp_fs->mutex);
+
+  return RET_OK;
+}
+
+/*目录被删除或者改名后，删除它以及它下面所有目录的记录。*/
+static ret_t ftp_fs_known_dir_forget(ftp_fs_t* ftp_fs, const char* path) {
+  int32_t i = 0;
+  uint32_t len = strlen(path);
+
+  tk_mutex_lock(ftp_fs->mutex);
+  for (i = (int32_t)(ftp_fs->known_dirs.size) - 1; i >= 0; i--) {
+    const char* iter = (const char*)darray_get(&ftp_fs->known_dirs, i);
+    if (strncmp(iter, path, len) == 0 && (iter[len] == '\0' || iter[len] == '/' || len == 1)) {
+      darray_remove_index(&ftp_fs->known_dirs, i);
+    }
+  }
+  tk_mutex_unlock(ftp_fs->mutex);
+
+  return RET_OK;
+}
+
+/*name是相对于ftp_fs当前目录的路径。*/
+static ret_t ftp_fs_known_dir_update(ftp_fs_t* ftp_fs, const char* name, bool_t exist) {
+  char path[MAX_PATH + 1] = {0};
+  return_value_if_fail(name != NULL, RET_BAD_PARAMS);
+
+  ftp_fs_abs_path(ftp_fs, name, path, sizeof(path));
+  if (exist) {
+    return ftp_fs_known_dir_add(ftp_fs, path);
+  } else {
+    return ftp_fs_known_dir_forget(ftp_fs, path);
+  }
+}
+
+typedef struct _fs_ftp_file_t {
+  fs_file_t file;
+  ftp_fs_t* ftp_fs;
+  char name[MAX_PATH + 1];
+  char temp_path[MAX_PATH + 1];
+  fs_file_t* temp_file;
+  bool_t changed;
+  bool_t cached;
+  bool_t append;
+  /*打开时远程文件是否存在及其大小。*/
+  bool_t existed;
+  uint64_t remote_size;
+  /*修改过的区间(按FTP_FS_BLOCK_SIZE对齐，按位置排序，互不重叠)。*/
+  darray_t dirty;
+  /*实际写入的最低位置(没有对齐)，用于判断是否只在末尾追加了数据，没有写入时为UINT64_MAX。*/
+  uint64_t dirty_start;
+  /*清空过文件、截短到remote_size以下或者修改的区间太多时，需要上传整个文件。*/
+  bool_t full_upload;
+} fs_ftp_file_t;
+
+typedef struct _ftp_range_t {
+  uint64_t start;
+  uint64_t end;
+} ftp_range_t;
+
+/*多数服务器在RETR的150回复中给出长度，如"150 Opening BINARY mode data connection for a.bin (1234 bytes)"。*/
+static uint64_t ftp_reply_get_bytes(const char* reply) {
+  const char* p = reply != NULL ? strstr(reply, " bytes)") : NULL;
+
+  if (p != NULL) {
+    while (p > reply && tk_isdigit(p[-1])) {
+      p--;
+    }
+    if (p > reply && p[-1] == '(') {
+      return (uint64_t)tk_atoul(p);
+    }
+  }
+
+  return 0;
+}
+
+static ret_t ftp_session_progress(ftp_session_t* s, uint64_t size) {
+  if (s->on_progress == NULL) {
+    return RET_OK;
+  }
+
+  if (s->progress_total == 0 && s->progress_done == 0) {
+    s->progress_total = ftp_reply_get_bytes((const char*)(s->reply.data));
+  }
+  s->progress_done += size;
+
+  return s->on_progress(s->on_progress_ctx, s->progress_done, s->progress_total);
+}
+
+static ret_t ftp_session_set_on_progress(ftp_session_t* s, ftp_fs_on_progress_t on_progress,
+                                         void* ctx, uint64_t total) {
+  /*ftp_fs_abort_transfer用on_progress_ctx查找连接。*/
+  tk_mutex_lock(s->ftp_fs->data_mutex);
+  s->on_progress = on_progress;
+  s->on_progress_ctx = ctx;
+  tk_mutex_unlock(s->ftp_fs->data_mutex);
+  s->progress_done = 0;
+  s->progress_total = total;
+
+  return RET_OK;
+}
+
+/*取出回复中第index个(从0开始)由空格分隔的字段作为校验值，统一转换成小写。*/
+static ret_t ftp_hash_reply_get(const char* reply, uint32_t index, char* hash, uint32_t size) {
+  tokenizer_t t;
+  uint32_t i = 0;
+  const char* p = NULL;
+
+  tokenizer_init(&t, reply, strlen(reply), " \r\n");
+  for (i = 0; i <= index && tokenizer_has_more(&t); i++) {
+    p = tokenizer_next(&t);
+  }
+  if (i == index + 1 && p != NULL) {
+    tk_strncpy(hash, p, size - 1);
+    tk_str_tolower(hash);
+  } else {
+    hash[0] = '\0';
+  }
+  tokenizer_deinit(&t);
+
+  return hash[0] != '\0' ? RET_OK : RET_FAIL;
+}
+
+/*有的服务器返回的CRC32省略了前导0，按数值比较。*/
+static bool_t ftp_hash_equal(ftp_fs_hash_type_t type, const char* a, const char* b) {
+  if (type == FTP_FS_HASH_CRC32) {
+    uint32_t va = 0;
+    uint32_t vb = 0;
+    return tk_sscanf(a, "%x", &va) == 1 && tk_sscanf(b, "%x", &vb) == 1 && va == vb;
+  }
+
+  return tk_str_ieq(a, b);
+}
+
+/*服务器支持HASH时优先使用，否则用XCRC/XSHA256。*/
+static ret_t ftp_session_cmd_hash(ftp_session_t* s, const char* filename, ftp_fs_hash_type_t type,
+                                  char* hash, uint32_t size) {
+  char cmd[FTP_CMD_MAX_SIZE] = {0};
+  char buf[FTP_BUF_MAX_SIZE] = {0};
+  bool_t crc32 = type == FTP_FS_HASH_CRC32;
+  return_value_if_fail(filename != NULL && hash != NULL && size > 0, RET_BAD_PARAMS);
+  return_value_if_fail(type != FTP_FS_HASH_NONE, RET_BAD_PARAMS);
+
+  if (ftp_session_has_feature(s, crc32 ? FTP_FEATURE_HASH_CRC32 : FTP_FEATURE_HASH_SHA256)) {
+    /*OPTS HASH选择的算法对整个连接有效，只在改变时发送。*/
+    if (s->hash_algo != type) {
+      tk_snprintf(cmd, sizeof(cmd), "OPTS HASH %s\r\n", crc32 ? "CRC32" : "SHA-256");
+      return_value_if_fail(ftp_session_cmd(s, cmd, NULL, NULL, 0) == RET_OK, RET_FAIL);
+      s->hash_algo = type;
+    }
+
+    /*213 SHA-256 0-1234 7f83b1657ff1fc53b92dc18148a1d65dfc2d4b1fa3d677284addd200126d9069 a.bin*/
+    tk_snprintf(cmd, sizeof(cmd), "HASH %s\r\n", filename);
+    return_value_if_fail(ftp_session_cmd(s, cmd, NULL, buf, sizeof(buf) - 1) == RET_OK, RET_FAIL);
+
+    return ftp_hash_reply_get(buf, 2, hash, size);
+  } else if (ftp_session_has_feature(s, crc32 ? FTP_FEATURE_XCRC : FTP_FEATURE_XSHA256)) {
+    /*250 1A2B3C4D*/
+    tk_snprintf(cmd, sizeof(cmd), "%s %s\r\n", crc32 ? "XCRC" : "XSHA256", filename);
+    return_value_if_fail(ftp_session_cmd(s, cmd, NULL, buf, sizeof(buf) - 1) == RET_OK, RET_FAIL);
+
+    return ftp_hash_reply_get(buf, 0, hash, size);
+  }
+
+  return RET_NOT_IMPL;
+}
+
+/*服务器不能计算设置的校验值时返回FTP_FS_HASH_NONE，这时也不用在传输时计算。*/
+static ftp_fs_hash_type_t ftp_session_get_hash_type(ftp_session_t* s) {
+  ftp_fs_hash_type_t type = s->ftp_fs->hash_type;
+
+  if (type == FTP_FS_HASH_CRC32 &&
+      ftp_session_has_feature(s, FTP_FEATURE_HASH_CRC32 | FTP_FEATURE_XCRC)) {
+    return type;
+  } else if (type == FTP_FS_HASH_SHA256 &&
+             ftp_session_has_feature(s, FTP_FEATURE_HASH_SHA256 | FTP_FEATURE_XSHA256)) {
+    return type;
+  }
+
+  return FTP_FS_HASH_NONE;
+}
+
+static ret_t ftp_session_hash_begin(ftp_session_t* s, ftp_fs_hash_type_t type) {
+  s->hash_type = type;
+  if (type == FTP_FS_HASH_CRC32) {
+    s->crc32 = tk_crc32_init();
+  } else if (type == FTP_FS_HASH_SHA256) {
+    tk_sha256_init(&(s->sha256));
+  }
+
+  return RET_OK;
+}
+
+static ret_t ftp_session_hash_update(ftp_session_t* s, const uint8_t* data, uint32_t size) {
+  if (s->hash_type == FTP_FS_HASH_CRC32) {
+    s->crc32 = tk_crc32(s->crc32, data, size);
+  } else if (s->hash_type == FTP_FS_HASH_SHA256) {
+    tk_sha256_hash(&(s->sha256), data, size);
+  }
+
+  return RET_OK;
+}
+
+/*结束计算，hash为小写十六进制字符串(至少FTP_HASH_MAX_SIZE个字节)。*/
+static ret_t ftp_session_hash_end(ftp_session_t* s, char* hash) {
+  uint32_t i = 0;
+  ftp_fs_hash_type_t type = s->hash_type;
+  uint8_t digest[TK_SHA256_HASH_LEN + 1] = {0};
+
+  s->hash_type = FTP_FS_HASH_NONE;
+  hash[0] = '\0';
+  if (type == FTP_FS_HASH_CRC32) {
+    /*tk_crc32没有做最后的取反，取反后才是标准的CRC32。*/
+    tk_snprintf(hash, FTP_HASH_MAX_SIZE, "%08x", (unsigned int)(~(s->crc32)));
+  } else if (type == FTP_FS_HASH_SHA256) {
+    tk_sha256_done(&(s->sha256), digest);
+    for (i = 0; i < TK_SHA256_HASH_LEN; i++) {
+      tk_snprintf(hash + i * 2, 3, "%02x", digest[i]);
+    }
+  }
+
+  return hash[0] != '\0' ? RET_OK : RET_FAIL;
+}
+
+static ret_t ftp_session_file_hash(ftp_session_t* s, const char* filename, ftp_fs_hash_type_t type,
+                                   char* hash) {
+  int32_t ret = 0;
+  uint32_t buf_size = 0;
+  fs_file_t* file = NULL;
+  uint8_t* buf = ftp_session_get_buffer(s, &buf_size);
+  return_value_if_fail(buf != NULL, RET_OOM);
+
+  file = fs_open_file(os_fs(), filename, "rb");
+  return_value_if_fail(file != NULL, RET_FAIL);
+
+  ftp_session_hash_begin(s, type);
+  while ((ret = fs_file_read(file, buf, buf_size)) > 0) {
+    ftp_session_hash_update(s, buf, ret);
+  }
+  fs_file_close(file);
+
+  return ftp_session_hash_end(s, hash);
+}
+
+/*本地文件和远程文件的长度和校验值都相同时不需要传输，这时直接把进度报告为完成。*/
+static bool_t ftp_session_is_same_file(ftp_session_t* s, const char* local_filename,
+                                       const char* remote_filename, ftp_fs_hash_type_t type) {
+  uint64_t size = 0;
+  fs_stat_info_t st;
+  char local_hash[FTP_HASH_MAX_SIZE] = {0};
+  char remote_hash[FTP_HASH_MAX_SIZE] = {0};
+
+  if (fs_stat(os_fs(), local_filename, &st) != RET_OK || st.is_dir ||
+      ftp_session_cmd_get_size(s, remote_filename, &size) != RET_OK || size != st.size ||
+      ftp_session_cmd_hash(s, remote_filename, type, remote_hash, sizeof(remote_hash)) != RET_OK ||
+      ftp_session_file_hash(s, local_filename, type, local_hash) != RET_OK ||
+      !ftp_hash_equal(type, local_hash, remote_hash)) {
+    return FALSE;
+  }
+
+  if (s->progress_total == 0) {
+    s->progress_total = st.size;
+  }
+  ftp_session_progress(s, st.size);
+
+  return TRUE;
+}
+
+/*服务器无法计算校验值时不算失败，只有结果不一致时返回RET_CRC。*/
+static ret_t ftp_session_verify_hash(ftp_session_t* s, const char* remote_filename,
+                                     ftp_fs_hash_type_t type, const char* local_hash) {
+  char remote_hash[FTP_HASH_MAX_SIZE] = {0};
+
+  if (ftp_session_cmd_hash(s, remote_filename, type, remote_hash, sizeof(remote_hash)) != RET_OK) {
+    log_warn("get hash of %s failed\n", remote_filename);
+    return RET_OK;
+  }
+
+  if (!ftp_hash_equal(type, local_hash, remote_hash)) {
+    log_warn("hash of %s mismatch: %s(local) %s(remote)\n", remote_filename, local_hash,
+             remote_hash);
+    return RET_CRC;
+  }
+
+  return RET_OK;
+}
+
+/*
+ * 中止正在进行的传输：关闭数据连接后发送ABOR。
+ * 服务器先回复426再回复226，传输已经结束时则是传输的226加上ABOR的225/226，
+ * 所以读到2xx后还要读走随后到达的回复。等不到回复时丢弃这个连接。
+ */
+static ret_t ftp_session_abort(ftp_session_t* s) {
+  int32_t code = 0;
+  ret_t ret = RET_OK;
+  int sock = TK_IOSTREAM_TCP(s->ios)->sock;
+
+  ftp_session_close_data(s);
+  s->round_trips++;
+  if (tk_iostream_write_len(s->ios, "ABOR\r\n", 6, 2000) != 6) {
+    s->broken = TRUE;
+    return RET_IO;
+  }
+
+  do {
+    if (s->rbuf_offset >= s->rbuf_len &&
+        tk_socket_wait_for_data(sock, FTP_FS_ABORT_TIMEOUT) != RET_OK) {
+      s->broken = TRUE;
+      return RET_IO;
+    }
+    ret = ftp_session_read_reply(s, &code);
+  } while (ret == RET_OK && (code < 200 || code >= 400));
+
+  while (ret == RET_OK && (s->rbuf_offset < s->rbuf_len ||
+                           tk_socket_wait_for_data(sock, FTP_FS_ABORT_DRAIN_TIMEOUT) == RET_OK)) {
+    ret = ftp_session_read_reply(s, &code);
+  }
+
+  if (ret != RET_OK) {
+    s->broken = TRUE;
+  }
+
+  return ret;
+}
+
+static ret_t ftp_session_retr_begin(ftp_session_t* s, const char* remote_filename,
+                                    uint64_t offset) {
+  char cmd[FTP_CMD_MAX_SIZE] = {0};
+  return_value_if_fail(s != NULL && remote_filename != NULL, RET_BAD_PARAMS);
+
+  return_value_if_fail(ftp_session_pasv(s) == RET_OK, RET_FAIL);
+  if (offset > 0) {
+    tk_snprintf(cmd, sizeof(cmd), "REST %llu\r\n", (unsigned long long)offset);
+    if (ftp_session_cmd(s, cmd, NULL, NULL, 0) != RET_OK) {
+      ftp_session_close_data(s);
+      return RET_NOT_IMPL;
+    }
+  }
+
+  tk_snprintf(cmd, sizeof(cmd), "RETR %s\r\n", remote_filename);
+  if (ftp_session_cmd(s, cmd, NULL, NULL, 0) != RET_OK) {
+    ftp_session_close_data(s);
+    return RET_NOT_FOUND;
+  }
+
+  return RET_OK;
+}
+
+#ifdef FTP_FS_WITH_ZERO_COPY
+/*
+ * 本地文件都是通过os_fs打开的，file->data就是FILE*。
+ * 用splice把数据从socket经过管道直接移到文件，不复制到用户空间。
+ * 返回RET_NOT_IMPL表示内核不支持，需要用普通方式传输。
+ */
+static ret_t ftp_session_splice_to_file(ftp_session_t* s, fs_file_t* file, uint64_t size) {
+  int pipefd[2];
+  ssize_t got = 0;
+  uint64_t done = 0;
+  ret_t ret = RET_OK;
+  loff_t offset = 0;
+  FILE* fp = (FILE*)(file->data);
+  int sock = TK_IOSTREAM_TCP(s->data_ios)->sock;
+  uint32_t chunk = s->ftp_fs->transfer_buffer_size;
+  return_value_if_fail(fp != NULL && sock >= 0, RET_NOT_IMPL);
+
+  fflush(fp);
+  offset = ftello(fp);
+  return_value_if_fail(offset >= 0, RET_NOT_IMPL);
+  return_value_if_fail(pipe(pipefd) == 0, RET_NOT_IMPL);
+
+  while (size == 0 || done < size) {
+    ssize_t n = 0;
+    size_t len = chunk;
+    if (size > 0 && size - done < len) {
+      len = (size_t)(size - done);
+    }
+
+    n = splice(sock, NULL, pipefd[1], NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (n < 0) {
+      ret = (done == 0 && (errno == EINVAL || errno == ENOSYS)) ? RET_NOT_IMPL : RET_IO;
+      break;
+    } else if (n == 0) {
+      break;
+    }
+
+    got = n;
+    while (n > 0) {
+      ssize_t m = splice(pipefd[0], NULL, fileno(fp), &offset, n, SPLICE_F_MOVE);
+      if (m <= 0) {
+        ret = RET_IO;
+        break;
+      }
+      n -= m;
+      done += m;
+    }
+    break_if_fail(ret == RET_OK);
+
+    if (ftp_session_progress(s, got) == RET_STOP) {
+      ret = RET_STOP;
+      break;
+    }
+  }
+
+  close(pipefd[0]);
+  close(pipefd[1]);
+  fseeko(fp, offset, SEEK_SET);
+
+  if (ret == RET_OK && size > 0 && done != size) {
+    ret = RET_IO;
+  }
+
+  return ret;
+}
+
+/*用sendfile把本地文件直接发送到socket。返回RET_NOT_IMPL表示需要用普通方式传输。*/
+static ret_t ftp_session_sendfile(ftp_session_t* s, fs_file_t* file, uint64_t size) {
+  uint64_t done = 0;
+  ret_t ret = RET_OK;
+  off_t offset = 0;
+  FILE* fp = (FILE*)(file->data);
+  int sock = TK_IOSTREAM_TCP(s->data_ios)->sock;
+  uint32_t chunk = s->ftp_fs->transfer_buffer_size;
+  return_value_if_fail(fp != NULL && sock >= 0, RET_NOT_IMPL);
+
+  offset = ftello(fp);
+  return_value_if_fail(offset >= 0, RET_NOT_IMPL);
+
+  while (size == 0 || done < size) {
+    ssize_t n = 0;
+    size_t len = chunk;
+    if (size > 0 && size - done < len) {
+      len = (size_t)(size - done);
+    }
+
+    n = sendfile(sock, fileno(fp), &offset, len);
+    if (n < 0) {
+      ret = (done == 0 && (errno == EINVAL || errno == ENOSYS)) ? RET_NOT_IMPL : RET_IO;
+      break;
+    } else if (n == 0) {
+      break;
+    }
+    done += n;
+
+    if (ftp_session_progress(s, n) == RET_STOP) {
+      ret = RET_STOP;
+      break;
+    }
+  }
+
+  fseeko(fp, offset, SEEK_SET);
+
+  if (ret == RET_OK && size > 0 && done != size) {
+    ret = RET_IO;
+  }
+
+  return ret;
+}
+#endif /*FTP_FS_WITH_ZERO_COPY*/
+
+typedef struct _ftp_file_writer_t {
+  ftp_session_t* s;
+  fs_file_t* file;
+} ftp_file_writer_t;
+
+static ret_t ftp_data_write_to_file(void* ctx, const uint8_t* data, uint32_t size) {
+  ftp_file_writer_t* writer = (ftp_file_writer_t*)ctx;
+  return_value_if_fail(fs_file_write(writer->file, data, size) == (int32_t)size, RET_IO);
+  ftp_session_hash_update(writer->s, data, size);
+
+  return ftp_session_progress(writer->s, size) == RET_STOP ? RET_STOP : RET_OK;
+}
+
+/*MODE Z：读取文件并压缩后发送，进度和校验值按压缩前的数据计算。*/
+static ret_t ftp_session_deflate_from_file(ftp_session_t* s, fs_file_t* file) {
+  mz_stream zs;
+  ret_t ret = RET_OK;
+  uint32_t in_size = 0;
+  uint32_t out_size = 0;
+  int flush = MZ_NO_FLUSH;
+  uint8_t* in = ftp_session_get_buffer(s, &in_size);
+  uint8_t* out = ftp_session_get_zbuffer(s, &out_size);
+  return_value_if_fail(in != NULL && out != NULL, RET_OOM);
+
+  memset(&zs, 0x00, sizeof(zs));
+  return_value_if_fail(mz_deflateInit(&zs, MZ_DEFAULT_COMPRESSION) == MZ_OK, RET_FAIL);
+
+  while (ret == RET_OK && flush != MZ_FINISH) {
+    int32_t n = fs_file_read(file, in, in_size);
+    if (n <= 0) {
+      n = 0;
+      flush = MZ_FINISH;
+    }
+    ftp_session_hash_update(s, in, n);
+
+    zs.next_in = in;
+    zs.avail_in = n;
+    do {
+      int32_t len = 0;
+      int zret = MZ_OK;
+      zs.next_out = out;
+      zs.avail_out = out_size;
+      /*没有新的输入时返回MZ_BUF_ERROR，不是错误。*/
+      zret = mz_deflate(&zs, flush);
+      if (zret < 0 && zret != MZ_BUF_ERROR) {
+        log_warn("deflate failed: %d\n", zret);
+        ret = RET_FAIL;
+        break;
+      }
+
+      len = out_size - zs.avail_out;
+      if (len > 0 && tk_iostream_write_len(s->data_ios, out, len, 2000) != len) {
+        ret = RET_IO;
+      }
+    } while (ret == RET_OK && zs.avail_out == 0);
+
+    if (ret == RET_OK && n > 0 && ftp_session_progress(s, n) == RET_STOP) {
+      ret = RET_STOP;
+    }
+  }
+  mz_deflateEnd(&zs);
+
+  return ret;
+}
+
+/*size为0表示一直读到数据连接关闭。*/
+static ret_t ftp_session_recv_to_file(ftp_session_t* s, fs_file_t* file, uint64_t size) {
+  int32_t ret = 0;
+  uint64_t done = 0;
+  uint8_t* buf = NULL;
+  uint32_t buf_size = 0;
+  return_value_if_fail(s != NULL && s->data_ios != NULL && file != NULL, RET_BAD_PARAMS);
+
+  if (s->mode_z) {
+    ftp_file_writer_t writer = {s, file};
+    /*压缩的数据不能按位置截取，只支持读到数据结束。*/
+    return_value_if_fail(size == 0, RET_NOT_IMPL);
+    return ftp_session_inflate_data(s, ftp_data_write_to_file, &writer);
+  }
+
+#ifdef FTP_FS_WITH_ZERO_COPY
+  /*需要计算校验值时数据必须经过用户空间。*/
+  if (s->hash_type == FTP_FS_HASH_NONE) {
+    ret = ftp_session_splice_to_file(s, file, size);
+    if (ret != RET_NOT_IMPL) {
+      return ret;
+    }
+  }
+#endif /*FTP_FS_WITH_ZERO_COPY*/
+
+  buf = ftp_session_get_buffer(s, &buf_size);
+  return_value_if_fail(buf != NULL, RET_OOM);
+
+  while (size == 0 || done < size) {
+    uint32_t len = buf_size;
+    if (size > 0 && size - done < len) {
+      len = (uint32_t)(size - done);
+    }
+
+    ret = tk_iostream_read(s->data_ios, buf, len);
+    break_if_fail(ret > 0);
+    return_value_if_fail(fs_file_write(file, buf, ret) == ret, RET_IO);
+    ftp_session_hash_update(s, buf, ret);
+    done += ret;
+
+    if (ftp_session_progress(s, ret) == RET_STOP) {
+      return RET_STOP;
+    }
+  }
+
+  return (size == 0 || done == size) ? RET_OK : RET_IO;
+}
+
+/*提前关闭数据连接时，服务器可能回复426/451，也可能已经发完数据回复226，读走即可。*/
+static ret_t ftp_session_retr_end(ftp_session_t* s, bool_t aborted) {
+  ret_t ret = RET_OK;
+  return_value_if_fail(s != NULL, RET_BAD_PARAMS);
+
+  ftp_session_close_data(s);
+  ret = ftp_session_expect226(s);
+  if (aborted && ret == RET_FAIL) {
+    ret = RET_OK;
+  }
+
+  return ret;
+}
+
+static ret_t ftp_session_cmd_download_file(ftp_session_t* s, const char* remote_filename,
+                                           const char* local_filename) {
+  ret_t ret = RET_OK;
+  fs_file_t* file = NULL;
+  ftp_fs_hash_type_t hash_type = FTP_FS_HASH_NONE;
+  char hash[FTP_HASH_MAX_SIZE] = {0};
+  return_value_if_fail(s != NULL && remote_filename != NULL && local_filename != NULL,
+                       RET_BAD_PARAMS);
+
+  hash_type = ftp_session_get_hash_type(s);
+  if (hash_type != FTP_FS_HASH_NONE &&
+      ftp_session_is_same_file(s, local_filename, remote_filename, hash_type)) {
+    return RET_OK;
+  }
+
+  s->compress_next = ftp_fs_should_compress(s->ftp_fs, remote_filename, 0);
+  ret = ftp_session_retr_begin(s, remote_filename, 0);
+  return_value_if_fail(ret == RET_OK, ret);
+
+  file = fs_open_file(os_fs(), local_filename, "wb+");
+  if (file != NULL) {
+    ftp_session_hash_begin(s, hash_type);
+    ret = ftp_session_recv_to_file(s, file, 0);
+    ftp_session_hash_end(s, hash);
+    fs_file_close(file);
+  } else {
+    ret = RET_FAIL;
+  }
+
+  if (ret == RET_OK) {
+    ret = ftp_session_retr_end(s, FALSE);
+    if (ret == RET_OK && hash_type != FTP_FS_HASH_NONE) {
+      ret = ftp_session_verify_hash(s, remote_filename, hash_type, hash);
+    }
+    return ret;
+  } else if (ret == RET_STOP) {
+    ftp_session_abort(s);
+    return ret;
+  } else {
+    ftp_session_retr_end(s, TRUE);
+    return ret;
+  }
+}
+
+static ret_t ftp_fs_ensure_local_dir(const char* local_filename) {
+  char path[MAX_PATH + 1] = {0};
+
+  path_dirname(local_filename, path, sizeof(path)-1);
+  if (path[0] != '\0' && !dir_exist(path)) {
+    if (fs_create_dir_r(os_fs(), path) != RET_OK) {
+      log_warn("create %s failed\n", path);
+      return RET_FAIL;
+    }
+  }
+
+  return RET_OK;
+}
+
+static ret_t ftp_fs_cmd_download_file(ftp_fs_t* ftp_fs, const char* remote_filename,
+                                      const char* local_filename) {
+  ret_t ret = RET_OK;
+  ftp_session_t* s = NULL;
+  return_value_if_fail(ftp_fs != NULL && remote_filename != NULL && local_filename != NULL,
+                       RET_BAD_PARAMS);
+  return_value_if_fail(ftp_fs_ensure_local_dir(local_filename) == RET_OK, RET_FAIL);
+
+  s = ftp_fs_checkout(ftp_fs);
+  return_value_if_fail(s != NULL, RET_IO);
+
+  ret = ftp_session_cmd_download_file(s, remote_filename, local_filename);
+  ftp_fs_checkin(ftp_fs, s);
+
+  return ret;
+}
+
+ret_t ftp_fs_download_file(fs_t* fs, const char* remote_filename, const char* local_filename) {
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(remote_filename != NULL && local_filename != NULL, RET_BAD_PARAMS);
+
+  return ftp_fs_cmd_download_file(ftp_fs, remote_filename, local_filename);
+}
+
+ret_t ftp_fs_download_file_ex(fs_t* fs, const char* remote_filename, const char* local_filename,
+                              ftp_fs_on_progress_t on_progress, void* ctx) {
+  ret_t ret = RET_OK;
+  ftp_session_t* s = NULL;
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(remote_filename != NULL && local_filename != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(ftp_fs_ensure_local_dir(local_filename) == RET_OK, RET_FAIL);
+
+  s = ftp_fs_checkout(ftp_fs);
+  return_value_if_fail(s != NULL, RET_IO);
+
+  ftp_session_set_on_progress(s, on_progress, ctx, 0);
+  ret = ftp_session_cmd_download_file(s, remote_filename, local_filename);
+  ftp_session_set_on_progress(s, NULL, NULL, 0);
+  ftp_fs_checkin(ftp_fs, s);
+
+  return ret;
+}
+
+ret_t ftp_fs_abort_transfer(fs_t* fs, void* ctx) {
+  uint32_t i = 0;
+  ret_t ret = RET_NOT_FOUND;
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL && ctx != NULL, RET_BAD_PARAMS);
+
+  /*只关闭socket不释放data_ios，传输的线程读写失败后自己关闭数据连接和放弃控制连接上的回复。*/
+  tk_mutex_lock(ftp_fs->mutex);
+  tk_mutex_lock(ftp_fs->data_mutex);
+  for (i = 0; i < ftp_fs->sessions.size; i++) {
+    ftp_session_t* iter = (ftp_session_t*)darray_get(&ftp_fs->sessions, i);
+    if (iter->busy && iter->on_progress_ctx == ctx && iter->data_ios != NULL) {
+      shutdown(TK_IOSTREAM_TCP(iter->data_ios)->sock, FTP_SHUT_RDWR);
+      ret = RET_OK;
+    }
+  }
+  tk_mutex_unlock(ftp_fs->data_mutex);
+  tk_mutex_unlock(ftp_fs->mutex);
+
+  return ret;
+}
+
+typedef struct _ftp_segment_t {
+  ftp_fs_t* ftp_fs;
+  const char* remote_filename;
+  const char* local_filename;
+  uint64_t offset;
+  uint64_t size;
+  bool_t is_last;
+  ret_t ret;
+} ftp_segment_t;
+
+static ret_t ftp_segment_download(ftp_segment_t* seg) {
+  ret_t ret = RET_OK;
+  fs_file_t* file = NULL;
+  ftp_session_t* s = NULL;
+
+  /*每个分段用自己的文件句柄，定位后写入，分段之间互不影响。*/
+  file = fs_open_file(os_fs(), seg->local_filename, "rb+");
+  return_value_if_fail(file != NULL, RET_FAIL);
+
+  if (fs_file_seek(file, seg->offset) != RET_OK) {
+    fs_file_close(file);
+    return RET_FAIL;
+  }
+
+  s = ftp_fs_checkout(seg->ftp_fs);
+  if (s == NULL) {
+    fs_file_close(file);
+    return RET_IO;
+  }
+
+  ret = ftp_session_retr_begin(s, seg->remote_filename, seg->offset);
+  if (ret == RET_OK) {
+    ret = ftp_session_recv_to_file(s, file, seg->size);
+    if (ret == RET_OK) {
+      ret = ftp_session_retr_end(s, !seg->is_last);
+    } else {
+      ftp_session_retr_end(s, TRUE);
+    }
+  }
+
+  ftp_fs_checkin(seg->ftp_fs, s);
+  fs_file_close(file);
+
+  return ret;
+}
+
+static void* ftp_segment_thread_entry(void* args) {
+  ftp_segment_t* seg = (ftp_segment_t*)args;
+
+  seg->ret = ftp_segment_download(seg);
+
+  return NULL;
+}
+
+ret_t ftp_fs_download_file_parallel(fs_t* fs, const char* remote_filename,
+                                    const char* local_filename, uint32_t segments) {
+  uint32_t i = 0;
+  ret_t ret = RET_OK;
+  uint64_t size = 0;
+  uint64_t seg_size = 0;
+  ftp_session_t* s = NULL;
+  fs_file_t* file = NULL;
+  ftp_segment_t* segs = NULL;
+  tk_thread_t** threads = NULL;
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(remote_filename != NULL && local_filename != NULL, RET_BAD_PARAMS);
+
+  s = ftp_fs_checkout(ftp_fs);
+  return_value_if_fail(s != NULL, RET_IO);
+  ret = ftp_session_cmd_get_size(s, remote_filename, &size);
+  ftp_fs_checkin(ftp_fs, s);
+
+  if (ret != RET_OK || size == 0 || segments < 2) {
+    return ftp_fs_cmd_download_file(ftp_fs, remote_filename, local_filename);
+  }
+
+  seg_size = tk_max(TK_ROUND_TO(size / segments, 4096), FTP_FS_MIN_SEGMENT_SIZE);
+  segments = (uint32_t)((size + seg_size - 1) / seg_size);
+  if (segments < 2) {
+    return ftp_fs_cmd_download_file(ftp_fs, remote_filename, local_filename);
+  }
+
+  /*
+   * 预先分配本地文件，各分段直接写到自己的位置。
+   * fs_file_truncate的长度是int32_t，更大的文件只创建空文件，由各分段定位写入时扩展。
+   */
+  return_value_if_fail(ftp_fs_ensure_local_dir(local_filename) == RET_OK, RET_FAIL);
+  file = fs_open_file(os_fs(), local_filename, "wb+");
+  return_value_if_fail(file != NULL, RET_FAIL);
+  ret = size <= INT32_MAX ? fs_file_truncate(file, (int32_t)size) : RET_OK;
+  fs_file_close(file);
+  return_value_if_fail(ret == RET_OK, RET_FAIL);
+
+  segs = TKMEM_ZALLOCN(ftp_segment_t, segments);
+  threads = TKMEM_ZALLOCN(tk_thread_t*, segments);
+  goto_error_if_fail(segs != NULL && threads != NULL);
+
+  for (i = 0; i < segments; i++) {
+    ftp_segment_t* seg = segs + i;
+
+    seg->ftp_fs = ftp_fs;
+    seg->remote_filename = remote_filename;
+    seg->local_filename = local_filename;
+    seg->offset = (uint64_t)i * seg_size;
+    seg->size = tk_min(seg_size, size - seg->offset);
+    seg->is_last = (i + 1) == segments;
+    seg->ret = RET_FAIL;
+
+    threads[i] = tk_thread_create(ftp_segment_thread_entry, seg);
+    if (threads[i] == NULL || tk_thread_start(threads[i]) != RET_OK) {
+      /*无法启动线程时在当前线程中完成。*/
+      seg->ret = ftp_segment_download(seg);
+    }
+  }
+
+  ret = RET_OK;
+  for (i = 0; i < segments; i++) {
+    if (threads[i] != NULL) {
+      tk_thread_join(threads[i]);
+      tk_thread_destroy(threads[i]);
+    }
+
+    if (segs[i].ret != RET_OK) {
+      log_warn("download segment %u of %s failed\n", i, remote_filename);
+      ret = segs[i].ret;
+    }
+  }
+
+  TKMEM_FREE(segs);
+  TKMEM_FREE(threads);
+
+  return ret;
+error:
+  TKMEM_FREE(segs);
+  TKMEM_FREE(threads);
+
+  return RET_OOM;
+}
+
+/*
+ * 在当前连接上创建目录(dir是绝对路径)，上级目录不存在时先创建上级目录。
+ * 目录已经存在时MKD也会失败，所以一直向上找到创建成功或者已知存在的目录为止。
+ */
+static ret_t ftp_session_create_dir_r(ftp_session_t* s, const char* dir) {
+  char cmd[FTP_CMD_MAX_SIZE] = {0};
+  char parent[MAX_PATH + 1] = {0};
+  return_value_if_fail(!ftp_fs_known_dir_has(s->ftp_fs, dir), RET_OK);
+
+  tk_snprintf(cmd, sizeof(cmd), "MKD %s\r\n", dir);
+  if (ftp_session_cmd(s, cmd, NULL, NULL, 0) != RET_OK) {
+    return_value_if_fail(!s->broken, RET_IO);
+    return_value_if_fail(ftp_path_get_parent(dir, parent, sizeof(parent)) == RET_OK, RET_FAIL);
+    return_value_if_fail(!ftp_fs_known_dir_has(s->ftp_fs, parent), RET_FAIL);
+    return_value_if_fail(ftp_session_create_dir_r(s, parent) == RET_OK, RET_FAIL);
+    return_value_if_fail(ftp_session_cmd(s, cmd, NULL, NULL, 0) == RET_OK, RET_FAIL);
+  }
+
+  /*缓存中可能还有这个目录不存在的记录。*/
+  ftp_fs_stat_cache_invalidate(s->ftp_fs, dir);
+
+  return ftp_fs_known_dir_add(s->ftp_fs, dir);
+}
+
+static ret_t ftp_session_stor_begin_once(ftp_session_t* s, const char* verb,
+                                         const char* remote_filename, uint64_t offset) {
+  char cmd[FTP_CMD_MAX_SIZE] = {0};
+
+  return_value_if_fail(ftp_session_pasv(s) == RET_OK, RET_FAIL);
+  if (offset > 0) {
+    tk_snprintf(cmd, sizeof(cmd), "REST %llu\r\n", (unsigned long long)offset);
+    if (ftp_session_cmd(s, cmd, NULL, NULL, 0) != RET_OK) {
+      ftp_session_close_data(s);
+      return RET_NOT_IMPL;
+    }
+  }
+
+  tk_snprintf(cmd, sizeof(cmd), "%s %s\r\n", verb, remote_filename);
+  if (ftp_session_cmd(s, cmd, NULL, NULL, 0) != RET_OK) {
+    ftp_session_close_data(s);
+    return RET_FAIL;
+  }
+
+  return RET_OK;
+}
+
+/*
+ * 不预先检查上级目录，直接上传。
+ * 服务器回复550/553并且上级目录不在已知目录中时，创建上级目录后再试一次。
+ */
+static ret_t ftp_session_stor_begin(ftp_session_t* s, const char* verb,
+                                    const char* remote_filename, uint64_t offset) {
+  ret_t ret = RET_OK;
+  bool_t compress = FALSE;
+  char path[MAX_PATH + 1] = {0};
+  char parent[MAX_PATH + 1] = {0};
+  return_value_if_fail(s != NULL && verb != NULL && remote_filename != NULL, RET_BAD_PARAMS);
+
+  compress = s->compress_next;
+  ftp_path_normalize(s->cwd, remote_filename, path, sizeof(path));
+  return_value_if_fail(ftp_path_get_parent(path, parent, sizeof(parent)) == RET_OK, RET_BAD_PARAMS);
+
+  ret = ftp_session_stor_begin_once(s, verb, remote_filename, offset);
+  if (ret == RET_FAIL && !s->broken &&
+      (s->last_error_code == 550 || s->last_error_code == 553)) {
+    if (ftp_fs_known_dir_has(s->ftp_fs, parent)) {
+      /*可能是其它客户端删除了目录，下次上传时再创建。*/
+      ftp_fs_known_dir_forget(s->ftp_fs, parent);
+    } else if (ftp_session_create_dir_r(s, parent) != RET_IO) {
+      s->compress_next = compress;
+      ret = ftp_session_stor_begin_once(s, verb, remote_filename, offset);
+    }
+  }
+
+  if (ret == RET_OK) {
+    ftp_fs_known_dir_add(s->ftp_fs, parent);
+  }
+
+  return ret;
+}
+
+/*size为0表示一直发送到文件结束。*/
+static ret_t ftp_session_send_from_file(ftp_session_t* s, fs_file_t* file, uint64_t size) {
+  int32_t ret = 0;
+  uint64_t done = 0;
+  uint8_t* buf = NULL;
+  uint32_t buf_size = 0;
+  return_value_if_fail(s != NULL && s->data_ios != NULL && file != NULL, RET_BAD_PARAMS);
+
+  if (s->mode_z) {
+    return_value_if_fail(size == 0, RET_NOT_IMPL);
+    return ftp_session_deflate_from_file(s, file);
+  }
+
+#ifdef FTP_FS_WITH_ZERO_COPY
+  if (s->hash_type == FTP_FS_HASH_NONE) {
+    ret = ftp_session_sendfile(s, file, size);
+    if (ret != RET_NOT_IMPL) {
+      return ret;
+    }
+  }
+#endif /*FTP_FS_WITH_ZERO_COPY*/
+
+  buf = ftp_session_get_buffer(s, &buf_size);
+  return_value_if_fail(buf != NULL, RET_OOM);
+
+  while (size == 0 || done < size) {
+    uint32_t len = buf_size;
+    if (size > 0 && size - done < len) {
+      len = (uint32_t)(size - done);
+    }
+
+    ret = fs_file_read(file, buf, len);
+    break_if_fail(ret > 0);
+    return_value_if_fail(tk_iostream_write_len(s->data_ios, buf, ret, 2000) == ret, RET_IO);
+    ftp_session_hash_update(s, buf, ret);
+    done += ret;
+
+    if (ftp_session_progress(s, ret) == RET_STOP) {
+      return RET_STOP;
+    }
+  }
+
+  return (size == 0 || done == size) ? RET_OK : RET_IO;
+}
+
+static ret_t ftp_session_stor_end(ftp_session_t* s) {
+  return_value_if_fail(s != NULL, RET_BAD_PARAMS);
+
+  ftp_session_close_data(s);
+
+  return ftp_session_expect226(s);
+}
+
+static ret_t ftp_session_cmd_upload_file(ftp_session_t* s, const char* local_filename,
+                                         const char* remote_filename) {
+  ret_t ret = RET_OK;
+  fs_file_t* file = NULL;
+  ftp_fs_hash_type_t hash_type = FTP_FS_HASH_NONE;
+  char hash[FTP_HASH_MAX_SIZE] = {0};
+  return_value_if_fail(s != NULL && remote_filename != NULL && local_filename != NULL,
+                       RET_BAD_PARAMS);
+
+  hash_type = ftp_session_get_hash_type(s);
+  if (hash_type != FTP_FS_HASH_NONE &&
+      ftp_session_is_same_file(s, local_filename, remote_filename, hash_type)) {
+    return RET_OK;
+  }
+
+  file = fs_open_file(os_fs(), local_filename, "rb");
+  return_value_if_fail(file != NULL, RET_FAIL);
+
+  s->compress_next = ftp_fs_should_compress(s->ftp_fs, local_filename, fs_file_size(file));
+  ret = ftp_session_stor_begin(s, "STOR", remote_filename, 0);
+  if (ret == RET_OK) {
+    ftp_session_hash_begin(s, hash_type);
+    ret = ftp_session_send_from_file(s, file, 0);
+    ftp_session_hash_end(s, hash);
+    if (ret != RET_OK) {
+      /*中止或者数据没有发完，服务器仍然可能回复226，不能按成功处理。*/
+      ftp_session_abort(s);
+    } else {
+      ret = ftp_session_stor_end(s);
+      if (ret == RET_OK && hash_type != FTP_FS_HASH_NONE) {
+        ret = ftp_session_verify_hash(s, remote_filename, hash_type, hash);
+      }
+    }
+  }
+  fs_file_close(file);
+
+  return ret;
+}
+
+static ret_t ftp_fs_cmd_upload_file(ftp_fs_t* ftp_fs, const char* local_filename,
+                                    const char* remote_filename) {
+  ret_t ret = RET_OK;
+  ftp_session_t* s = NULL;
+  return_value_if_fail(ftp_fs != NULL && remote_filename != NULL && local_filename != NULL,
+                       RET_BAD_PARAMS);
+
+  s = ftp_fs_checkout(ftp_fs);
+  return_value_if_fail(s != NULL, RET_IO);
+
+  ret = ftp_session_cmd_upload_file(s, local_filename, remote_filename);
+  ftp_fs_checkin(ftp_fs, s);
+  ftp_fs_stat_cache_invalidate(ftp_fs, remote_filename);
+
+  return ret;
+}
+
+ret_t ftp_fs_upload_file(fs_t* fs, const char* local_filename, const char* remote_filename) {
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(remote_filename != NULL && local_filename != NULL, RET_BAD_PARAMS);
+
+  return ftp_fs_cmd_upload_file(ftp_fs, local_filename, remote_filename);
+}
+
+ret_t ftp_fs_upload_file_ex(fs_t* fs, const char* local_filename, const char* remote_filename,
+                            ftp_fs_on_progress_t on_progress, void* ctx) {
+  ret_t ret = RET_OK;
+  ftp_session_t* s = NULL;
+  fs_stat_info_t st;
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(remote_filename != NULL && local_filename != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(fs_stat(os_fs(), local_filename, &st) == RET_OK, RET_NOT_FOUND);
+
+  s = ftp_fs_checkout(ftp_fs);
+  return_value_if_fail(s != NULL, RET_IO);
+
+  ftp_session_set_on_progress(s, on_progress, ctx, st.size);
+  ret = ftp_session_cmd_upload_file(s, local_filename, remote_filename);
+  ftp_session_set_on_progress(s, NULL, NULL, 0);
+  ftp_fs_checkin(ftp_fs, s);
+  ftp_fs_stat_cache_invalidate(ftp_fs, remote_filename);
+
+  return ret;
+}
+
+/*目录树中的一项，rel是相对于根目录的路径(用'/'分隔)。*/
+typedef struct _ftp_dir_entry_t {
+  char rel[MAX_PATH + 1];
+  bool_t is_dir;
+  uint64_t size;
+  uint64_t mtime;
+  bool_t matched;
+} ftp_dir_entry_t;
+
+static ret_t ftp_dir_entry_join(const char* dir, const char* name, char* path, uint32_t size) {
+  if (dir[0] == '\0') {
+    tk_strncpy(path, name, size - 1);
+  } else {
+    tk_snprintf(path, size, "%s/%s", dir, name);
+  }
+
+  return RET_OK;
+}
+
+/*广度优先列出远程目录树，entries同时作为待列出目录的队列。*/
+static ret_t ftp_session_walk_remote(ftp_session_t* s, const char* root, darray_t* entries) {
+  uint32_t i = 0;
+  darray_t items;
+  darray_t stats;
+  ret_t ret = RET_OK;
+  uint32_t prefix = 0;
+  char abs_root[MAX_PATH + 1] = {0};
+
+  ftp_path_normalize(s->cwd, root, abs_root, sizeof(abs_root));
+  prefix = tk_str_eq(abs_root, "/") ? 1 : strlen(abs_root) + 1;
+  darray_init(&items, 64, (tk_destroy_t)fs_item_destroy, NULL);
+  darray_init(&stats, 64, default_destroy, NULL);
+
+  for (i = 0; ret == RET_OK; i++) {
+    uint32_t k = 0;
+    char dir[MAX_PATH + 1] = {0};
+
+    if (i == 0) {
+      tk_strncpy(dir, abs_root, sizeof(dir) - 1);
+    } else if (i <= entries->size) {
+      ftp_dir_entry_t* parent = (ftp_dir_entry_t*)darray_get(entries, i - 1);
+      if (!parent->is_dir) {
+        continue;
+      }
+      ftp_path_normalize(abs_root, parent->rel, dir, sizeof(dir));
+    } else {
+      break;
+    }
+
+    darray_clear(&items);
+    darray_clear(&stats);
+    ret = ftp_session_cmd_list(s, dir, &items, &stats);
+    for (k = 0; ret == RET_OK && k < stats.size; k++) {
+      ftp_stat_entry_t* iter = (ftp_stat_entry_t*)darray_get(&stats, k);
+      ftp_dir_entry_t* entry = NULL;
+
+      if (strlen(iter->path) <= prefix) {
+        continue;
+      }
+
+      entry = TKMEM_ZALLOC(ftp_dir_entry_t);
+      if (entry == NULL) {
+        ret = RET_OOM;
+        break;
+      }
+      tk_strncpy(entry->rel, iter->path + prefix, sizeof(entry->rel) - 1);
+      entry->is_dir = iter->info.is_dir;
+      entry->size = iter->info.size;
+      entry->mtime = iter->info.mtime;
+      if (darray_push(entries, entry) != RET_OK) {
+        TKMEM_FREE(entry);
+        ret = RET_OOM;
+      }
+    }
+  }
+
+  darray_deinit(&items);
+  darray_deinit(&stats);
+
+  return ret;
+}
+
+/*广度优先列出本地目录树。*/
+static ret_t ftp_walk_local(const char* root, darray_t* entries) {
+  uint32_t i = 0;
+  ret_t ret = RET_OK;
+
+  for (i = 0; ret == RET_OK; i++) {
+    fs_item_t item;
+    fs_dir_t* dir = NULL;
+    const char* rel = "";
+    char path[MAX_PATH + 1] = {0};
+
+    if (i > 0) {
+      ftp_dir_entry_t* parent = NULL;
+      if (i > entries->size) {
+        break;
+      }
+      parent = (ftp_dir_entry_t*)darray_get(entries, i - 1);
+      if (!parent->is_dir) {
+        continue;
+      }
+      rel = parent->rel;
+    }
+
+    path_build(path, sizeof(path), root, rel, NULL);
+    dir = fs_open_dir(os_fs(), path);
+    if (dir == NULL) {
+      ret = RET_FAIL;
+      break;
+    }
+
+    while (fs_dir_read(dir, &item) == RET_OK) {
+      fs_stat_info_t st;
+      char filename[MAX_PATH + 1] = {0};
+      ftp_dir_entry_t* entry = NULL;
+
+      if (tk_str_eq(item.name, ".") || tk_str_eq(item.name, "..") ||
+          !(item.is_dir || item.is_reg_file)) {
+        continue;
+      }
+
+      entry = TKMEM_ZALLOC(ftp_dir_entry_t);
+      if (entry == NULL) {
+        ret = RET_OOM;
+        break;
+      }
+      ftp_dir_entry_join(rel, item.name, entry->rel, sizeof(entry->rel));
+      entry->is_dir = item.is_dir;
+      path_build(filename, sizeof(filename), path, item.name, NULL);
+      if (!item.is_dir && fs_stat(os_fs(), filename, &st) == RET_OK) {
+        entry->size = st.size;
+        entry->mtime = st.mtime;
+      }
+      if (darray_push(entries, entry) != RET_OK) {
+        TKMEM_FREE(entry);
+        ret = RET_OOM;
+        break;
+      }
+    }
+    fs_dir_close(dir);
+  }
+
+  return ret;
+}
+
+typedef struct _ftp_dir_job_t {
+  char remote_filename[MAX_PATH + 1];
+  char local_filename[MAX_PATH + 1];
+  bool_t upload;
+  uint64_t size;
+  ret_t ret;
+} ftp_dir_job_t;
+
+/*一组文件传输，由多个工作线程分担，每个线程使用自己的控制连接。*/
+typedef struct _ftp_dir_task_t {
+  ftp_fs_t* ftp_fs;
+  darray_t jobs;
+  uint32_t next;
+  tk_mutex_t* mutex;
+  uint64_t done;
+  uint64_t total;
+  bool_t cancelled;
+  ret_t ret;
+  ftp_fs_on_progress_t on_progress;
+  ftp_fs_on_file_done_t on_file_done;
+  void* ctx;
+} ftp_dir_task_t;
+
+typedef struct _ftp_dir_worker_t {
+  ftp_dir_task_t* task;
+  uint64_t last_done;
+} ftp_dir_worker_t;
+
+static ret_t ftp_dir_task_init(ftp_dir_task_t* task, ftp_fs_t* ftp_fs,
+                               ftp_fs_on_progress_t on_progress,
+                               ftp_fs_on_file_done_t on_file_done, void* ctx) {
+  memset(task, 0x00, sizeof(*task));
+  task->ftp_fs = ftp_fs;
+  task->ret = RET_OK;
+  task->on_progress = on_progress;
+  task->on_file_done = on_file_done;
+  task->ctx = ctx;
+  darray_init(&(task->jobs), 64, default_destroy, NULL);
+  task->mutex = tk_mutex_create();
+
+  return task->mutex != NULL ? RET_OK : RET_OOM;
+}
+
+static ret_t ftp_dir_task_add(ftp_dir_task_t* task, const char* remote_filename,
+                              const char* local_filename, bool_t upload, uint64_t size) {
+  ftp_dir_job_t* job = TKMEM_ZALLOC(ftp_dir_job_t);
+  return_value_if_fail(job != NULL, RET_OOM);
+
+  tk_strncpy(job->remote_filename, remote_filename, sizeof(job->remote_filename) - 1);
+  tk_strncpy(job->local_filename, local_filename, sizeof(job->local_filename) - 1);
+  job->upload = upload;
+  job->size = size;
+  job->ret = RET_SKIP;
+  task->total += size;
+
+  if (darray_push(&(task->jobs), job) != RET_OK) {
+    TKMEM_FREE(job);
+    return RET_OOM;
+  }
+
+  return RET_OK;
+}
+
+static ret_t ftp_dir_task_deinit(ftp_dir_task_t* task) {
+  darray_deinit(&(task->jobs));
+  if (task->mutex != NULL) {
+    tk_mutex_destroy(task->mutex);
+  }
+
+  return RET_OK;
+}
+
+/*把各个连接的进度汇总成整个任务的进度，回调在锁内调用，不会并发。*/
+static ret_t ftp_dir_worker_on_progress(void* ctx, uint64_t done, uint64_t total) {
+  bool_t cancelled = FALSE;
+  ftp_dir_worker_t* worker = (ftp_dir_worker_t*)ctx;
+  ftp_dir_task_t* task = worker->task;
+
+  tk_mutex_lock(task->mutex);
+  task->done += done - worker->last_done;
+  worker->last_done = done;
+  if (task->on_progress != NULL && !task->cancelled) {
+    if (task->on_progress(task->ctx, task->done, task->total) == RET_STOP) {
+      task->cancelled = TRUE;
+    }
+  }
+  cancelled = task->cancelled;
+  tk_mutex_unlock(task->mutex);
+
+  return cancelled ? RET_STOP : RET_OK;
+}
+
+static ret_t ftp_dir_worker_run(ftp_dir_worker_t* worker) {
+  ftp_session_t* s = NULL;
+  ftp_dir_task_t* task = worker->task;
+  ftp_fs_t* ftp_fs = task->ftp_fs;
+
+  while (TRUE) {
+    ret_t ret = RET_OK;
+    ftp_dir_job_t* job = NULL;
+
+    tk_mutex_lock(task->mutex);
+    if (!task->cancelled && task->next < task->jobs.size) {
+      job = (ftp_dir_job_t*)darray_get(&(task->jobs), task->next++);
+    }
+    tk_mutex_unlock(task->mutex);
+    break_if_fail(job != NULL);
+
+    /*每个线程一直使用同一个连接，连接断开后才重新取一个。*/
+    if (s == NULL) {
+      s = ftp_fs_checkout(ftp_fs);
+    }
+
+    worker->last_done = 0;
+    if (s == NULL) {
+      ret = RET_IO;
+    } else if (job->upload) {
+      ftp_session_set_on_progress(s, ftp_dir_worker_on_progress, worker, job->size);
+      ret = ftp_session_cmd_upload_file(s, job->local_filename, job->remote_filename);
+      ftp_fs_stat_cache_invalidate(ftp_fs, job->remote_filename);
+    } else {
+      ftp_session_set_on_progress(s, ftp_dir_worker_on_progress, worker, job->size);
+      ret = ftp_session_cmd_download_file(s, job->remote_filename, job->local_filename);
+    }
+
+    if (s != NULL) {
+      ftp_session_set_on_progress(s, NULL, NULL, 0);
+      if (s->broken) {
+        ftp_fs_checkin(ftp_fs, s);
+        s = NULL;
+      }
+    }
+
+    tk_mutex_lock(task->mutex);
+    job->ret = ret;
+    if (worker->last_done < job->size) {
+      /*失败或者服务器上的文件变小了，补齐进度，保证结束时done等于total。*/
+      task->done += job->size - worker->last_done;
+    }
+    if (ret != RET_OK && task->ret != RET_STOP) {
+      task->ret = ret;
+    }
+    if (task->on_file_done != NULL) {
+      task->on_file_done(task->ctx, job->remote_filename, job->local_filename, ret);
+    }
+    tk_mutex_unlock(task->mutex);
+  }
+
+  if (s != NULL) {
+    ftp_fs_checkin(ftp_fs, s);
+  }
+
+  return RET_OK;
+}
+
+static void* ftp_dir_worker_thread_entry(void* args) {
+  ftp_dir_worker_run((ftp_dir_worker_t*)args);
+
+  return NULL;
+}
+
+/*用workers个线程(包括当前线程)执行所有的传输。*/
+static ret_t ftp_dir_task_run(ftp_dir_task_t* task, uint32_t workers) {
+  uint32_t i = 0;
+  tk_thread_t** threads = NULL;
+  ftp_dir_worker_t* items = NULL;
+
+  workers = tk_max(tk_min(workers, task->jobs.size), 1);
+  items = TKMEM_ZALLOCN(ftp_dir_worker_t, workers);
+  threads = TKMEM_ZALLOCN(tk_thread_t*, workers);
+  if (items == NULL || threads == NULL) {
+    TKMEM_FREE(items);
+    TKMEM_FREE(threads);
+    return RET_OOM;
+  }
+
+  for (i = 0; i < workers; i++) {
+    items[i].task = task;
+  }
+
+  for (i = 1; i < workers; i++) {
+    threads[i] = tk_thread_create(ftp_dir_worker_thread_entry, items + i);
+    if (threads[i] != NULL && tk_thread_start(threads[i]) != RET_OK) {
+      tk_thread_destroy(threads[i]);
+      threads[i] = NULL;
+    }
+  }
+
+  /*启动失败的线程不影响结果，剩下的文件由其它线程完成。*/
+  ftp_dir_worker_run(items);
+  for (i = 1; i < workers; i++) {
+    if (threads[i] != NULL) {
+      tk_thread_join(threads[i]);
+      tk_thread_destroy(threads[i]);
+    }
+  }
+  TKMEM_FREE(items);
+  TKMEM_FREE(threads);
+
+  if (task->cancelled) {
+    task->ret = RET_STOP;
+  }
+
+  return task->ret;
+}
+
+ret_t ftp_fs_download_dir(fs_t* fs, const char* remote_dir, const char* local_dir,
+                          uint32_t workers, ftp_fs_on_progress_t on_progress,
+                          ftp_fs_on_file_done_t on_file_done, void* ctx) {
+  uint32_t i = 0;
+  darray_t entries;
+  ret_t ret = RET_OK;
+  ftp_dir_task_t task;
+  ftp_session_t* s = NULL;
+  char abs_root[MAX_PATH + 1] = {0};
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(remote_dir != NULL && local_dir != NULL, RET_BAD_PARAMS);
+
+  s = ftp_fs_checkout(ftp_fs);
+  return_value_if_fail(s != NULL, RET_IO);
+
+  darray_init(&entries, 64, default_destroy, NULL);
+  ftp_fs_abs_path(ftp_fs, remote_dir, abs_root, sizeof(abs_root));
+  ret = ftp_session_walk_remote(s, abs_root, &entries);
+  ftp_fs_checkin(ftp_fs, s);
+
+  if (ret == RET_OK) {
+    ret = ftp_dir_task_init(&task, ftp_fs, on_progress, on_file_done, ctx);
+  }
+
+  if (ret == RET_OK) {
+    /*先创建所有的本地目录，传输文件时不再检查。*/
+    if (!dir_exist(local_dir) && fs_create_dir_r(os_fs(), local_dir) != RET_OK) {
+      ret = RET_FAIL;
+    }
+
+    for (i = 0; ret == RET_OK && i < entries.size; i++) {
+      char local[MAX_PATH + 1] = {0};
+      char remote[MAX_PATH + 1] = {0};
+      ftp_dir_entry_t* entry = (ftp_dir_entry_t*)darray_get(&entries, i);
+
+      path_build(local, sizeof(local), local_dir, entry->rel, NULL);
+      if (entry->is_dir) {
+        if (!dir_exist(local) && fs_create_dir_r(os_fs(), local) != RET_OK) {
+          log_warn("create %s failed\n", local);
+          ret = RET_FAIL;
+        }
+      } else {
+        ftp_path_normalize(abs_root, entry->rel, remote, sizeof(remote));
+        ret = ftp_dir_task_add(&task, remote, local, FALSE, entry->size);
+      }
+    }
+
+    if (ret == RET_OK) {
+      ret = ftp_dir_task_run(&task, workers);
+    }
+    ftp_dir_task_deinit(&task);
+  }
+  darray_deinit(&entries);
+
+  return ret;
+}
+
+/*
+ * 用一次批量操作创建(create为TRUE)或删除entries中的所有目录和文件，rets可以为NULL。
+ * 创建时entries按从上到下的顺序排列，删除时按从下到上的顺序排列。
+ */
+static ret_t ftp_fs_batch_entries(ftp_fs_t* ftp_fs, bool_t create, const char* abs_root,
+                                  darray_t* entries, ret_t* rets) {
+  uint32_t i = 0;
+  uint32_t nr = entries->size;
+  char* names = NULL;
+  ret_t ret = RET_OK;
+  ftp_fs_batch_item_t* items = NULL;
+  return_value_if_fail(nr > 0, RET_OK);
+
+  names = (char*)TKMEM_ALLOC(nr * (MAX_PATH + 1));
+  items = TKMEM_ZALLOCN(ftp_fs_batch_item_t, nr);
+  if (names == NULL || items == NULL) {
+    TKMEM_FREE(names);
+    TKMEM_FREE(items);
+    return RET_OOM;
+  }
+
+  for (i = 0; i < nr; i++) {
+    char* name = names + i * (MAX_PATH + 1);
+    ftp_dir_entry_t* entry = (ftp_dir_entry_t*)darray_get(entries, i);
+
+    ftp_path_normalize(abs_root, entry->rel, name, MAX_PATH + 1);
+    if (create) {
+      items[i].op = FTP_FS_BATCH_CREATE_DIR;
+    } else {
+      items[i].op = entry->is_dir ? FTP_FS_BATCH_REMOVE_DIR : FTP_FS_BATCH_REMOVE_FILE;
+    }
+    items[i].name = name;
+  }
+
+  ret = ftp_fs_batch((fs_t*)ftp_fs, items, nr, FALSE);
+  for (i = 0; rets != NULL && i < nr; i++) {
+    rets[i] = items[i].ret;
+  }
+  TKMEM_FREE(names);
+  TKMEM_FREE(items);
+
+  return ret;
+}
+
+ret_t ftp_fs_upload_dir(fs_t* fs, const char* local_dir, const char* remote_dir,
+                        uint32_t workers, ftp_fs_on_progress_t on_progress,
+                        ftp_fs_on_file_done_t on_file_done, void* ctx) {
+  uint32_t i = 0;
+  darray_t entries;
+  ret_t ret = RET_OK;
+  ftp_dir_task_t task;
+  char abs_root[MAX_PATH + 1] = {0};
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(remote_dir != NULL && local_dir != NULL, RET_BAD_PARAMS);
+
+  darray_init(&entries, 64, default_destroy, NULL);
+  ftp_fs_abs_path(ftp_fs, remote_dir, abs_root, sizeof(abs_root));
+  ret = ftp_walk_local(local_dir, &entries);
+
+  if (ret == RET_OK && !fs_dir_exist(fs, abs_root)) {
+    ret = fs_create_dir_r(fs, abs_root);
+  }
+
+  if (ret == RET_OK) {
+    darray_t dirs;
+
+    /*已经存在的目录会创建失败，忽略即可。*/
+    darray_init(&dirs, 16, NULL, NULL);
+    for (i = 0; i < entries.size; i++) {
+      ftp_dir_entry_t* entry = (ftp_dir_entry_t*)darray_get(&entries, i);
+      if (entry->is_dir && darray_push(&dirs, entry) != RET_OK) {
+        ret = RET_OOM;
+        break;
+      }
+    }
+    if (ret == RET_OK) {
+      ftp_fs_batch_entries(ftp_fs, TRUE, abs_root, &dirs, NULL);
+    }
+    darray_deinit(&dirs);
+  }
+
+  if (ret == RET_OK) {
+    ret = ftp_dir_task_init(&task, ftp_fs, on_progress, on_file_done, ctx);
+    for (i = 0; ret == RET_OK && i < entries.size; i++) {
+      char local[MAX_PATH + 1] = {0};
+      char remote[MAX_PATH + 1] = {0};
+      ftp_dir_entry_t* entry = (ftp_dir_entry_t*)darray_get(&entries, i);
+
+      if (!entry->is_dir) {
+        path_build(local, sizeof(local), local_dir, entry->rel, NULL);
+        ftp_path_normalize(abs_root, entry->rel, remote, sizeof(remote));
+        ret = ftp_dir_task_add(&task, remote, local, TRUE, entry->size);
+      }
+    }
+
+    if (ret == RET_OK) {
+      ret = ftp_dir_task_run(&task, workers);
+    }
+    ftp_dir_task_deinit(&task);
+  }
+  darray_deinit(&entries);
+
+  return ret;
+}
+
+static int ftp_dir_entry_compare(const void* a, const void* b) {
+  return strcmp(((const ftp_dir_entry_t*)a)->rel, ((const ftp_dir_entry_t*)b)->rel);
+}
+
+static int ftp_dir_entry_compare_rel(const void* a, const void* b) {
+  return strcmp(((const ftp_dir_entry_t*)a)->rel, (const char*)b);
+}
+
+/*
+ * 目标文件是上次同步时写入的，它的修改时间晚于当时的源文件，
+ * 所以只有源文件的长度不同或者修改时间晚于目标文件时才需要重新传输。
+ */
+static bool_t ftp_sync_is_changed(const ftp_dir_entry_t* src, const ftp_dir_entry_t* dst,
+                                  bool_t size_only) {
+  if (src->size != dst->size) {
+    return TRUE;
+  }
+
+  return !size_only && src->mtime > dst->mtime;
+}
+
+/*一次同步的上下文，源和目标的目录树用相对路径对应起来。*/
+typedef struct _ftp_sync_t {
+  ftp_fs_t* ftp_fs;
+  const char* local_dir;
+  char abs_root[MAX_PATH + 1];
+  const ftp_fs_sync_options_t* options;
+  darray_t locals;
+  darray_t remotes;
+  darray_t mkdirs;
+  darray_t removes;
+  ftp_dir_task_t task;
+} ftp_sync_t;
+
+static ret_t ftp_sync_plan_one(ftp_sync_t* sync, ftp_fs_sync_action_t action, ftp_dir_entry_t* entry,
+                               char* local, char* remote) {
+  const ftp_fs_sync_options_t* options = sync->options;
+
+  path_build(local, MAX_PATH + 1, sync->local_dir, entry->rel, NULL);
+  ftp_path_normalize(sync->abs_root, entry->rel, remote, MAX_PATH + 1);
+  if (options->on_plan != NULL) {
+    return options->on_plan(options->ctx, action, remote, local);
+  }
+
+  return RET_OK;
+}
+
+/*比较两边的目录树，生成需要创建的目录、需要传输的文件和需要删除的文件。*/
+static ret_t ftp_sync_plan(ftp_sync_t* sync) {
+  int32_t i = 0;
+  ret_t ret = RET_OK;
+  const ftp_fs_sync_options_t* options = sync->options;
+  darray_t* src = options->upload ? &(sync->locals) : &(sync->remotes);
+  darray_t* dst = options->upload ? &(sync->remotes) : &(sync->locals);
+
+  darray_sort(dst, ftp_dir_entry_compare);
+  for (i = 0; ret == RET_OK && i < (int32_t)(src->size); i++) {
+    char local[MAX_PATH + 1] = {0};
+    char remote[MAX_PATH + 1] = {0};
+    ftp_fs_sync_action_t action = FTP_FS_SYNC_COPY_NEW;
+    ftp_dir_entry_t* entry = (ftp_dir_entry_t*)darray_get(src, i);
+    int32_t index = darray_bsearch_index(dst, ftp_dir_entry_compare_rel, entry->rel);
+    ftp_dir_entry_t* other = index >= 0 ? (ftp_dir_entry_t*)darray_get(dst, index) : NULL;
+
+    if (other != NULL) {
+      other->matched = TRUE;
+      if (other->is_dir != entry->is_dir) {
+        log_warn("%s is a %s on one side and a %s on the other, skip it\n", entry->rel,
+                 entry->is_dir ? "dir" : "file", entry->is_dir ? "file" : "dir");
+        continue;
+      } else if (entry->is_dir || !ftp_sync_is_changed(entry, other, options->size_only)) {
+        continue;
+      }
+      action = FTP_FS_SYNC_COPY_CHANGED;
+    } else if (entry->is_dir) {
+      action = FTP_FS_SYNC_CREATE_DIR;
+    }
+
+    if (ftp_sync_plan_one(sync, action, entry, local, remote) == RET_SKIP) {
+      continue;
+    }
+
+    if (action == FTP_FS_SYNC_CREATE_DIR) {
+      ret = darray_push(&(sync->mkdirs), entry);
+    } else {
+      ret = ftp_dir_task_add(&(sync->task), remote, local, options->upload, entry->size);
+    }
+  }
+
+  /*目标中多余的项按从下到上的顺序删除，先删除目录中的文件再删除目录。*/
+  for (i = (int32_t)(dst->size) - 1; ret == RET_OK && options->remove_extra && i >= 0; i--) {
+    char local[MAX_PATH + 1] = {0};
+    char remote[MAX_PATH + 1] = {0};
+    ftp_dir_entry_t* entry = (ftp_dir_entry_t*)darray_get(dst, i);
+
+    if (!entry->matched &&
+        ftp_sync_plan_one(sync, entry->is_dir ? FTP_FS_SYNC_REMOVE_DIR : FTP_FS_SYNC_REMOVE_FILE,
+                          entry, local, remote) != RET_SKIP) {
+      ret = darray_push(&(sync->removes), entry);
+    }
+  }
+
+  return ret;
+}
+
+static ret_t ftp_sync_create_dirs(ftp_sync_t* sync) {
+  uint32_t i = 0;
+  ftp_fs_t* ftp_fs = sync->ftp_fs;
+
+  if (sync->options->upload) {
+    if (!fs_dir_exist((fs_t*)ftp_fs, sync->abs_root) &&
+        fs_create_dir_r((fs_t*)ftp_fs, sync->abs_root) != RET_OK) {
+      return RET_FAIL;
+    }
+
+    /*已经存在的目录会创建失败，忽略即可。*/
+    ftp_fs_batch_entries(ftp_fs, TRUE, sync->abs_root, &(sync->mkdirs), NULL);
+
+    return RET_OK;
+  }
+
+  if (!dir_exist(sync->local_dir) && fs_create_dir_r(os_fs(), sync->local_dir) != RET_OK) {
+    return RET_FAIL;
+  }
+
+  for (i = 0; i < sync->mkdirs.size; i++) {
+    char local[MAX_PATH + 1] = {0};
+    ftp_dir_entry_t* entry = (ftp_dir_entry_t*)darray_get(&(sync->mkdirs), i);
+
+    path_build(local, sizeof(local), sync->local_dir, entry->rel, NULL);
+    if (!dir_exist(local) && fs_create_dir_r(os_fs(), local) != RET_OK) {
+      log_warn("create %s failed\n", local);
+      return RET_FAIL;
+    }
+  }
+
+  return RET_OK;
+}
+
+static ret_t ftp_sync_remove_extra(ftp_sync_t* sync) {
+  uint32_t i = 0;
+  ret_t ret = RET_OK;
+  ret_t* rets = NULL;
+  uint32_t nr = sync->removes.size;
+  const ftp_fs_sync_options_t* options = sync->options;
+  return_value_if_fail(nr > 0, RET_OK);
+
+  rets = TKMEM_ZALLOCN(ret_t, nr);
+  return_value_if_fail(rets != NULL, RET_OOM);
+
+  if (options->upload) {
+    ftp_fs_batch_entries(sync->ftp_fs, FALSE, sync->abs_root, &(sync->removes), rets);
+  }
+
+  for (i = 0; i < nr; i++) {
+    char local[MAX_PATH + 1] = {0};
+    char remote[MAX_PATH + 1] = {0};
+    ftp_dir_entry_t* entry = (ftp_dir_entry_t*)darray_get(&(sync->removes), i);
+
+    path_build(local, sizeof(local), sync->local_dir, entry->rel, NULL);
+    ftp_path_normalize(sync->abs_root, entry->rel, remote, sizeof(remote));
+    if (!options->upload) {
+      if (entry->is_dir) {
+        rets[i] = fs_remove_dir(os_fs(), local);
+      } else {
+        rets[i] = fs_remove_file(os_fs(), local);
+      }
+    }
+
+    if (rets[i] != RET_OK) {
+      ret = rets[i];
+    }
+    if (options->on_file_done != NULL) {
+      options->on_file_done(options->ctx, remote, local, rets[i]);
+    }
+  }
+  TKMEM_FREE(rets);
+
+  return ret;
+}
+
+static ret_t ftp_sync_deinit(ftp_sync_t* sync) {
+  ftp_dir_task_deinit(&(sync->task));
+  darray_deinit(&(sync->mkdirs));
+  darray_deinit(&(sync->removes));
+  darray_deinit(&(sync->locals));
+  darray_deinit(&(sync->remotes));
+
+  return RET_OK;
+}
+
+ret_t ftp_fs_sync(fs_t* fs, const char* local_dir, const char* remote_dir,
+                  const ftp_fs_sync_options_t* options) {
+  ftp_sync_t sync;
+  ret_t ret = RET_OK;
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL && options != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(remote_dir != NULL && local_dir != NULL, RET_BAD_PARAMS);
+
+  memset(&sync, 0x00, sizeof(sync));
+  sync.ftp_fs = ftp_fs;
+  sync.options = options;
+  sync.local_dir = local_dir;
+  ftp_fs_abs_path(ftp_fs, remote_dir, sync.abs_root, sizeof(sync.abs_root));
+  darray_init(&(sync.locals), 64, default_destroy, NULL);
+  darray_init(&(sync.remotes), 64, default_destroy, NULL);
+  darray_init(&(sync.mkdirs), 16, NULL, NULL);
+  darray_init(&(sync.removes), 16, NULL, NULL);
+  ret = ftp_dir_task_init(&(sync.task), ftp_fs, options->on_progress, options->on_file_done,
+                          options->ctx);
+
+  /*目标目录不存在时当作空目录，源目录必须存在。*/
+  if (ret == RET_OK) {
+    if (dir_exist(local_dir)) {
+      ret = ftp_walk_local(local_dir, &(sync.locals));
+    } else if (options->upload) {
+      ret = RET_NOT_FOUND;
+    }
+  }
+
+  if (ret == RET_OK) {
+    if (fs_dir_exist(fs, sync.abs_root)) {
+      ftp_session_t* s = ftp_fs_checkout(ftp_fs);
+      if (s != NULL) {
+        ret = ftp_session_walk_remote(s, sync.abs_root, &(sync.remotes));
+        ftp_fs_checkin(ftp_fs, s);
+      } else {
+        ret = RET_IO;
+      }
+    } else if (!options->upload) {
+      ret = RET_NOT_FOUND;
+    }
+  }
+
+  if (ret == RET_OK) {
+    ret = ftp_sync_plan(&sync);
+  }
+
+  if (ret == RET_OK && !options->dry_run) {
+    ret = ftp_sync_create_dirs(&sync);
+    if (ret == RET_OK && sync.task.jobs.size > 0) {
+      ret = ftp_dir_task_run(&(sync.task), options->workers);
+    }
+
+    /*传输没有全部成功时不删除，避免目标中只剩下不完整的内容。*/
+    if (ret == RET_OK) {
+      ret = ftp_sync_remove_extra(&sync);
+    }
+  }
+  ftp_sync_deinit(&sync);
+
+  return ret;
+}
+
+typedef enum _ftp_nb_state_t {
+  FTP_NB_CHECKOUT = 0,
+  FTP_NB_PASV,
+  FTP_NB_OPEN,
+  FTP_NB_DATA,
+  FTP_NB_CLOSE,
+  FTP_NB_DONE
+} ftp_nb_state_t;
+
+struct _ftp_fs_nb_transfer_t {
+  ftp_fs_t* ftp_fs;
+  ftp_session_t* s;
+  bool_t upload;
+  char remote_filename[MAX_PATH + 1];
+  char local_filename[MAX_PATH + 1];
+  ftp_fs_on_progress_t on_progress;
+  void* ctx;
+
+  ftp_nb_state_t state;
+  /*FTP_NB_PASV状态下发出的是EPSV。*/
+  bool_t epsv;
+  fs_file_t* file;
+  int data_sock;
+  uint64_t total;
+  bool_t cancelled;
+  ret_t ret;
+
+  /*上传时从文件读出但还没有发送出去的数据。*/
+  uint32_t pending_offset;
+  uint32_t pending_len;
+};
+
+/*结束传输。sync为FALSE表示控制连接上还有没读走的回复，这个连接只能丢弃。*/
+static ret_t ftp_fs_nb_transfer_finish(ftp_fs_nb_transfer_t* t, ret_t ret, bool_t sync) {
+  if (t->s != NULL) {
+    ftp_session_close_data(t->s);
+    ftp_session_set_on_progress(t->s, NULL, NULL, 0);
+    if (!sync) {
+      t->s->broken = TRUE;
+    }
+    ftp_fs_checkin(t->ftp_fs, t->s);
+    t->s = NULL;
+  }
+
+  if (t->file != NULL) {
+    fs_file_close(t->file);
+    t->file = NULL;
+  }
+
+  if (t->upload) {
+    ftp_fs_stat_cache_invalidate(t->ftp_fs, t->remote_filename);
+  }
+
+  t->data_sock = -1;
+  t->ret = ret;
+  t->state = FTP_NB_DONE;
+
+  return ret;
+}
+
+static ret_t ftp_fs_nb_transfer_send_cmd(ftp_fs_nb_transfer_t* t, const char* verb,
+                                         const char* arg) {
+  int32_t len = 0;
+  char cmd[FTP_CMD_MAX_SIZE] = {0};
+
+  if (arg != NULL) {
+    tk_snprintf(cmd, sizeof(cmd), "%s %s\r\n", verb, arg);
+  } else {
+    tk_snprintf(cmd, sizeof(cmd), "%s\r\n", verb);
+  }
+
+  len = strlen(cmd);
+  t->s->round_trips++;
+  if (tk_iostream_write_len(t->s->ios, cmd, len, 2000) != len) {
+    t->s->broken = TRUE;
+    return RET_IO;
+  }
+
+  return RET_OK;
+}
+
+static ret_t ftp_fs_nb_transfer_checkout(ftp_fs_nb_transfer_t* t) {
+  fs_stat_info_t st;
+  ret_t reason = RET_OK;
+
+  t->s = ftp_fs_checkout_ex(t->ftp_fs, FALSE, &reason);
+  if (t->s == NULL) {
+    /*连接都在使用中时下次再试。*/
+    return reason;
+  }
+
+  if (t->upload) {
+    t->file = fs_open_file(os_fs(), t->local_filename, "rb");
+    if (t->file != NULL && fs_stat(os_fs(), t->local_filename, &st) == RET_OK) {
+      t->total = st.size;
+    }
+  } else if (ftp_fs_ensure_local_dir(t->local_filename) == RET_OK) {
+    t->file = fs_open_file(os_fs(), t->local_filename, "wb+");
+  }
+  if (t->file == NULL) {
+    return ftp_fs_nb_transfer_finish(t, RET_FAIL, TRUE);
+  }
+
+  ftp_session_set_on_progress(t->s, t->on_progress, t->ctx, t->total);
+  ftp_session_close_data(t->s);
+  t->epsv = tk_str_eq(ftp_session_pasv_cmd(t->s), "EPSV");
+  if (ftp_fs_nb_transfer_send_cmd(t, t->epsv ? "EPSV" : "PASV", NULL) != RET_OK) {
+    return ftp_fs_nb_transfer_finish(t, RET_IO, FALSE);
+  }
+  t->state = FTP_NB_PASV;
+
+  return RET_BUSY;
+}
+
+static ret_t ftp_fs_nb_transfer_on_reply(ftp_fs_nb_transfer_t* t) {
+  int32_t code = 0;
+  ret_t ret = ftp_session_poll_reply(t->s, &code);
+
+  if (ret == RET_BUSY) {
+    return RET_BUSY;
+  } else if (ret != RET_OK) {
+    return ftp_fs_nb_transfer_finish(t, ret, FALSE);
+  }
+
+  ret = ftp_session_check_reply(t->s, code, NULL, NULL, 0);
+  switch (t->state) {
+    case FTP_NB_PASV: {
+      if (ret != RET_OK) {
+        if (!t->epsv) {
+          return ftp_fs_nb_transfer_finish(t, RET_FAIL, TRUE);
+        }
+
+        /*和阻塞方式一样，EPSV失败后改用PASV，仍然等待PASV的回复。*/
+        ftp_session_disable_feature(t->s, FTP_FEATURE_EPSV);
+        t->epsv = FALSE;
+        ret = ftp_fs_nb_transfer_send_cmd(t, "PASV", NULL);
+        if (ret != RET_OK) {
+          return ftp_fs_nb_transfer_finish(t, ret, FALSE);
+        }
+        break;
+      }
+
+      ret = ftp_session_pasv_connect(t->s, (const char*)(t->s->reply.data));
+      if (ret != RET_OK) {
+        return ftp_fs_nb_transfer_finish(t, ret, TRUE);
+      }
+
+      t->data_sock = TK_IOSTREAM_TCP(t->s->data_ios)->sock;
+      tk_socket_set_blocking(t->data_sock, FALSE);
+      ret = ftp_fs_nb_transfer_send_cmd(t, t->upload ? "STOR" : "RETR", t->remote_filename);
+      if (ret != RET_OK) {
+        return ftp_fs_nb_transfer_finish(t, ret, FALSE);
+      }
+      t->state = FTP_NB_OPEN;
+      break;
+    }
+    case FTP_NB_OPEN: {
+      if (ret != RET_OK || code >= 200) {
+        return ftp_fs_nb_transfer_finish(t, t->upload ? RET_FAIL : RET_NOT_FOUND, TRUE);
+      }
+      t->state = FTP_NB_DATA;
+      break;
+    }
+    case FTP_NB_CLOSE: {
+      return ftp_fs_nb_transfer_finish(t, (code >= 200 && code < 300) ? RET_OK : RET_FAIL, TRUE);
+    }
+    default:
+      break;
+  }
+
+  return RET_BUSY;
+}
+
+static ret_t ftp_fs_nb_transfer_recv(ftp_fs_nb_transfer_t* t, uint32_t max_bytes) {
+  uint32_t done = 0;
+  uint32_t buf_size = 0;
+  uint8_t* buf = ftp_session_get_buffer(t->s, &buf_size);
+
+  if (buf == NULL) {
+    return ftp_fs_nb_transfer_finish(t, RET_OOM, FALSE);
+  }
+
+  while (done < max_bytes) {
+    int32_t ret = tk_socket_recv(t->data_sock, buf, tk_min(buf_size, max_bytes - done), 0);
+
+    if (ret == 0) {
+      /*数据连接已经关闭，等待226。*/
+      ftp_session_close_data(t->s);
+      t->data_sock = -1;
+      t->state = FTP_NB_CLOSE;
+      break;
+    } else if (ret < 0) {
+      if (tk_socket_last_io_has_error()) {
+        return ftp_fs_nb_transfer_finish(t, RET_IO, FALSE);
+      }
+      break;
+    }
+
+    if (fs_file_write(t->file, buf, ret) != ret) {
+      return ftp_fs_nb_transfer_finish(t, RET_IO, FALSE);
+    }
+    done += ret;
+
+    if (ftp_session_progress(t->s, ret) == RET_STOP) {
+      return ftp_fs_nb_transfer_finish(t, RET_STOP, FALSE);
+    }
+  }
+
+  return RET_BUSY;
+}
+
+static ret_t ftp_fs_nb_transfer_send(ftp_fs_nb_transfer_t* t, uint32_t max_bytes) {
+  uint32_t done = 0;
+  uint32_t buf_size = 0;
+  uint8_t* buf = ftp_session_get_buffer(t->s, &buf_size);
+
+  if (buf == NULL) {
+    return ftp_fs_nb_transfer_finish(t, RET_OOM, FALSE);
+  }
+
+  while (done < max_bytes) {
+    int32_t ret = 0;
+
+    if (t->pending_len == 0) {
+      ret = fs_file_read(t->file, buf, buf_size);
+      if (ret <= 0) {
+        /*文件已经发送完，关闭数据连接后等待226。*/
+        ftp_session_close_data(t->s);
+        t->data_sock = -1;
+        t->state = FTP_NB_CLOSE;
+        break;
+      }
+      t->pending_offset = 0;
+      t->pending_len = ret;
+    }
+
+    ret = tk_socket_send(t->data_sock, buf + t->pending_offset,
+                         tk_min(t->pending_len, max_bytes - done), 0);
+    if (ret <= 0) {
+      if (ret < 0 && tk_socket_last_io_has_error()) {
+        return ftp_fs_nb_transfer_finish(t, RET_IO, FALSE);
+      }
+      break;
+    }
+
+    t->pending_offset += ret;
+    t->pending_len -= ret;
+    done += ret;
+
+    if (ftp_session_progress(t->s, ret) == RET_STOP) {
+      return ftp_fs_nb_transfer_finish(t, RET_STOP, FALSE);
+    }
+  }
+
+  return RET_BUSY;
+}
+
+ftp_fs_nb_transfer_t* ftp_fs_nb_transfer_create(fs_t* fs, bool_t upload,
+                                                const char* remote_filename,
+                                                const char* local_filename,
+                                                ftp_fs_on_progress_t on_progress, void* ctx) {
+  ftp_fs_nb_transfer_t* t = NULL;
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL, NULL);
+  return_value_if_fail(remote_filename != NULL && local_filename != NULL, NULL);
+
+  t = TKMEM_ZALLOC(ftp_fs_nb_transfer_t);
+  return_value_if_fail(t != NULL, NULL);
+
+  t->ftp_fs = ftp_fs;
+  t->upload = upload;
+  t->data_sock = -1;
+  t->ret = RET_BUSY;
+  t->on_progress = on_progress;
+  t->ctx = ctx;
+  t->state = FTP_NB_CHECKOUT;
+  ftp_fs_abs_path(ftp_fs, remote_filename, t->remote_filename, sizeof(t->remote_filename));
+  tk_strncpy(t->local_filename, local_filename, sizeof(t->local_filename) - 1);
+
+  return t;
+}
+
+ret_t ftp_fs_nb_transfer_step(ftp_fs_nb_transfer_t* t, uint32_t max_bytes) {
+  return_value_if_fail(t != NULL, RET_BAD_PARAMS);
+
+  if (t->state == FTP_NB_DONE) {
+    return t->ret;
+  }
+
+  if (t->cancelled) {
+    /*不等服务器的回复，直接丢弃控制连接，保证不会阻塞。*/
+    return ftp_fs_nb_transfer_finish(t, RET_STOP, FALSE);
+  }
+
+  switch (t->state) {
+    case FTP_NB_CHECKOUT: {
+      return ftp_fs_nb_transfer_checkout(t);
+    }
+    case FTP_NB_DATA: {
+      if (t->upload) {
+        return ftp_fs_nb_transfer_send(t, max_bytes);
+      } else {
+        return ftp_fs_nb_transfer_recv(t, max_bytes);
+      }
+    }
+    default: {
+      return ftp_fs_nb_transfer_on_reply(t);
+    }
+  }
+}
+
+ret_t ftp_fs_nb_transfer_cancel(ftp_fs_nb_transfer_t* t) {
+  return_value_if_fail(t != NULL, RET_BAD_PARAMS);
+
+  t->cancelled = TRUE;
+
+  return RET_OK;
+}
+
+ret_t ftp_fs_nb_transfer_destroy(ftp_fs_nb_transfer_t* t) {
+  return_value_if_fail(t != NULL, RET_BAD_PARAMS);
+
+  if (t->state != FTP_NB_DONE) {
+    ftp_fs_nb_transfer_finish(t, RET_STOP, FALSE);
+  }
+  TKMEM_FREE(t);
+
+  return RET_OK;
+}
+
+/*读取数据连接中接下来的size个字节，用于比较续传时重叠的部分。*/
+static ret_t ftp_session_recv_to_buffer(ftp_session_t* s, uint8_t* buf, uint32_t size) {
+  int32_t ret = 0;
+  uint32_t done = 0;
+  return_value_if_fail(s != NULL && s->data_ios != NULL && buf != NULL, RET_BAD_PARAMS);
+
+  while (done < size) {
+    ret = tk_iostream_read(s->data_ios, buf + done, size - done);
+    break_if_fail(ret > 0);
+    done += ret;
+  }
+
+  return done == size ? RET_OK : RET_IO;
+}
+
+static bool_t ftp_fs_local_range_eq(const char* local_filename, uint64_t offset, const uint8_t* data,
+                                    uint32_t size) {
+  bool_t eq = FALSE;
+  uint8_t* buf = NULL;
+  fs_file_t* file = NULL;
+
+  buf = (uint8_t*)TKMEM_ALLOC(size);
+  return_value_if_fail(buf != NULL, FALSE);
+
+  file = fs_open_file(os_fs(), local_filename, "rb");
+  if (file != NULL) {
+    if (fs_file_seek(file, offset) == RET_OK && fs_file_read(file, buf, size) == (int32_t)size) {
+      eq = memcmp(buf, data, size) == 0;
+    }
+    fs_file_close(file);
+  }
+  TKMEM_FREE(buf);
+
+  return eq;
+}
+
+static ret_t ftp_session_cmd_download_file_resume(ftp_session_t* s, const char* remote_filename,
+                                                  const char* local_filename,
+                                                  uint32_t verify_size) {
+  ret_t ret = RET_OK;
+  uint64_t size = 0;
+  uint8_t* tail = NULL;
+  fs_file_t* file = NULL;
+  int64_t local_size = file_exist(local_filename) ? file_get_size(local_filename) : 0;
+  bool_t has_size = ftp_session_cmd_get_size(s, remote_filename, &size) == RET_OK;
+
+  if (local_size <= 0 || (has_size && (uint64_t)local_size > size)) {
+    return ftp_session_cmd_download_file(s, remote_filename, local_filename);
+  }
+
+  if (has_size && (uint64_t)local_size == size && verify_size == 0) {
+    return RET_OK;
+  }
+
+  /*从重叠部分的起点开始取数据，校验通过后剩下的数据直接追加到本地文件。*/
+  verify_size = tk_min(verify_size, (uint64_t)local_size);
+  ret = ftp_session_retr_begin(s, remote_filename, local_size - verify_size);
+  if (ret == RET_NOT_IMPL) {
+    log_debug("server does not support REST, download %s again\n", remote_filename);
+    return ftp_session_cmd_download_file(s, remote_filename, local_filename);
+  }
+  return_value_if_fail(ret == RET_OK, ret);
+
+  if (verify_size > 0) {
+    tail = (uint8_t*)TKMEM_ALLOC(verify_size);
+    ret = tail != NULL ? ftp_session_recv_to_buffer(s, tail, verify_size) : RET_OOM;
+    if (ret == RET_OK &&
+        !ftp_fs_local_range_eq(local_filename, local_size - verify_size, tail, verify_size)) {
+      ret = RET_CRC;
+    }
+    TKMEM_FREE(tail);
+
+    if (ret != RET_OK) {
+      ftp_session_retr_end(s, TRUE);
+      if (ret == RET_CRC) {
+        log_debug("%s changed, download it again\n", remote_filename);
+        return ftp_session_cmd_download_file(s, remote_filename, local_filename);
+      }
+      return ret;
+    }
+  }
+
+  file = fs_open_file(os_fs(), local_filename, "rb+");
+  if (file != NULL && fs_file_seek(file, local_size) == RET_OK) {
+    ret = ftp_session_recv_to_file(s, file, 0);
+  } else {
+    ret = RET_FAIL;
+  }
+
+  if (file != NULL) {
+    fs_file_close(file);
+  }
+
+  if (ret == RET_OK) {
+    return ftp_session_retr_end(s, FALSE);
+  } else {
+    ftp_session_retr_end(s, TRUE);
+    return ret;
+  }
+}
+
+ret_t ftp_fs_download_file_resume(fs_t* fs, const char* remote_filename,
+                                  const char* local_filename, uint32_t verify_size) {
+  ret_t ret = RET_OK;
+  ftp_session_t* s = NULL;
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(remote_filename != NULL && local_filename != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(ftp_fs_ensure_local_dir(local_filename) == RET_OK, RET_FAIL);
+
+  s = ftp_fs_checkout(ftp_fs);
+  return_value_if_fail(s != NULL, RET_IO);
+
+  ret = ftp_session_cmd_download_file_resume(s, remote_filename, local_filename, verify_size);
+  ftp_fs_checkin(ftp_fs, s);
+
+  return ret;
+}
+
+/*远程文件和本地文件前offset个字节相同，用APPE(不支持时用REST+STOR)上传剩下的部分。*/
+static ret_t ftp_session_cmd_upload_tail(ftp_session_t* s, const char* local_filename,
+                                         const char* remote_filename, uint64_t offset) {
+  ret_t ret = RET_OK;
+  fs_file_t* file = NULL;
+
+  file = fs_open_file(os_fs(), local_filename, "rb");
+  return_value_if_fail(file != NULL, RET_FAIL);
+
+  if (fs_file_seek(file, offset) == RET_OK) {
+    ret = ftp_session_stor_begin(s, "APPE", remote_filename, 0);
+    if (ret != RET_OK) {
+      ret = ftp_session_stor_begin(s, "STOR", remote_filename, offset);
+    }
+
+    if (ret == RET_OK) {
+      ret = ftp_session_send_from_file(s, file, 0);
+      if (ret == RET_OK) {
+        ret = ftp_session_stor_end(s);
+      } else {
+        /*数据没有发完时服务器仍然可能回复226，不能按成功处理。*/
+        ftp_session_abort(s);
+      }
+    }
+  } else {
+    ret = RET_FAIL;
+  }
+  fs_file_close(file);
+
+  return ret;
+}
+
+static ret_t ftp_session_cmd_upload_file_resume(ftp_session_t* s, const char* local_filename,
+                                                const char* remote_filename,
+                                                uint32_t verify_size) {
+  ret_t ret = RET_OK;
+  uint64_t size = 0;
+  uint8_t* tail = NULL;
+  int64_t local_size = file_get_size(local_filename);
+  return_value_if_fail(local_size >= 0, RET_NOT_FOUND);
+
+  if (ftp_session_cmd_get_size(s, remote_filename, &size) != RET_OK || size == 0 ||
+      size > (uint64_t)local_size) {
+    return ftp_session_cmd_upload_file(s, local_filename, remote_filename);
+  }
+
+  verify_size = (uint32_t)tk_min(verify_size, size);
+  if (verify_size > 0) {
+    /*取回远程文件的末尾，和本地文件相同位置的数据比较。*/
+    tail = (uint8_t*)TKMEM_ALLOC(verify_size);
+    return_value_if_fail(tail != NULL, RET_OOM);
+
+    ret = ftp_session_retr_begin(s, remote_filename, size - verify_size);
+    if (ret == RET_OK) {
+      ret = ftp_session_recv_to_buffer(s, tail, verify_size);
+      ftp_session_retr_end(s, ret != RET_OK);
+      if (ret == RET_OK &&
+          !ftp_fs_local_range_eq(local_filename, size - verify_size, tail, verify_size)) {
+        ret = RET_CRC;
+      }
+    }
+    TKMEM_FREE(tail);
+
+    if (ret != RET_OK) {
+      log_debug("%s does not match, upload it again\n", remote_filename);
+      return ftp_session_cmd_upload_file(s, local_filename, remote_filename);
+    }
+  }
+
+  if (size == (uint64_t)local_size) {
+    return RET_OK;
+  }
+
+  return ftp_session_cmd_upload_tail(s, local_filename, remote_filename, size);
+}
+
+ret_t ftp_fs_upload_file_resume(fs_t* fs, const char* local_filename,
+                                const char* remote_filename, uint32_t verify_size) {
+  ret_t ret = RET_OK;
+  ftp_session_t* s = NULL;
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(remote_filename != NULL && local_filename != NULL, RET_BAD_PARAMS);
+
+  s = ftp_fs_checkout(ftp_fs);
+  return_value_if_fail(s != NULL, RET_IO);
+
+  ret = ftp_session_cmd_upload_file_resume(s, local_filename, remote_filename, verify_size);
+  ftp_fs_checkin(ftp_fs, s);
+  ftp_fs_stat_cache_invalidate(ftp_fs, remote_filename);
+
+  return ret;
+}
+
+static ret_t ftp_fs_cmd_upload_tail(ftp_fs_t* ftp_fs, const char* local_filename,
+                                    const char* remote_filename, uint64_t offset) {
+  ret_t ret = RET_OK;
+  ftp_session_t* s = NULL;
+
+  s = ftp_fs_checkout(ftp_fs);
+  return_value_if_fail(s != NULL, RET_IO);
+
+  ret = ftp_session_cmd_upload_tail(s, local_filename, remote_filename, offset);
+  if (ret == RET_NOT_IMPL) {
+    ret = ftp_session_cmd_upload_file(s, local_filename, remote_filename);
+  }
+  ftp_fs_checkin(ftp_fs, s);
+  ftp_fs_stat_cache_invalidate(ftp_fs, remote_filename);
+
+  return ret;
+}
+
+/*STOR以REST指定的位置开始覆盖写入，不会截断文件，需要服务器支持REST STREAM。*/
+static ret_t ftp_session_cmd_upload_ranges(ftp_session_t* s, const char* local_filename,
+                                           const char* remote_filename, darray_t* ranges,
+                                           uint64_t size) {
+  uint32_t i = 0;
+  ret_t ret = RET_OK;
+  uint64_t remote_size = 0;
+  fs_file_t* file = NULL;
+  ftp_range_t* first = (ftp_range_t*)darray_head(ranges);
+
+  /*多数服务器在REST 0时按普通STOR处理，会截断文件。*/
+  return_value_if_fail(first != NULL && first->start > 0, RET_NOT_IMPL);
+  return_value_if_fail(ftp_session_has_feature(s, FTP_FEATURE_REST_STREAM), RET_NOT_IMPL);
+
+  file = fs_open_file(os_fs(), local_filename, "rb");
+  return_value_if_fail(file != NULL, RET_FAIL);
+
+  for (i = 0; i < ranges->size; i++) {
+    ftp_range_t* iter = (ftp_range_t*)darray_get(ranges, i);
+    uint64_t end = tk_min(iter->end, size);
+    if (iter->start >= end) {
+      continue;
+    }
+
+    ret = fs_file_seek(file, iter->start);
+    break_if_fail(ret == RET_OK);
+    ret = ftp_session_stor_begin(s, "STOR", remote_filename, iter->start);
+    break_if_fail(ret == RET_OK);
+
+    ret = ftp_session_send_from_file(s, file, end - iter->start);
+    if (ret == RET_OK) {
+      ret = ftp_session_stor_end(s);
+    } else {
+      ftp_session_stor_end(s);
+    }
+    break_if_fail(ret == RET_OK);
+  }
+  fs_file_close(file);
+
+  /*确认服务器没有截断文件。*/
+  if (ret == RET_OK) {
+    ret = ftp_session_cmd_get_size(s, remote_filename, &remote_size);
+    if (ret == RET_OK && remote_size != size) {
+      log_debug("%s size mismatch after partial upload\n", remote_filename);
+      ret = RET_FAIL;
+    }
+  }
+
+  return ret;
+}
+
+static ret_t ftp_fs_cmd_upload_ranges(ftp_fs_t* ftp_fs, const char* local_filename,
+                                      const char* remote_filename, darray_t* ranges,
+                                      uint64_t size) {
+  ret_t ret = RET_OK;
+  ftp_session_t* s = NULL;
+
+  s = ftp_fs_checkout(ftp_fs);
+  return_value_if_fail(s != NULL, RET_IO);
+
+  ret = ftp_session_cmd_upload_ranges(s, local_filename, remote_filename, ranges, size);
+  ftp_fs_checkin(ftp_fs, s);
+  ftp_fs_stat_cache_invalidate(ftp_fs, remote_filename);
+
+  return ret;
+}
+
+static ret_t ftp_session_cmd_get_mtime(ftp_session_t* s, const char* filename, char* mtime,
+                                       uint32_t mtime_size) {
+  ret_t ret = RET_FAIL;
+  char cmd[FTP_CMD_MAX_SIZE] = {0};
+  char buf[FTP_BUF_MAX_SIZE] = {0};
+  return_value_if_fail(filename != NULL && mtime != NULL && mtime_size > 1, RET_BAD_PARAMS);
+
+  tk_snprintf(cmd, sizeof(cmd), "MDTM %s\r\n", filename);
+  ret = ftp_session_cmd(s, cmd, NULL, buf, sizeof(buf) - 1);
+  return_value_if_fail(ret == RET_OK, ret);
+
+  /*213 20231026082500*/
+  tk_strncpy(mtime, buf, mtime_size - 1);
+  tk_replace_char(mtime, '\r', '\0');
+  tk_replace_char(mtime, '\n', '\0');
+
+  return mtime[0] != '\0' ? RET_OK : RET_FAIL;
+}
+
+/*缓存文件的键(主机、端口和远程文件的绝对路径)的最大长度。*/
+#define FTP_CACHE_KEY_MAX_SIZE (MAX_PATH + 128)
+
+typedef struct _ftp_cache_meta_t {
+  uint64_t size;
+  uint64_t last_used;
+  char mtime[32];
+  char name[MAX_PATH + 1];
+  /*缓存文件名是键的SHA-256，保存原始的键用于确认缓存文件确实属于这个远程文件。*/
+  char key[FTP_CACHE_KEY_MAX_SIZE];
+} ftp_cache_meta_t;
+
+static ret_t ftp_cache_meta_load(ftp_cache_meta_t* meta, const char* filename) {
+  int key_offset = 0;
+  uint32_t size = 0;
+  ret_t ret = RET_FAIL;
+  unsigned long long file_size = 0;
+  unsigned long long last_used = 0;
+  char* data = (char*)file_read(filename, &size);
+  return_value_if_fail(data != NULL, RET_NOT_FOUND);
+
+  memset(meta, 0x00, sizeof(*meta));
+  if (tk_sscanf(data, "%llu %llu %31s %n", &file_size, &last_used, meta->mtime, &key_offset) == 3) {
+    /*键中可能有空格，一直到行尾都是键。*/
+    meta->size = file_size;
+    meta->last_used = last_used;
+    if (key_offset > 0 && (uint32_t)key_offset < size) {
+      tk_strncpy(meta->key, data + key_offset, sizeof(meta->key) - 1);
+      meta->key[strcspn(meta->key, "\r\n")] = '\0';
+    }
+    ret = RET_OK;
+  }
+  TKMEM_FREE(data);
+
+  return ret;
+}
+
+static ret_t ftp_cache_meta_save(ftp_cache_meta_t* meta, const char* filename) {
+  char data[FTP_CACHE_KEY_MAX_SIZE + 128] = {0};
+
+  tk_snprintf(data, sizeof(data), "%llu %llu %s %s\n", (unsigned long long)(meta->size),
+              (unsigned long long)(meta->last_used), meta->mtime, meta->key);
+
+  return file_write(filename, data, strlen(data));
+}
+
+/*
+ * 缓存文件名取键的SHA-256，不同的路径不会因为替换分隔符或者截断而对应同一个文件。
+ * key不为NULL时返回原始的键(FTP_CACHE_KEY_MAX_SIZE字节)，保存在meta文件中用于校验。
+ */
+static ret_t ftp_fs_cache_get_path(ftp_fs_t* ftp_fs, const char* name, char* path,
+                                   uint32_t path_size, char* key) {
+  uint32_t i = 0;
+  tk_sha256_t sha256;
+  char abs_name[MAX_PATH + 1] = {0};
+  char full_key[FTP_CACHE_KEY_MAX_SIZE] = {0};
+  char filename[TK_SHA256_HASH_LEN * 2 + 1] = {0};
+  uint8_t digest[TK_SHA256_HASH_LEN + 1] = {0};
+
+  ftp_fs_abs_path(ftp_fs, name, abs_name, sizeof(abs_name));
+  tk_snprintf(full_key, sizeof(full_key), "%s:%u%s", ftp_fs->host, ftp_fs->port, abs_name);
+
+  tk_sha256_init(&sha256);
+  tk_sha256_hash(&sha256, (const uint8_t*)full_key, strlen(full_key));
+  tk_sha256_done(&sha256, digest);
+  for (i = 0; i < TK_SHA256_HASH_LEN; i++) {
+    tk_snprintf(filename + i * 2, 3, "%02x", digest[i]);
+  }
+
+  if (key != NULL) {
+    tk_strncpy(key, full_key, FTP_CACHE_KEY_MAX_SIZE - 1);
+  }
+
+  return path_build(path, path_size, ftp_fs->cache_dir, filename, NULL);
+}
+
+static int ftp_cache_meta_compare_by_time(const void* a, const void* b) {
+  const ftp_cache_meta_t* ma = (const ftp_cache_meta_t*)a;
+  const ftp_cache_meta_t* mb = (const ftp_cache_meta_t*)b;
+
+  if (ma->last_used == mb->last_used) {
+    return 0;
+  }
+
+  return ma->last_used < mb->last_used ? -1 : 1;
+}
+
+/*超过容量时，按最后使用时间删除最久没用的文件，刚放入缓存的文件(keep)除外。调用者需要持有cache_mutex。*/
+static ret_t ftp_fs_cache_evict(ftp_fs_t* ftp_fs, const char* keep) {
+  fs_item_t item;
+  darray_t metas;
+  uint32_t i = 0;
+  uint64_t total = 0;
+  fs_dir_t* dir = fs_open_dir(os_fs(), ftp_fs->cache_dir);
+  return_value_if_fail(dir != NULL, RET_FAIL);
+
+  darray_init(&metas, 16, default_destroy, NULL);
+  while (fs_dir_read(dir, &item) == RET_OK) {
+    ftp_cache_meta_t* meta = NULL;
+    char filename[MAX_PATH + 1] = {0};
+
+    if (!item.is_reg_file || !tk_str_end_with(item.name, ".meta")) {
+      continue;
+    }
+
+    meta = TKMEM_ZALLOC(ftp_cache_meta_t);
+    break_if_fail(meta != NULL);
+
+    path_build(filename, sizeof(filename), ftp_fs->cache_dir, item.name, NULL);
+    if (ftp_cache_meta_load(meta, filename) == RET_OK) {
+      total += meta->size;
+      if (!tk_str_eq(filename, keep)) {
+        tk_strncpy(meta->name, item.name, sizeof(meta->name) - 1);
+        darray_push(&metas, meta);
+        continue;
+      }
+    }
+    TKMEM_FREE(meta);
+  }
+  fs_dir_close(dir);
+
+  if (total > ftp_fs->cache_max_size) {
+    darray_sort(&metas, ftp_cache_meta_compare_by_time);
+    for (i = 0; i < metas.size && total > ftp_fs->cache_max_size; i++) {
+      char filename[MAX_PATH + 1] = {0};
+      ftp_cache_meta_t* meta = (ftp_cache_meta_t*)darray_get(&metas, i);
+
+      path_build(filename, sizeof(filename), ftp_fs->cache_dir, meta->name, NULL);
+      fs_remove_file(os_fs(), filename);
+      filename[strlen(filename) - strlen(".meta")] = '\0';
+      fs_remove_file(os_fs(), filename);
+      total -= meta->size;
+    }
+  }
+  darray_deinit(&metas);
+
+  return RET_OK;
+}
+
+static ret_t ftp_fs_cache_remove(ftp_fs_t* ftp_fs, const char* name) {
+  char path[MAX_PATH + 1] = {0};
+  char meta_path[MAX_PATH + 1] = {0};
+  return_value_if_fail(ftp_fs->cache_max_size > 0, RET_OK);
+
+  ftp_fs_cache_get_path(ftp_fs, name, path, sizeof(path), NULL);
+  tk_snprintf(meta_path, sizeof(meta_path), "%s.meta", path);
+
+  tk_mutex_lock(ftp_fs->cache_mutex);
+  if (file_exist(meta_path)) {
+    fs_remove_file(os_fs(), meta_path);
+  }
+  if (file_exist(path)) {
+    fs_remove_file(os_fs(), path);
+  }
+  tk_mutex_unlock(ftp_fs->cache_mutex);
+
+  return RET_OK;
+}
+
+/*缓存的文件是否和远程文件一致，调用者需要持有cache_mutex。*/
+static bool_t ftp_fs_cache_is_valid(const ftp_cache_meta_t* remote, const char* path,
+                                    const char* meta_path) {
+  fs_stat_info_t st;
+  ftp_cache_meta_t meta;
+
+  return ftp_cache_meta_load(&meta, meta_path) == RET_OK && tk_str_eq(meta.key, remote->key) &&
+         meta.size == remote->size && tk_str_eq(meta.mtime, remote->mtime) &&
+         fs_stat(os_fs(), path, &st) == RET_OK && st.size == remote->size;
+}
+
+/*
+ * 用SIZE和MDTM检查缓存是否有效，无效时重新下载到缓存中。
+ * 每次下载用自己的临时文件，检查和替换缓存文件都在cache_mutex中进行，多个线程可以同时取同一个文件。
+ */
+static ret_t ftp_fs_cache_fetch(ftp_fs_t* ftp_fs, const char* name, char* path,
+                                uint32_t path_size) {
+  ftp_cache_meta_t remote;
+  ret_t ret = RET_OK;
+  bool_t valid = FALSE;
+  uint64_t size = 0;
+  ftp_session_t* s = NULL;
+  char meta_path[MAX_PATH + 1] = {0};
+  char part_path[MAX_PATH + 1] = {0};
+
+  memset(&remote, 0x00, sizeof(remote));
+  ftp_fs_cache_get_path(ftp_fs, name, path, path_size, remote.key);
+  tk_snprintf(meta_path, sizeof(meta_path), "%s.meta", path);
+  tk_snprintf(part_path, sizeof(part_path), "%s.%u.part", path, ftp_fs_next_temp_id(ftp_fs));
+
+  s = ftp_fs_checkout(ftp_fs);
+  return_value_if_fail(s != NULL, RET_IO);
+
+  ret = ftp_session_cmd_get_size(s, name, &size);
+  if (ret == RET_OK) {
+    ret = ftp_session_cmd_get_mtime(s, name, remote.mtime, sizeof(remote.mtime));
+  }
+
+  if (ret != RET_OK) {
+    /*无法判断文件是否变化，不使用缓存。*/
+    ftp_fs_checkin(ftp_fs, s);
+    return RET_NOT_IMPL;
+  }
+  remote.size = size;
+  remote.last_used = time_now_ms();
+
+  tk_mutex_lock(ftp_fs->cache_mutex);
+  valid = ftp_fs_cache_is_valid(&remote, path, meta_path);
+  if (valid) {
+    ftp_cache_meta_save(&remote, meta_path);
+  }
+  tk_mutex_unlock(ftp_fs->cache_mutex);
+
+  if (valid) {
+    ftp_fs_checkin(ftp_fs, s);
+    return RET_OK;
+  }
+
+  /*先下载到临时文件，完成后再替换，避免其它线程读到不完整的文件。*/
+  ret = ftp_session_cmd_download_file(s, name, part_path);
+  ftp_fs_checkin(ftp_fs, s);
+
+  if (ret == RET_OK) {
+    tk_mutex_lock(ftp_fs->cache_mutex);
+    /*其它线程可能已经放入了同样的内容，不用再替换。*/
+    if (!ftp_fs_cache_is_valid(&remote, path, meta_path)) {
+      fs_remove_file(os_fs(), meta_path);
+      if (file_exist(path)) {
+        fs_remove_file(os_fs(), path);
+      }
+      ret = fs_file_rename(os_fs(), part_path, path);
+    }
+    if (ret == RET_OK) {
+      ftp_cache_meta_save(&remote, meta_path);
+      ftp_fs_cache_evict(ftp_fs, meta_path);
+    }
+    tk_mutex_unlock(ftp_fs->cache_mutex);
+  }
+
+  if (file_exist(part_path)) {
+    fs_remove_file(os_fs(), part_path);
+  }
+
+  return ret;
+}
+
+static int32_t fs_ftp_file_read(fs_file_t* file, void* buffer, uint32_t size) {
+  fs_ftp_file_t* ftp_file = (fs_ftp_file_t*)file;
+  return_value_if_fail(ftp_file != NULL, RET_BAD_PARAMS);
+
+  return fs_file_read(ftp_file->temp_file, buffer, size);
+}
+
+/*把[start, end)加入修改过的区间，和重叠或者相邻的区间合并。*/
+static ret_t fs_ftp_file_add_range(fs_ftp_file_t* ftp_file, uint64_t start, uint64_t end) {
+  int32_t i = 0;
+  ftp_range_t* range = NULL;
+
+  for (i = (int32_t)(ftp_file->dirty.size) - 1; i >= 0; i--) {
+    ftp_range_t* iter = (ftp_range_t*)darray_get(&ftp_file->dirty, i);
+    if (iter->start <= end && start <= iter->end) {
+      start = tk_min(start, iter->start);
+      end = tk_max(end, iter->end);
+      darray_remove_index(&ftp_file->dirty, i);
+    }
+  }
+
+  if (ftp_file->dirty.size >= FTP_FS_MAX_DIRTY_RANGES) {
+    ftp_file->full_upload = TRUE;
+    darray_clear(&ftp_file->dirty);
+    return RET_OK;
+  }
+
+  range = TKMEM_ZALLOC(ftp_range_t);
+  if (range == NULL) {
+    ftp_file->full_upload = TRUE;
+    return RET_OOM;
+  }
+  range->start = start;
+  range->end = end;
+
+  for (i = 0; i < (int32_t)(ftp_file->dirty.size); i++) {
+    ftp_range_t* iter = (ftp_range_t*)darray_get(&ftp_file->dirty, i);
+    if (iter->start > start) {
+      break;
+    }
+  }
+
+  if (darray_insert(&ftp_file->dirty, i, range) != RET_OK) {
+    TKMEM_FREE(range);
+    ftp_file->full_upload = TRUE;
+  }
+
+  return RET_OK;
+}
+
+static ret_t fs_ftp_file_mark_dirty(fs_ftp_file_t* ftp_file, int64_t offset, uint32_t size) {
+  uint64_t start = 0;
+  uint64_t end = 0;
+
+  if (ftp_file->append) {
+    /*追加方式总是写到文件末尾。*/
+    offset = fs_file_size(ftp_file->temp_file);
+  }
+
+  offset = tk_max(offset, 0);
+  if (size > 0) {
+    ftp_file->dirty_start = tk_min(ftp_file->dirty_start, (uint64_t)offset);
+  }
+  start = (uint64_t)offset / FTP_FS_BLOCK_SIZE * FTP_FS_BLOCK_SIZE;
+  end = ((uint64_t)offset + size + FTP_FS_BLOCK_SIZE - 1) / FTP_FS_BLOCK_SIZE * FTP_FS_BLOCK_SIZE;
+  ftp_file->changed = TRUE;
+
+  if (!ftp_file->full_upload && size > 0) {
+    fs_ftp_file_add_range(ftp_file, start, end);
+  }
+
+  return RET_OK;
+}
+
+static int32_t fs_ftp_file_write(fs_file_t* file, const void* buffer, uint32_t size) {
+  fs_ftp_file_t* ftp_file = (fs_ftp_file_t*)file;
+  return_value_if_fail(ftp_file != NULL, RET_BAD_PARAMS);
+  fs_ftp_file_mark_dirty(ftp_file, fs_file_tell(ftp_file->temp_file), size);
+
+  return fs_file_write(ftp_file->temp_file, buffer, size);
+}
+
+static int32_t fs_ftp_file_printf(fs_file_t* file, const char* const format_str, va_list vl) {
+  fs_ftp_file_t* ftp_file = (fs_ftp_file_t*)file;
+  return_value_if_fail(ftp_file != NULL, RET_BAD_PARAMS);
+
+  if (ftp_file->temp_file != NULL && ftp_file->temp_file->vt != NULL &&
+      ftp_file->temp_file->vt->printf != NULL) {
+    int64_t offset = fs_file_tell(ftp_file->temp_file);
+    int32_t ret = ftp_file->temp_file->vt->printf(ftp_file->temp_file, format_str, vl);
+    fs_ftp_file_mark_dirty(ftp_file, offset, tk_max(ret, 0));
+    return ret;
+  }
+
+  return RET_FAIL;
+}
+
+static ret_t fs_ftp_file_seek(fs_file_t* file, int32_t offset) {
+  fs_ftp_file_t* ftp_file = (fs_ftp_file_t*)file;
+  return_value_if_fail(ftp_file != NULL, RET_BAD_PARAMS);
+
+  return fs_file_seek(ftp_file->temp_file, offset);
+}
+
+static int64_t fs_ftp_file_tell(fs_file_t* file) {
+  fs_ftp_file_t* ftp_file = (fs_ftp_file_t*)file;
+  return_value_if_fail(ftp_file != NULL, 0);
+
+  return fs_file_tell(ftp_file->temp_file);
+}
+
+static int64_t fs_ftp_file_size(fs_file_t* file) {
+  fs_ftp_file_t* ftp_file = (fs_ftp_file_t*)file;
+  return_value_if_fail(ftp_file != NULL, 0);
+
+  return fs_file_size(ftp_file->temp_file);
+}
+
+static ret_t fs_ftp_file_stat(fs_file_t* file, fs_stat_info_t* fst) {
+  fs_ftp_file_t* ftp_file = (fs_ftp_file_t*)file;
+  return_value_if_fail(ftp_file != NULL, RET_BAD_PARAMS);
+
+  return fs_file_stat(ftp_file->temp_file, fst);
+}
+
+/*
+ * 没有修改时不上传；只在原文件末尾追加了数据时，只上传追加的部分；
+ * 服务器支持REST STREAM时，只上传修改过的块；否则上传整个文件。
+ */
+static ret_t fs_ftp_file_upload(fs_ftp_file_t* ftp_file) {
+  ret_t ret = RET_OK;
+  int64_t size = 0;
+  uint64_t low = 0;
+  ftp_range_t* first = NULL;
+  ftp_fs_t* ftp_fs = ftp_file->ftp_fs;
+
+  if (!ftp_file->changed) {
+    return RET_OK;
+  }
+
+  fs_file_sync(ftp_file->temp_file);
+  size = fs_file_size(ftp_file->temp_file);
+  return_value_if_fail(size >= 0, RET_FAIL);
+
+  if (!ftp_file->existed || ftp_file->full_upload || (uint64_t)size < ftp_file->remote_size) {
+    ret = RET_NOT_IMPL;
+  } else {
+    low = ftp_file->dirty_start;
+    if ((uint64_t)size > ftp_file->remote_size) {
+      fs_ftp_file_add_range(ftp_file, ftp_file->remote_size, (uint64_t)size);
+      low = tk_min(low, ftp_file->remote_size);
+    }
+
+    /*区间按块对齐后起点总是不大于remote_size，是否只追加了数据要看实际写入的位置。*/
+    first = (ftp_range_t*)darray_head(&ftp_file->dirty);
+    if (first == NULL || low >= (uint64_t)size) {
+      ret = RET_OK;
+    } else if (low >= ftp_file->remote_size) {
+      ret = ftp_fs_cmd_upload_tail(ftp_fs, ftp_file->temp_path, ftp_file->name,
+                                   ftp_file->remote_size);
+    } else {
+      ret = ftp_fs_cmd_upload_ranges(ftp_fs, ftp_file->temp_path, ftp_file->name,
+                                     &ftp_file->dirty, (uint64_t)size);
+    }
+  }
+
+  /*部分上传失败(连接错误除外)时，上传整个文件。*/
+  if (ret != RET_OK && ret != RET_IO) {
+    ret = ftp_fs_cmd_upload_file(ftp_fs, ftp_file->temp_path, ftp_file->name);
+  }
+
+  if (ret == RET_OK) {
+    ftp_file->changed = FALSE;
+    ftp_file->full_upload = FALSE;
+    ftp_file->existed = TRUE;
+    ftp_file->remote_size = (uint64_t)size;
+    ftp_file->dirty_start = UINT64_MAX;
+    darray_clear(&ftp_file->dirty);
+    ftp_fs_cache_remove(ftp_fs, ftp_file->name);
+  }
+
+  return ret;
+}
+
+static ret_t fs_ftp_file_sync(fs_file_t* file) {
+  fs_ftp_file_t* ftp_file = (fs_ftp_file_t*)file;
+  return_value_if_fail(ftp_file != NULL, RET_BAD_PARAMS);
+
+  return fs_ftp_file_upload(ftp_file);
+}
+
+static ret_t fs_ftp_file_truncate(fs_file_t* file, int32_t size) {
+  fs_ftp_file_t* ftp_file = (fs_ftp_file_t*)file;
+  return_value_if_fail(ftp_file != NULL, RET_BAD_PARAMS);
+
+  if ((uint64_t)tk_max(size, 0) < ftp_file->remote_size) {
+    ftp_file->full_upload = TRUE;
+  }
+  fs_ftp_file_mark_dirty(ftp_file, size, 0);
+  return fs_file_truncate(ftp_file->temp_file, size);
+}
+
+static bool_t fs_ftp_file_eof(fs_file_t* file) {
+  fs_ftp_file_t* ftp_file = (fs_ftp_file_t*)file;
+  return_value_if_fail(ftp_file != NULL, TRUE);
+
+  return fs_file_eof(ftp_file->temp_file);
+}
+
+static ret_t fs_ftp_file_close(fs_file_t* file) {
+  ret_t ret = RET_OK;
+  fs_ftp_file_t* ftp_file = (fs_ftp_file_t*)file;
+  return_value_if_fail(ftp_file != NULL, RET_BAD_PARAMS);
+
+  if (ftp_file->temp_file != NULL) {
+    if (!ftp_file->cached) {
+      ret = fs_ftp_file_upload(ftp_file);
+    }
+    fs_file_close(ftp_file->temp_file);
+    ftp_file->temp_file = NULL;
+  }
+
+  if (ftp_file->cached) {
+    /*缓存中的文件以只读方式打开，保留下来供下次使用。*/
+  } else if (file_exist(ftp_file->temp_path)) {
+    fs_remove_file(os_fs(), ftp_file->temp_path);
+  }
+
+  darray_deinit(&ftp_file->dirty);
+  TKMEM_FREE(ftp_file);
+
+  return ret;
+}
+
+static const fs_file_vtable_t s_file_vtable = {.read = fs_ftp_file_read,
+                                               .write = fs_ftp_file_write,
+                                               .printf = fs_ftp_file_printf,
+                                               .seek = fs_ftp_file_seek,
+                                               .tell = fs_ftp_file_tell,
+                                               .size = fs_ftp_file_size,
+                                               .stat = fs_ftp_file_stat,
+                                               .sync = fs_ftp_file_sync,
+                                               .truncate = fs_ftp_file_truncate,
+                                               .eof = fs_ftp_file_eof,
+                                               .close = fs_ftp_file_close};
+
+typedef struct _ftp_block_t {
+  int64_t index;
+  uint32_t len;
+  uint32_t last_used;
+  uint8_t* data;
+} ftp_block_t;
+
+/*只读模式下按块读取远程文件，只取回用到的块。*/
+typedef struct _fs_ftp_block_file_t {
+  fs_file_t file;
+  ftp_fs_t* ftp_fs;
+  char name[MAX_PATH + 1];
+  uint64_t size;
+  uint64_t pos;
+  int64_t last_block;
+  uint32_t readahead;
+  uint32_t tick;
+  ftp_block_t blocks[FTP_FS_CACHED_BLOCKS];
+} fs_ftp_block_file_t;
+
+static ftp_block_t* fs_ftp_block_file_find(fs_ftp_block_file_t* ftp_file, int64_t index) {
+  uint32_t i = 0;
+
+  for (i = 0; i < ARRAY_SIZE(ftp_file->blocks); i++) {
+    ftp_block_t* iter = ftp_file->blocks + i;
+    if (iter->data != NULL && iter->index == index) {
+      iter->last_used = ++ftp_file->tick;
+      return iter;
+    }
+  }
+
+  return NULL;
+}
+
+static ftp_block_t* fs_ftp_block_file_alloc(fs_ftp_block_file_t* ftp_file) {
+  uint32_t i = 0;
+  ftp_block_t* block = ftp_file->blocks;
+
+  for (i = 1; i < ARRAY_SIZE(ftp_file->blocks); i++) {
+    ftp_block_t* iter = ftp_file->blocks + i;
+    if (iter->last_used < block->last_used) {
+      block = iter;
+    }
+  }
+
+  if (block->data == NULL) {
+    block->data = (uint8_t*)TKMEM_ALLOC(FTP_FS_BLOCK_SIZE);
+    return_value_if_fail(block->data != NULL, NULL);
+  }
+  block->index = -1;
+  block->len = 0;
+
+  return block;
+}
+
+static ret_t fs_ftp_block_file_fetch(fs_ftp_block_file_t* ftp_file, int64_t index) {
+  uint32_t i = 0;
+  uint32_t nr = 1;
+  ret_t ret = RET_OK;
+  ftp_session_t* s = NULL;
+  uint64_t offset = index * FTP_FS_BLOCK_SIZE;
+  uint64_t blocks = (ftp_file->size + FTP_FS_BLOCK_SIZE - 1) / FTP_FS_BLOCK_SIZE;
+
+  /*顺序读取时预读的块数逐步加倍，随机读取时只取一块。*/
+  if (index == ftp_file->last_block + 1) {
+    ftp_file->readahead = tk_min(ftp_file->readahead * 2, FTP_FS_CACHED_BLOCKS / 2);
+  } else {
+    ftp_file->readahead = 1;
+  }
+  nr = tk_min(tk_max(ftp_file->readahead, 1), blocks - index);
+
+  s = ftp_fs_checkout(ftp_file->ftp_fs);
+  return_value_if_fail(s != NULL, RET_IO);
+
+  ret = ftp_session_retr_begin(s, ftp_file->name, offset);
+  if (ret == RET_OK) {
+    for (i = 0; i < nr; i++) {
+      uint64_t start = (index + i) * FTP_FS_BLOCK_SIZE;
+      uint32_t len = tk_min(FTP_FS_BLOCK_SIZE, ftp_file->size - start);
+      ftp_block_t* block = fs_ftp_block_file_alloc(ftp_file);
+
+      ret = block != NULL ? ftp_session_recv_to_buffer(s, block->data, len) : RET_OOM;
+      break_if_fail(ret == RET_OK);
+
+      block->index = index + i;
+      block->len = len;
+      block->last_used = ++ftp_file->tick;
+    }
+    ftp_session_retr_end(s, ret != RET_OK || (uint64_t)(index + nr) < blocks);
+  }
+  ftp_fs_checkin(ftp_file->ftp_fs, s);
+
+  ftp_file->last_block = index + nr - 1;
+
+  return ret;
+}
+
+static int32_t fs_ftp_block_file_read(fs_file_t* file, void* buffer, uint32_t size) {
+  uint32_t done = 0;
+  fs_ftp_block_file_t* ftp_file = (fs_ftp_block_file_t*)file;
+  return_value_if_fail(ftp_file != NULL && buffer != NULL, -1);
+
+  while (done < size && ftp_file->pos < ftp_file->size) {
+    uint32_t offset = 0;
+    uint32_t len = 0;
+    int64_t index = ftp_file->pos / FTP_FS_BLOCK_SIZE;
+    ftp_block_t* block = fs_ftp_block_file_find(ftp_file, index);
+
+    if (block == NULL) {
+      break_if_fail(fs_ftp_block_file_fetch(ftp_file, index) == RET_OK);
+      block = fs_ftp_block_file_find(ftp_file, index);
+      break_if_fail(block != NULL);
+    }
+
+    offset = ftp_file->pos - index * FTP_FS_BLOCK_SIZE;
+    break_if_fail(offset < block->len);
+    len = tk_min(block->len - offset, size - done);
+
+    memcpy((uint8_t*)buffer + done, block->data + offset, len);
+    ftp_file->pos += len;
+    done += len;
+  }
+
+  return done;
+}
+
+static int32_t fs_ftp_block_file_write(fs_file_t* file, const void* buffer, uint32_t size) {
+  return -1;
+}
+
+static int32_t fs_ftp_block_file_printf(fs_file_t* file, const char* const format_str,
+                                        va_list vl) {
+  return -1;
+}
+
+static ret_t fs_ftp_block_file_seek(fs_file_t* file, int32_t offset) {
+  fs_ftp_block_file_t* ftp_file = (fs_ftp_block_file_t*)file;
+  return_value_if_fail(ftp_file != NULL && offset >= 0, RET_BAD_PARAMS);
+  return_value_if_fail((uint64_t)offset <= ftp_file->size, RET_BAD_PARAMS);
+
+  ftp_file->pos = offset;
+
+  return RET_OK;
+}
+
+static int64_t fs_ftp_block_file_tell(fs_file_t* file) {
+  fs_ftp_block_file_t* ftp_file = (fs_ftp_block_file_t*)file;
+  return_value_if_fail(ftp_file != NULL, 0);
+
+  return ftp_file->pos;
+}
+
+static int64_t fs_ftp_block_file_size(fs_file_t* file) {
+  fs_ftp_block_file_t* ftp_file = (fs_ftp_block_file_t*)file;
+  return_value_if_fail(ftp_file != NULL, 0);
+
+  return ftp_file->size;
+}
+
+static ret_t fs_ftp_block_file_stat(fs_file_t* file, fs_stat_info_t* fst) {
+  fs_ftp_block_file_t* ftp_file = (fs_ftp_block_file_t*)file;
+  return_value_if_fail(ftp_file != NULL && fst != NULL, RET_BAD_PARAMS);
+
+  memset(fst, 0x00, sizeof(*fst));
+  fst->size = ftp_file->size;
+  fst->is_reg_file = TRUE;
+
+  return RET_OK;
+}
+
+static ret_t fs_ftp_block_file_sync(fs_file_t* file) {
+  return RET_OK;
+}
+
+static ret_t fs_ftp_block_file_truncate(fs_file_t* file, int32_t size) {
+  return RET_NOT_IMPL;
+}
+
+static bool_t fs_ftp_block_file_eof(fs_file_t* file) {
+  fs_ftp_block_file_t* ftp_file = (fs_ftp_block_file_t*)file;
+  return_value_if_fail(ftp_file != NULL, TRUE);
+
+  return ftp_file->pos >= ftp_file->size;
+}
+
+static ret_t fs_ftp_block_file_close(fs_file_t* file) {
+  uint32_t i = 0;
+  fs_ftp_block_file_t* ftp_file = (fs_ftp_block_file_t*)file;
+  return_value_if_fail(ftp_file != NULL, RET_BAD_PARAMS);
+
+  for (i = 0; i < ARRAY_SIZE(ftp_file->blocks); i++) {
+    TKMEM_FREE(ftp_file->blocks[i].data);
+  }
+  TKMEM_FREE(ftp_file);
+
+  return RET_OK;
+}
+
+static const fs_file_vtable_t s_block_file_vtable = {.read = fs_ftp_block_file_read,
+                                                     .write = fs_ftp_block_file_write,
+                                                     .printf = fs_ftp_block_file_printf,
+                                                     .seek = fs_ftp_block_file_seek,
+                                                     .tell = fs_ftp_block_file_tell,
+                                                     .size = fs_ftp_block_file_size,
+                                                     .stat = fs_ftp_block_file_stat,
+                                                     .sync = fs_ftp_block_file_sync,
+                                                     .truncate = fs_ftp_block_file_truncate,
+                                                     .eof = fs_ftp_block_file_eof,
+                                                     .close = fs_ftp_block_file_close};
+
+static fs_file_t* fs_ftp_open_block_file(ftp_fs_t* ftp_fs, const char* name) {
+  ret_t ret = RET_OK;
+  uint64_t size = 0;
+  ftp_session_t* s = NULL;
+  fs_ftp_block_file_t* ftp_file = NULL;
+
+  s = ftp_fs_checkout(ftp_fs);
+  return_value_if_fail(s != NULL, NULL);
+  ret = ftp_session_cmd_get_size(s, name, &size);
+  ftp_fs_checkin(ftp_fs, s);
+  return_value_if_fail(ret == RET_OK, NULL);
+
+  ftp_file = TKMEM_ZALLOC(fs_ftp_block_file_t);
+  return_value_if_fail(ftp_file != NULL, NULL);
+
+  ftp_file->file.vt = &s_block_file_vtable;
+  ftp_file->ftp_fs = ftp_fs;
+  ftp_file->size = size;
+  ftp_file->last_block = -2;
+  tk_strncpy(ftp_file->name, name, sizeof(ftp_file->name) - 1);
+
+  return (fs_file_t*)ftp_file;
+}
+
+/*直接从RETR的数据连接读取的输入流，生命周期内独占一个控制连接。*/
+typedef struct _ftp_istream_t {
+  tk_istream_t istream;
+
+  ftp_fs_t* ftp_fs;
+  ftp_session_t* s;
+  char name[MAX_PATH + 1];
+  uint64_t offset;
+  bool_t opened;
+  bool_t eos;
+} ftp_istream_t;
+
+#define FTP_ISTREAM(obj) ((ftp_istream_t*)(obj))
+
+static ret_t ftp_istream_open(ftp_istream_t* ftp_istream) {
+  ret_t ret = ftp_session_retr_begin(ftp_istream->s, ftp_istream->name, ftp_istream->offset);
+  ftp_istream->opened = ret == RET_OK;
+
+  return ret;
+}
+
+static ret_t ftp_istream_close(ftp_istream_t* ftp_istream, bool_t aborted) {
+  ret_t ret = RET_OK;
 
-  if (ftp_fs->stat_cmd != NULL) {
-    tk_snprintf(cmd, sizeof(cmd), "%s %s\r\n", ftp_fs->stat_cmd, filename);
-    ret = ftp_fs_cmd(ftp_fs, cmd, NULL, buf, sizeof(buf) - 1);
-  } else {
-    tk_snprintf(cmd, sizeof(cmd), "XSTAT %s\r\n", filename);
-    ret = ftp_fs_cmd(ftp_fs, cmd, NULL, buf, sizeof(buf) - 1);
-    if (ret != RET_OK) {
-      if (ftp_fs->last_error_code == 500 || ftp_fs->last_error_code == 502) {
-        tk_snprintf(cmd, sizeof(cmd), "STAT %s\r\n", filename);
-        ret = ftp_fs_cmd(ftp_fs, cmd, NULL, buf, sizeof(buf) - 1);
-      } else {
-        return ret;
-      }
-    }
+  if (ftp_istream->opened) {
+    ftp_istream->opened = FALSE;
+    ret = ftp_session_retr_end(ftp_istream->s, aborted);
   }
 
-  p = strstr(buf, "\r\n");
-  if (p != NULL && p[2]) {
-    p += strlen("\r\n");
-    // p = 213-Status of \"/test.bin\":\r\n-rw-r--r--   1 jim      staff        1650 Oct 25 13:12 test.bin\r\n213 End of status.\r\n
-    tokenizer_init(&t, p, strlen(p), " ");
-    if (tokenizer_has_more(&t)) {
-      p = tokenizer_next(&t);  // -rw-r--r--
-      if (tk_strcmp(p, "213") == 0) {
-        fst->is_dir = TRUE;
-        //空目录可能没有内容，比如："/abc":\r\n213 End of status.\r\n
-      } else {
-        fst->is_reg_file = p[0] == '-';
-        fst->is_dir = p[0] == 'd';
-        p = tokenizer_next(&t);                   // 1
-        p = tokenizer_next(&t);                   // jim
-        p = tokenizer_next(&t);                   // staff
-        fst->size = tokenizer_next_int64(&t, 0);  // 1650
-        p = tokenizer_next(&t);                   // Oct
-        p = tokenizer_next(&t);                   // 25
-        p = tokenizer_next(&t);                   // 13:12
-      }
-    }
-    tokenizer_deinit(&t);
+  return ret;
+}
+
+static int32_t ftp_istream_read(tk_istream_t* stream, uint8_t* buff, uint32_t max_size) {
+  int32_t ret = 0;
+  ftp_istream_t* ftp_istream = FTP_ISTREAM(stream);
+  return_value_if_fail(ftp_istream != NULL && buff != NULL, -1);
+
+  if (ftp_istream->eos || max_size == 0) {
+    return 0;
+  }
+
+  if (!ftp_istream->opened && ftp_istream_open(ftp_istream) != RET_OK) {
+    return -1;
+  }
+
+  ret = tk_iostream_read(ftp_istream->s->data_ios, buff, max_size);
+  if (ret > 0) {
+    ftp_istream->offset += ret;
   } else {
-    tokenizer_init(&t, buf, strlen(buf), " ");
-    fst->size = tokenizer_next_int64(&t, 0);
-    fst->mtime = tokenizer_next_int64(&t, 0);
-    fst->ctime = tokenizer_next_int64(&t, 0);
-    fst->atime = tokenizer_next_int64(&t, 0);
-    fst->is_dir = tokenizer_next_int(&t, 0);
-    fst->is_link = tokenizer_next_int(&t, 0);
-    fst->is_reg_file = tokenizer_next_int(&t, 0);
-    fst->uid = tokenizer_next_int(&t, 0);
-    fst->gid = tokenizer_next_int(&t, 0);
-    tokenizer_deinit(&t);
+    ftp_istream->eos = TRUE;
+    ret = ftp_istream_close(ftp_istream, FALSE) == RET_OK ? 0 : -1;
+  }
+
+  return ret;
+}
+
+/*定位时关闭当前的数据连接，下次读取时用REST+RETR从新的位置开始。*/
+static ret_t ftp_istream_seek(tk_istream_t* stream, uint32_t offset) {
+  ftp_istream_t* ftp_istream = FTP_ISTREAM(stream);
+  return_value_if_fail(ftp_istream != NULL, RET_BAD_PARAMS);
+
+  if (offset != ftp_istream->offset || ftp_istream->eos) {
+    ftp_istream_close(ftp_istream, TRUE);
+    ftp_istream->offset = offset;
+    ftp_istream->eos = FALSE;
   }
 
   return RET_OK;
 }
 
-static ret_t ftp_fs_cmd_get_pwd(ftp_fs_t* ftp_fs, char* path, uint32_t path_size) {
-  char cmd[FTP_CMD_MAX_SIZE] = {0};
-  ret_t ret = RET_FAIL;
-  char buf[FTP_BUF_MAX_SIZE] = {0};
-  const char* p = NULL;
-  const char* pend = NULL;
-  return_value_if_fail(path != NULL && path_size > 0, RET_BAD_PARAMS);
+static int32_t ftp_istream_tell(tk_istream_t* stream) {
+  ftp_istream_t* ftp_istream = FTP_ISTREAM(stream);
+  return_value_if_fail(ftp_istream != NULL, -1);
 
-  tk_snprintf(cmd, sizeof(cmd), "PWD\r\n");
-  ret = ftp_fs_cmd(ftp_fs, cmd, NULL, buf, sizeof(buf) - 1);
-  return_value_if_fail(ret == RET_OK, ret);
+  return (int32_t)(ftp_istream->offset);
+}
 
-  p = strchr(buf, '"');
-  if (p != NULL) {
-    p += 1;
-    pend = strchr(p, '"');
-    if (pend != NULL) {
-      tk_strncpy(path, p, tk_min(pend - p, path_size));
-      return RET_OK;
-    }
-  }
+static bool_t ftp_istream_eos(tk_istream_t* stream) {
+  ftp_istream_t* ftp_istream = FTP_ISTREAM(stream);
+  return_value_if_fail(ftp_istream != NULL, TRUE);
 
-  return RET_FAIL;
+  return ftp_istream->eos;
 }
 
-typedef struct _fs_ftp_file_t {
-  fs_file_t file;
-  ftp_fs_t* ftp_fs;
-  char name[MAX_PATH + 1];
-  char temp_path[MAX_PATH + 1];
-  fs_file_t* temp_file;
-  bool_t changed;
-} fs_ftp_file_t;
+static ret_t ftp_istream_wait_for_data(tk_istream_t* stream, uint32_t timeout_ms) {
+  ftp_istream_t* ftp_istream = FTP_ISTREAM(stream);
+  return_value_if_fail(ftp_istream != NULL, RET_BAD_PARAMS);
 
-static ret_t ftp_fs_cmd_download_file(ftp_fs_t* ftp_fs, const char* remote_filename,
-                                      const char* local_filename) {
-  int ret = 0;
-  char cmd[FTP_CMD_MAX_SIZE] = {0};
-  char buf[FTP_BUF_MAX_SIZE] = {0};
-  char path[MAX_PATH + 1] = {0};
+  return ftp_istream->eos ? RET_EOS : RET_OK;
+}
 
-  fs_file_t* file = NULL;
-  return_value_if_fail(ftp_fs != NULL && remote_filename != NULL && local_filename != NULL,
-                       RET_BAD_PARAMS);
+static ret_t ftp_istream_on_destroy(tk_object_t* obj) {
+  ftp_istream_t* ftp_istream = FTP_ISTREAM(obj);
 
-  path_dirname(local_filename, path, sizeof(path)-1);
-  if (!dir_exist(path)) {
-    if (fs_create_dir_r(os_fs(), path) != RET_OK) {
-      log_warn("create %s failed\n", path);
-      return RET_FAIL;
-    }
+  if (ftp_istream->s != NULL) {
+    ftp_istream_close(ftp_istream, TRUE);
+    ftp_fs_checkin(ftp_istream->ftp_fs, ftp_istream->s);
+    ftp_istream->s = NULL;
   }
 
-  goto_error_if_fail(ftp_fs_pasv(ftp_fs) == RET_OK);
-  tk_snprintf(cmd, sizeof(cmd), "RETR %s\r\n", remote_filename);
+  return RET_OK;
+}
 
-  if (ftp_fs_cmd(ftp_fs, cmd, NULL, NULL, 0) == RET_OK) {
-    file = fs_open_file(os_fs(), local_filename, "wb+");
-    if (file != NULL) {
-      while ((ret = tk_iostream_read(ftp_fs->data_ios, buf, sizeof(buf) - 1)) > 0) {
-        break_if_fail(fs_file_write(file, buf, ret) == ret);
-      }
-      fs_file_close(file);
-    }
+static const object_vtable_t s_ftp_istream_vtable = {.type = "ftp_istream",
+                                                     .desc = "ftp_istream",
+                                                     .size = sizeof(ftp_istream_t),
+                                                     .on_destroy = ftp_istream_on_destroy};
 
-    TK_OBJECT_UNREF(ftp_fs->data_ios);
-    return ftp_fs_expect226(ftp_fs);
+tk_istream_t* ftp_fs_open_istream(fs_t* fs, const char* name, uint64_t offset) {
+  tk_object_t* obj = NULL;
+  ftp_istream_t* ftp_istream = NULL;
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL && name != NULL, NULL);
+
+  obj = tk_object_create(&s_ftp_istream_vtable);
+  ftp_istream = FTP_ISTREAM(obj);
+  return_value_if_fail(ftp_istream != NULL, NULL);
+
+  ftp_istream->ftp_fs = ftp_fs;
+  ftp_istream->offset = offset;
+  tk_strncpy(ftp_istream->name, name, sizeof(ftp_istream->name) - 1);
+  TK_ISTREAM(obj)->read = ftp_istream_read;
+  TK_ISTREAM(obj)->seek = ftp_istream_seek;
+  TK_ISTREAM(obj)->tell = ftp_istream_tell;
+  TK_ISTREAM(obj)->eos = ftp_istream_eos;
+  TK_ISTREAM(obj)->wait_for_data = ftp_istream_wait_for_data;
+
+  /*输入流一直占用连接，等待空闲连接可能永远等不到(比如同一个线程已经打开了一个流)，不能等待。*/
+  ftp_istream->s = ftp_fs_checkout_ex(ftp_fs, FALSE, NULL);
+  if (ftp_istream->s == NULL) {
+    log_warn("no free session to open %s for reading\n", name);
+    goto error;
   }
+  /*先打开数据连接，文件不存在或者不支持REST时立即返回失败。*/
+  goto_error_if_fail(ftp_istream_open(ftp_istream) == RET_OK);
 
-  return RET_NOT_FOUND;
+  return TK_ISTREAM(obj);
 error:
-  fs_file_close(file);
-  TK_OBJECT_UNREF(ftp_fs->data_ios);
+  TK_OBJECT_UNREF(obj);
 
-  return RET_OK;
+  return NULL;
 }
 
-ret_t ftp_fs_download_file(fs_t* fs, const char* remote_filename, const char* local_filename) {
-  ftp_fs_t* ftp_fs = FTP_FS(fs);
-  return_value_if_fail(ftp_fs != NULL, RET_BAD_PARAMS);
-  return_value_if_fail(remote_filename != NULL && local_filename != NULL, RET_BAD_PARAMS);
+/*写入的数据直接发送到STOR/APPE的数据连接，生命周期内独占一个控制连接。*/
+typedef struct _ftp_ostream_t {
+  tk_ostream_t ostream;
 
-  return ftp_fs_cmd_download_file(ftp_fs, remote_filename, local_filename);
-}
+  ftp_fs_t* ftp_fs;
+  ftp_session_t* s;
+  char name[MAX_PATH + 1];
+  uint64_t offset;
+  ret_t ret;
+} ftp_ostream_t;
 
-static ret_t ftp_fs_cmd_upload_file(ftp_fs_t* ftp_fs, const char* local_filename,
-                                    const char* remote_filename) {
-  int ret = 0;
-  char cmd[FTP_CMD_MAX_SIZE] = {0};
-  char buf[FTP_BUF_MAX_SIZE] = {0};
-  char path[MAX_PATH + 1] = {0};
+#define FTP_OSTREAM(obj) ((ftp_ostream_t*)(obj))
 
-  fs_file_t* file = NULL;
-  return_value_if_fail(ftp_fs != NULL && remote_filename != NULL && local_filename != NULL,
-                       RET_BAD_PARAMS);
+static int32_t ftp_ostream_write(tk_ostream_t* stream, const uint8_t* buff, uint32_t max_size) {
+  int32_t ret = 0;
+  ftp_ostream_t* ftp_ostream = FTP_OSTREAM(stream);
+  return_value_if_fail(ftp_ostream != NULL && buff != NULL, -1);
+  return_value_if_fail(ftp_ostream->s != NULL && ftp_ostream->ret == RET_OK, -1);
 
-  path_dirname(remote_filename, path, sizeof(path)-1);
-  if (!fs_dir_exist((fs_t*)ftp_fs, path)) {
-    if (fs_create_dir_r((fs_t*)ftp_fs, path) != RET_OK) {
-      log_warn("create %s failed\n", path);
-      return RET_FAIL;
-    }
+  ret = tk_iostream_write_len(ftp_ostream->s->data_ios, buff, max_size, 5000);
+  if (ret > 0) {
+    ftp_ostream->offset += ret;
   }
 
-  file = fs_open_file(os_fs(), local_filename, "rb");
-  return_value_if_fail(file != NULL, RET_FAIL);
+  if (ret != (int32_t)max_size) {
+    ftp_ostream->ret = RET_IO;
+  }
 
-  goto_error_if_fail(ftp_fs_pasv(ftp_fs) == RET_OK);
-  tk_snprintf(cmd, sizeof(cmd), "STOR %s\r\n", remote_filename);
-  goto_error_if_fail(ftp_fs_cmd(ftp_fs, cmd, NULL, NULL, 0) == RET_OK);
+  return ret;
+}
 
-  while ((ret = fs_file_read(file, buf, sizeof(buf) - 1)) > 0) {
-    break_if_fail(tk_iostream_write_len(ftp_fs->data_ios, buf, ret, 2000) == ret);
-  }
+/*数据是顺序发送的，只能"定位"到当前位置。*/
+static ret_t ftp_ostream_seek(tk_ostream_t* stream, uint32_t offset) {
+  ftp_ostream_t* ftp_ostream = FTP_OSTREAM(stream);
+  return_value_if_fail(ftp_ostream != NULL, RET_BAD_PARAMS);
 
-  fs_file_close(file);
-  TK_OBJECT_UNREF(ftp_fs->data_ios);
+  return offset == ftp_ostream->offset ? RET_OK : RET_NOT_IMPL;
+}
 
-  return ftp_fs_expect226(ftp_fs);
-error:
-  fs_file_close(file);
-  TK_OBJECT_UNREF(ftp_fs->data_ios);
+static int32_t ftp_ostream_tell(tk_ostream_t* stream) {
+  ftp_ostream_t* ftp_ostream = FTP_OSTREAM(stream);
+  return_value_if_fail(ftp_ostream != NULL, -1);
 
-  return RET_FAIL;
+  return (int32_t)(ftp_ostream->offset);
 }
 
-ret_t ftp_fs_upload_file(fs_t* fs, const char* local_filename, const char* remote_filename) {
-  ftp_fs_t* ftp_fs = FTP_FS(fs);
-  return_value_if_fail(ftp_fs != NULL, RET_BAD_PARAMS);
-  return_value_if_fail(remote_filename != NULL && local_filename != NULL, RET_BAD_PARAMS);
+static ret_t ftp_ostream_flush(tk_ostream_t* stream) {
+  ftp_ostream_t* ftp_ostream = FTP_OSTREAM(stream);
+  return_value_if_fail(ftp_ostream != NULL, RET_BAD_PARAMS);
 
-  return ftp_fs_cmd_upload_file(ftp_fs, local_filename, remote_filename);
+  return ftp_ostream->ret;
 }
 
-static int32_t fs_ftp_file_read(fs_file_t* file, void* buffer, uint32_t size) {
-  fs_ftp_file_t* ftp_file = (fs_ftp_file_t*)file;
-  return_value_if_fail(ftp_file != NULL, RET_BAD_PARAMS);
+ret_t ftp_fs_close_ostream(tk_ostream_t* stream) {
+  ret_t ret = RET_OK;
+  ftp_ostream_t* ftp_ostream = FTP_OSTREAM(stream);
+  return_value_if_fail(ftp_ostream != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(ftp_ostream->s != NULL, ftp_ostream->ret);
 
-  return fs_file_read(ftp_file->temp_file, buffer, size);
+  /*关闭数据连接表示文件结束，然后检查服务器的226回复。*/
+  ret = ftp_session_stor_end(ftp_ostream->s);
+  if (ftp_ostream->ret == RET_OK) {
+    ftp_ostream->ret = ret;
+  }
+
+  ftp_fs_checkin(ftp_ostream->ftp_fs, ftp_ostream->s);
+  ftp_ostream->s = NULL;
+  ftp_fs_stat_cache_invalidate(ftp_ostream->ftp_fs, ftp_ostream->name);
+  ftp_fs_cache_remove(ftp_ostream->ftp_fs, ftp_ostream->name);
+
+  return ftp_ostream->ret;
 }
 
-static int32_t fs_ftp_file_write(fs_file_t* file, const void* buffer, uint32_t size) {
-  fs_ftp_file_t* ftp_file = (fs_ftp_file_t*)file;
-  return_value_if_fail(ftp_file != NULL, RET_BAD_PARAMS);
-  ftp_file->changed = TRUE;
+static ret_t ftp_ostream_on_destroy(tk_object_t* obj) {
+  ftp_fs_close_ostream(TK_OSTREAM(obj));
 
-  return fs_file_write(ftp_file->temp_file, buffer, size);
+  return RET_OK;
 }
 
-static int32_t fs_ftp_file_printf(fs_file_t* file, const char* const format_str, va_list vl) {
-  fs_ftp_file_t* ftp_file = (fs_ftp_file_t*)file;
-  return_value_if_fail(ftp_file != NULL, RET_BAD_PARAMS);
+static const object_vtable_t s_ftp_ostream_vtable = {.type = "ftp_ostream",
+                                                     .desc = "ftp_ostream",
+                                                     .size = sizeof(ftp_ostream_t),
+                                                     .on_destroy = ftp_ostream_on_destroy};
 
-  if (ftp_file->temp_file != NULL && ftp_file->temp_file->vt != NULL &&
-      ftp_file->temp_file->vt->printf != NULL) {
-    ftp_file->changed = TRUE;
-    return ftp_file->temp_file->vt->printf(file, format_str, vl);
+tk_ostream_t* ftp_fs_open_ostream(fs_t* fs, const char* name, bool_t append) {
+  tk_object_t* obj = NULL;
+  ftp_ostream_t* ftp_ostream = NULL;
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL && name != NULL, NULL);
+
+  obj = tk_object_create(&s_ftp_ostream_vtable);
+  ftp_ostream = FTP_OSTREAM(obj);
+  return_value_if_fail(ftp_ostream != NULL, NULL);
+
+  ftp_ostream->ftp_fs = ftp_fs;
+  tk_strncpy(ftp_ostream->name, name, sizeof(ftp_ostream->name) - 1);
+  TK_OSTREAM(obj)->write = ftp_ostream_write;
+  TK_OSTREAM(obj)->seek = ftp_ostream_seek;
+  TK_OSTREAM(obj)->tell = ftp_ostream_tell;
+  TK_OSTREAM(obj)->flush = ftp_ostream_flush;
+
+  /*输出流一直占用连接，等待空闲连接可能永远等不到(比如同一个线程已经打开了一个流)，不能等待。*/
+  ftp_ostream->s = ftp_fs_checkout_ex(ftp_fs, FALSE, NULL);
+  if (ftp_ostream->s == NULL) {
+    log_warn("no free session to open %s for writing\n", name);
+    goto error;
   }
 
-  return RET_FAIL;
+  if (ftp_session_stor_begin(ftp_ostream->s, append ? "APPE" : "STOR", name, 0) != RET_OK) {
+    ftp_fs_checkin(ftp_fs, ftp_ostream->s);
+    ftp_ostream->s = NULL;
+    goto error;
+  }
+
+  return TK_OSTREAM(obj);
+error:
+  TK_OBJECT_UNREF(obj);
+
+  return NULL;
 }
 
-static ret_t fs_ftp_file_seek(fs_file_t* file, int32_t offset) {
-  fs_ftp_file_t* ftp_file = (fs_ftp_file_t*)file;
-  return_value_if_fail(ftp_file != NULL, RET_BAD_PARAMS);
+/*以流的方式写入的文件，只能顺序写。*/
+typedef struct _fs_ftp_stream_file_t {
+  fs_file_t file;
+  tk_ostream_t* ostream;
+} fs_ftp_stream_file_t;
 
-  return fs_file_seek(ftp_file->temp_file, offset);
+static int32_t fs_ftp_stream_file_read(fs_file_t* file, void* buffer, uint32_t size) {
+  return -1;
 }
 
-static int64_t fs_ftp_file_tell(fs_file_t* file) {
-  fs_ftp_file_t* ftp_file = (fs_ftp_file_t*)file;
-  return_value_if_fail(ftp_file != NULL, 0);
+static int32_t fs_ftp_stream_file_write(fs_file_t* file, const void* buffer, uint32_t size) {
+  fs_ftp_stream_file_t* ftp_file = (fs_ftp_stream_file_t*)file;
+  return_value_if_fail(ftp_file != NULL, -1);
 
-  return fs_file_tell(ftp_file->temp_file);
+  return tk_ostream_write(ftp_file->ostream, buffer, size);
 }
 
-static int64_t fs_ftp_file_size(fs_file_t* file) {
-  fs_ftp_file_t* ftp_file = (fs_ftp_file_t*)file;
-  return_value_if_fail(ftp_file != NULL, 0);
+static int32_t fs_ftp_stream_file_printf(fs_file_t* file, const char* const format_str,
+                                         va_list vl) {
+  va_list copy;
+  int32_t len = 0;
+  int32_t ret = 0;
+  char* data = NULL;
+  char buf[FTP_BUF_MAX_SIZE] = {0};
+  return_value_if_fail(file != NULL && format_str != NULL, -1);
+
+  va_copy(copy, vl);
+  len = tk_vsnprintf(buf, sizeof(buf), format_str, vl);
+  if (len < 0 || len < (int32_t)sizeof(buf)) {
+    va_end(copy);
+    return_value_if_fail(len >= 0, -1);
+    return fs_ftp_stream_file_write(file, buf, len);
+  }
 
-  return fs_file_size(ftp_file->temp_file);
+  /*放不下时按实际长度分配，不截断输出。*/
+  data = (char*)TKMEM_ALLOC(len + 1);
+  if (data == NULL) {
+    va_end(copy);
+    return -1;
+  }
+  tk_vsnprintf(data, len + 1, format_str, copy);
+  va_end(copy);
+
+  ret = fs_ftp_stream_file_write(file, data, len);
+  TKMEM_FREE(data);
+
+  return ret;
 }
 
-static ret_t fs_ftp_file_stat(fs_file_t* file, fs_stat_info_t* fst) {
-  fs_ftp_file_t* ftp_file = (fs_ftp_file_t*)file;
+static ret_t fs_ftp_stream_file_seek(fs_file_t* file, int32_t offset) {
+  fs_ftp_stream_file_t* ftp_file = (fs_ftp_stream_file_t*)file;
   return_value_if_fail(ftp_file != NULL, RET_BAD_PARAMS);
 
-  return fs_file_stat(ftp_file->temp_file, fst);
+  return tk_ostream_seek(ftp_file->ostream, offset);
 }
 
-static ret_t fs_ftp_file_sync(fs_file_t* file) {
-  fs_ftp_file_t* ftp_file = (fs_ftp_file_t*)file;
-  return_value_if_fail(ftp_file != NULL, RET_BAD_PARAMS);
+static int64_t fs_ftp_stream_file_tell(fs_file_t* file) {
+  fs_ftp_stream_file_t* ftp_file = (fs_ftp_stream_file_t*)file;
+  return_value_if_fail(ftp_file != NULL, 0);
 
-  if (ftp_file->changed) {
-    return ftp_fs_cmd_upload_file(ftp_file->ftp_fs, ftp_file->temp_path, ftp_file->name);
-  }
+  return tk_ostream_tell(ftp_file->ostream);
+}
+
+static ret_t fs_ftp_stream_file_stat(fs_file_t* file, fs_stat_info_t* fst) {
+  return_value_if_fail(file != NULL && fst != NULL, RET_BAD_PARAMS);
+
+  memset(fst, 0x00, sizeof(*fst));
+  fst->size = fs_ftp_stream_file_tell(file);
+  fst->is_reg_file = TRUE;
 
   return RET_OK;
 }
 
-static ret_t fs_ftp_file_truncate(fs_file_t* file, int32_t size) {
-  fs_ftp_file_t* ftp_file = (fs_ftp_file_t*)file;
+static ret_t fs_ftp_stream_file_sync(fs_file_t* file) {
+  fs_ftp_stream_file_t* ftp_file = (fs_ftp_stream_file_t*)file;
   return_value_if_fail(ftp_file != NULL, RET_BAD_PARAMS);
 
-  ftp_file->changed = TRUE;
-  return fs_file_truncate(ftp_file->temp_file, size);
+  return tk_ostream_flush(ftp_file->ostream);
 }
 
-static bool_t fs_ftp_file_eof(fs_file_t* file) {
-  fs_ftp_file_t* ftp_file = (fs_ftp_file_t*)file;
-  return_value_if_fail(ftp_file != NULL, TRUE);
+static ret_t fs_ftp_stream_file_truncate(fs_file_t* file, int32_t size) {
+  return RET_NOT_IMPL;
+}
 
-  return fs_file_eof(ftp_file->temp_file);
+static bool_t fs_ftp_stream_file_eof(fs_file_t* file) {
+  return TRUE;
 }
 
-static ret_t fs_ftp_file_close(fs_file_t* file) {
-  fs_ftp_file_t* ftp_file = (fs_ftp_file_t*)file;
+static ret_t fs_ftp_stream_file_close(fs_file_t* file) {
+  ret_t ret = RET_OK;
+  fs_ftp_stream_file_t* ftp_file = (fs_ftp_stream_file_t*)file;
   return_value_if_fail(ftp_file != NULL, RET_BAD_PARAMS);
-  if (ftp_file->temp_file != NULL) {
-    fs_file_sync(ftp_file->temp_file);
-    fs_file_close(ftp_file->temp_file);
-    ftp_file->temp_file = NULL;
-  }
 
-  if (file_exist(ftp_file->temp_path)) {
-    ftp_fs_cmd_upload_file(ftp_file->ftp_fs, ftp_file->temp_path, ftp_file->name);
-    fs_remove_file(os_fs(), ftp_file->temp_path);
+  ret = ftp_fs_close_ostream(ftp_file->ostream);
+  TK_OBJECT_UNREF(ftp_file->ostream);
+  TKMEM_FREE(ftp_file);
+
+  return ret;
+}
+
+static const fs_file_vtable_t s_stream_file_vtable = {.read = fs_ftp_stream_file_read,
+                                                      .write = fs_ftp_stream_file_write,
+                                                      .printf = fs_ftp_stream_file_printf,
+                                                      .seek = fs_ftp_stream_file_seek,
+                                                      .tell = fs_ftp_stream_file_tell,
+                                                      .size = fs_ftp_stream_file_tell,
+                                                      .stat = fs_ftp_stream_file_stat,
+                                                      .sync = fs_ftp_stream_file_sync,
+                                                      .truncate = fs_ftp_stream_file_truncate,
+                                                      .eof = fs_ftp_stream_file_eof,
+                                                      .close = fs_ftp_stream_file_close};
+
+static fs_file_t* fs_ftp_open_stream_file(ftp_fs_t* ftp_fs, const char* name, bool_t append) {
+  fs_ftp_stream_file_t* ftp_file = TKMEM_ZALLOC(fs_ftp_stream_file_t);
+  return_value_if_fail(ftp_file != NULL, NULL);
+
+  ftp_file->ostream = ftp_fs_open_ostream(&(ftp_fs->fs), name, append);
+  if (ftp_file->ostream == NULL) {
+    TKMEM_FREE(ftp_file);
+    return NULL;
   }
+  ftp_file->file.vt = &s_stream_file_vtable;
 
-  TKMEM_FREE(ftp_file);
+  return (fs_file_t*)ftp_file;
+}
 
-  return RET_OK;
+static bool_t fs_ftp_is_read_only_mode(const char* mode) {
+  return strchr(mode, 'w') == NULL && strchr(mode, 'a') == NULL && strchr(mode, '+') == NULL;
 }
 
-static const fs_file_vtable_t s_file_vtable = {.read = fs_ftp_file_read,
-                                               .write = fs_ftp_file_write,
-                                               .printf = fs_ftp_file_printf,
-                                               .seek = fs_ftp_file_seek,
-                                               .tell = fs_ftp_file_tell,
-                                               .size = fs_ftp_file_size,
-                                               .stat = fs_ftp_file_stat,
-                                               .sync = fs_ftp_file_sync,
-                                               .truncate = fs_ftp_file_truncate,
-                                               .eof = fs_ftp_file_eof,
-                                               .close = fs_ftp_file_close};
+/*"w"/"wb"/"a"/"ab"：只写，不需要原来的内容(或者只在末尾追加)。*/
+static bool_t fs_ftp_is_write_only_mode(const char* mode) {
+  return (strchr(mode, 'w') != NULL || strchr(mode, 'a') != NULL) && strchr(mode, '+') == NULL;
+}
 
 static fs_file_t* fs_ftp_open_file(fs_t* fs, const char* name, const char* mode) {
   fs_ftp_file_t* ftp_file = NULL;
   char temp_path[MAX_PATH + 1] = {0};
   ftp_fs_t* ftp_fs = FTP_FS(fs);
   return_value_if_fail(fs != NULL && name != NULL && mode != NULL, NULL);
+
+  if (ftp_fs->lazy_read && fs_ftp_is_read_only_mode(mode)) {
+    fs_file_t* file = fs_ftp_open_block_file(ftp_fs, name);
+    if (file != NULL) {
+      return file;
+    }
+  }
+
+  if (ftp_fs->stream_write && fs_ftp_is_write_only_mode(mode)) {
+    return fs_ftp_open_stream_file(ftp_fs, name, strchr(mode, 'a') != NULL);
+  }
+
   ftp_file = TKMEM_ZALLOC(fs_ftp_file_t);
   return_value_if_fail(ftp_file != NULL, NULL);
+  tk_strncpy(ftp_file->name, name, sizeof(ftp_file->name) - 1);
+  darray_init(&ftp_file->dirty, 4, default_destroy, NULL);
+  ftp_file->dirty_start = UINT64_MAX;
+
+  if (ftp_fs->cache_max_size > 0 && fs_ftp_is_read_only_mode(mode)) {
+    if (ftp_fs_cache_fetch(ftp_fs, name, ftp_file->temp_path, sizeof(ftp_file->temp_path)) ==
+        RET_OK) {
+      ftp_file->temp_file = fs_open_file(os_fs(), ftp_file->temp_path, mode);
+      if (ftp_file->temp_file != NULL) {
+        ftp_file->file.vt = &s_file_vtable;
+        ftp_file->ftp_fs = ftp_fs;
+        ftp_file->cached = TRUE;
+        return (fs_file_t*)ftp_file;
+      }
+    }
+  }
 
-  tk_snprintf(temp_path, sizeof(temp_path) - 1, "%s_%d_%s", ftp_fs->host, ftp_fs->data_port, name);
+  /*同一个文件可能被多个线程(或者多个进程)同时打开，每次打开用不同的临时文件。*/
+  tk_snprintf(temp_path, sizeof(temp_path) - 1, "%s_%d_%llu_%u_%s", ftp_fs->host, ftp_fs->port,
+              (unsigned long long)time_now_ms(), ftp_fs_next_temp_id(ftp_fs), name);
   tk_replace_char(temp_path, '/', '_');
   tk_replace_char(temp_path, '\\', '_');
 
   path_prepend_temp_path(ftp_file->temp_path, temp_path);
 
-  if (ftp_fs_cmd_download_file(ftp_fs, name, ftp_file->temp_path) != RET_OK) {
-    if (strchr(mode, 'w') == NULL) {
-      goto error;
-    }
+  if (ftp_fs_cmd_download_file(ftp_fs, name, ftp_file->temp_path) == RET_OK) {
+    ftp_file->existed = TRUE;
+    ftp_file->remote_size = tk_max(file_get_size(ftp_file->temp_path), 0);
+  } else if (strchr(mode, 'w') == NULL) {
+    goto error;
   }
 
-  tk_strncpy(ftp_file->name, name, sizeof(ftp_file->name) - 1);
   ftp_file->temp_file = fs_open_file(os_fs(), ftp_file->temp_path, mode);
   if (ftp_file->temp_file != NULL) {
     ftp_file->file.vt = &s_file_vtable;
     ftp_file->ftp_fs = ftp_fs;
+    ftp_file->append = strchr(mode, 'a') != NULL;
+    if (strchr(mode, 'w') != NULL) {
+      /*"w"方式会清空文件，或者文件原来不存在，关闭时都需要上传。*/
+      ftp_file->changed = TRUE;
+      ftp_file->full_upload = TRUE;
+    }
     return (fs_file_t*)ftp_file;
   }
 
 error:
+  darray_deinit(&ftp_file->dirty);
   TKMEM_FREE(ftp_file);
   return NULL;
 }
@@ -742,16 +5368,40 @@ static const fs_dir_vtable_t s_dir_vtable = {
     .read = fs_ftp_dir_read, .rewind = fs_ftp_dir_rewind, .close = fs_ftp_dir_close};
 
 static fs_dir_t* fs_ftp_open_dir(fs_t* fs, const char* name) {
+  uint32_t i = 0;
+  darray_t stats;
+  ret_t ret = RET_OK;
+  ftp_session_t* s = NULL;
   fs_ftp_dir_t* dir = NULL;
+  darray_t* pstats = NULL;
   return_value_if_fail(fs != NULL && name != NULL, NULL);
   dir = TKMEM_ZALLOC(fs_ftp_dir_t);
   return_value_if_fail(dir != NULL, NULL);
 
   darray_init(&dir->items, 10, (tk_destroy_t)fs_item_destroy, NULL);
+  darray_init(&stats, 10, default_destroy, NULL);
   dir->dir.vt = &s_dir_vtable;
   dir->ftp_fs = FTP_FS(fs);
+  if (dir->ftp_fs->stat_cache_ttl > 0) {
+    pstats = &stats;
+  }
+
+  s = ftp_fs_checkout(dir->ftp_fs);
+  if (s != NULL) {
+    ret = ftp_session_cmd_list(s, name, &dir->items, pstats);
+    ftp_fs_checkin(dir->ftp_fs, s);
+  } else {
+    ret = RET_IO;
+  }
+
+  /*列表已经包含了每一项的stat信息，先放入缓存，避免读目录后逐项stat。*/
+  for (i = 0; ret == RET_OK && i < stats.size; i++) {
+    ftp_stat_entry_t* iter = (ftp_stat_entry_t*)darray_get(&stats, i);
+    ftp_fs_stat_cache_put(dir->ftp_fs, iter->path, &(iter->info), iter->ret);
+  }
+  darray_deinit(&stats);
 
-  if (ftp_fs_cmd_list(dir->ftp_fs, name, &dir->items) == RET_OK) {
+  if (ret == RET_OK) {
     return (fs_dir_t*)dir;
   } else {
     fs_dir_close((fs_dir_t*)dir);
@@ -759,13 +5409,28 @@ static fs_dir_t* fs_ftp_open_dir(fs_t* fs, const char* name) {
   }
 }
 
+static ret_t fs_ftp_simple_cmd(ftp_fs_t* ftp_fs, const char* cmd) {
+  ret_t ret = RET_OK;
+  ftp_session_t* s = ftp_fs_checkout(ftp_fs);
+  return_value_if_fail(s != NULL, RET_IO);
+
+  ret = ftp_session_cmd(s, cmd, NULL, NULL, 0);
+  ftp_fs_checkin(ftp_fs, s);
+
+  return ret;
+}
+
 static ret_t fs_ftp_remove_file(fs_t* fs, const char* name) {
+  ret_t ret = RET_OK;
   char cmd[FTP_CMD_MAX_SIZE] = {0};
   ftp_fs_t* ftp_fs = FTP_FS(fs);
   return_value_if_fail(ftp_fs != NULL && name != NULL, RET_BAD_PARAMS);
 
   tk_snprintf(cmd, sizeof(cmd), "DELE %s\r\n", name);
-  return ftp_fs_cmd(ftp_fs, cmd, NULL, NULL, 0);
+  ret = fs_ftp_simple_cmd(ftp_fs, cmd);
+  ftp_fs_stat_cache_invalidate(ftp_fs, name);
+
+  return ret;
 }
 
 static bool_t fs_ftp_file_exist(fs_t* fs, const char* name) {
@@ -774,49 +5439,92 @@ static bool_t fs_ftp_file_exist(fs_t* fs, const char* name) {
 }
 
 static ret_t fs_ftp_file_rename(fs_t* fs, const char* name, const char* new_name) {
+  ret_t ret = RET_OK;
+  ftp_session_t* s = NULL;
   char cmd[FTP_CMD_MAX_SIZE] = {0};
   ftp_fs_t* ftp_fs = FTP_FS(fs);
   return_value_if_fail(ftp_fs != NULL && name != NULL && new_name != NULL, RET_BAD_PARAMS);
 
-  tk_snprintf(cmd, sizeof(cmd), "RNFR %s\r\n", name);
-  return_value_if_fail(ftp_fs_cmd(ftp_fs, cmd, NULL, NULL, 0) == RET_OK, RET_FAIL);
+  /*RNFR和RNTO必须在同一个连接上执行。*/
+  s = ftp_fs_checkout(ftp_fs);
+  return_value_if_fail(s != NULL, RET_IO);
 
-  tk_snprintf(cmd, sizeof(cmd), "RNTO %s\r\n", new_name);
-  return_value_if_fail(ftp_fs_cmd(ftp_fs, cmd, NULL, NULL, 0) == RET_OK, RET_FAIL);
+  tk_snprintf(cmd, sizeof(cmd), "RNFR %s\r\n", name);
+  ret = ftp_session_cmd(s, cmd, NULL, NULL, 0);
+  if (ret == RET_OK) {
+    tk_snprintf(cmd, sizeof(cmd), "RNTO %s\r\n", new_name);
+    ret = ftp_session_cmd(s, cmd, NULL, NULL, 0);
+  }
+  ftp_fs_checkin(ftp_fs, s);
+  if (ret == RET_OK) {
+    ftp_fs_known_dir_update(ftp_fs, name, FALSE);
+  }
+  ftp_fs_stat_cache_invalidate(ftp_fs, name);
+  ftp_fs_stat_cache_invalidate(ftp_fs, new_name);
 
-  return RET_OK;
+  return ret == RET_OK ? RET_OK : RET_FAIL;
 }
 
 static ret_t fs_ftp_remove_dir(fs_t* fs, const char* name) {
+  ret_t ret = RET_OK;
   char cmd[FTP_CMD_MAX_SIZE] = {0};
   ftp_fs_t* ftp_fs = FTP_FS(fs);
   return_value_if_fail(ftp_fs != NULL && name != NULL, RET_BAD_PARAMS);
 
   tk_snprintf(cmd, sizeof(cmd), "RMD %s\r\n", name);
-  return ftp_fs_cmd(ftp_fs, cmd, NULL, NULL, 0);
+  ret = fs_ftp_simple_cmd(ftp_fs, cmd);
+  ftp_fs_known_dir_update(ftp_fs, name, FALSE);
+  ftp_fs_stat_cache_invalidate(ftp_fs, name);
+
+  return ret;
 }
 
 static ret_t fs_ftp_change_dir(fs_t* fs, const char* name) {
-  char cmd[FTP_CMD_MAX_SIZE] = {0};
+  ret_t ret = RET_OK;
+  ftp_session_t* s = NULL;
   ftp_fs_t* ftp_fs = FTP_FS(fs);
   return_value_if_fail(ftp_fs != NULL && name != NULL, RET_BAD_PARAMS);
 
-  tk_snprintf(cmd, sizeof(cmd), "CWD %s\r\n", name);
-  return ftp_fs_cmd(ftp_fs, cmd, NULL, NULL, 0);
+  s = ftp_fs_checkout(ftp_fs);
+  return_value_if_fail(s != NULL, RET_IO);
+
+  ret = ftp_session_cwd(s, name);
+  if (ret == RET_OK) {
+    /*其它会话在取出时会同步到这个目录。*/
+    tk_mutex_lock(ftp_fs->mutex);
+    tk_strncpy(ftp_fs->cwd, s->cwd, sizeof(ftp_fs->cwd) - 1);
+    tk_mutex_unlock(ftp_fs->mutex);
+  }
+  ftp_fs_checkin(ftp_fs, s);
+
+  return ret;
 }
 
 static ret_t fs_ftp_create_dir(fs_t* fs, const char* name) {
+  ret_t ret = RET_OK;
   char cmd[FTP_CMD_MAX_SIZE] = {0};
   ftp_fs_t* ftp_fs = FTP_FS(fs);
   return_value_if_fail(ftp_fs != NULL && name != NULL, RET_BAD_PARAMS);
 
   tk_snprintf(cmd, sizeof(cmd), "MKD %s\r\n", name);
-  return ftp_fs_cmd(ftp_fs, cmd, NULL, NULL, 0);
+  ret = fs_ftp_simple_cmd(ftp_fs, cmd);
+  if (ret == RET_OK) {
+    ftp_fs_known_dir_update(ftp_fs, name, TRUE);
+  }
+  ftp_fs_stat_cache_invalidate(ftp_fs, name);
+
+  return ret;
 }
 
 static bool_t fs_ftp_dir_exist(fs_t* fs, const char* name) {
   fs_stat_info_t info;
-  return fs_stat(fs, name, &info) == RET_OK && info.is_dir;
+  bool_t exist = fs_stat(fs, name, &info) == RET_OK && info.is_dir;
+
+  if (exist) {
+    ftp_fs_known_dir_update(FTP_FS(fs), name, TRUE);
+  }
+
+  return exist;
 }
 
 static ret_t fs_ftp_dir_rename(fs_t* fs, const char* name, const char* new_name) {
@@ -824,11 +5532,27 @@ static ret_t fs_ftp_dir_rename(fs_t* fs, const char* name, const char* new_name)
 }
 
 static int32_t fs_ftp_get_file_size(fs_t* fs, const char* name) {
-  int32_t size = 0;
+  fs_stat_info_t info;
+  ret_t ret = RET_OK;
+  uint64_t size = 0;
+  ftp_session_t* s = NULL;
+  char path[MAX_PATH + 1] = {0};
   ftp_fs_t* ftp_fs = FTP_FS(fs);
-  return_value_if_fail(ftp_fs != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(ftp_fs != NULL && name != NULL, RET_BAD_PARAMS);
+
+  ftp_fs_abs_path(ftp_fs, name, path, sizeof(path));
+  /*fs_get_file_size只能返回int32_t，更大的文件返回INT32_MAX，需要准确长度时用fs_stat。*/
+  if (ftp_fs_stat_cache_get(ftp_fs, path, &info, &ret)) {
+    return (ret == RET_OK && info.is_reg_file) ? (int32_t)tk_min(info.size, INT32_MAX) : 0;
+  }
+
+  s = ftp_fs_checkout(ftp_fs);
+  return_value_if_fail(s != NULL, 0);
 
-  return ftp_fs_cmd_get_size(ftp_fs, name, &size) == RET_OK ? size : 0;
+  ret = ftp_session_cmd_get_size(s, name, &size);
+  ftp_fs_checkin(ftp_fs, s);
+
+  return ret == RET_OK ? (int32_t)tk_min(size, INT32_MAX) : 0;
 }
 
 static ret_t fs_ftp_get_disk_info(fs_t* fs, const char* volume, int32_t* free_kb,
@@ -837,17 +5561,336 @@ static ret_t fs_ftp_get_disk_info(fs_t* fs, const char* volume, int32_t* free_kb
 }
 
 static ret_t fs_ftp_stat(fs_t* fs, const char* name, fs_stat_info_t* fst) {
+  ret_t ret = RET_OK;
+  ftp_session_t* s = NULL;
+  char path[MAX_PATH + 1] = {0};
   ftp_fs_t* ftp_fs = FTP_FS(fs);
-  return_value_if_fail(ftp_fs != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(ftp_fs != NULL && name != NULL && fst != NULL, RET_BAD_PARAMS);
+
+  ftp_fs_abs_path(ftp_fs, name, path, sizeof(path));
+  if (ftp_fs_stat_cache_get(ftp_fs, path, fst, &ret)) {
+    return ret;
+  }
+
+  s = ftp_fs_checkout(ftp_fs);
+  return_value_if_fail(s != NULL, RET_IO);
+
+  ret = ftp_session_cmd_stat(s, name, fst);
+  ftp_fs_checkin(ftp_fs, s);
+
+  /*连接错误不缓存，文件不存在等结果缓存为否定项。*/
+  if (ret != RET_IO) {
+    ftp_fs_stat_cache_put(ftp_fs, path, fst, ret);
+  }
+
+  return ret;
+}
+
+/*按parent分组，每个目录只列一次。列不出来的目录逐个用XSTAT/STAT。*/
+ret_t ftp_fs_stat_many(fs_t* fs, const char** names, uint32_t nr, fs_stat_info_t* fsts,
+                       ret_t* rets) {
+  uint32_t i = 0;
+  uint32_t j = 0;
+  uint32_t k = 0;
+  darray_t items;
+  darray_t stats;
+  char* paths = NULL;
+  bool_t* done = NULL;
+  ftp_session_t* s = NULL;
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL && names != NULL && fsts != NULL && rets != NULL,
+                       RET_BAD_PARAMS);
+  return_value_if_fail(nr > 0, RET_OK);
+
+  paths = TKMEM_ALLOC(nr * (MAX_PATH + 1));
+  done = TKMEM_ZALLOCN(bool_t, nr);
+  if (paths == NULL || done == NULL) {
+    TKMEM_FREE(paths);
+    TKMEM_FREE(done);
+    return RET_OOM;
+  }
+
+  for (i = 0; i < nr; i++) {
+    char* path = paths + i * (MAX_PATH + 1);
+    rets[i] = RET_BAD_PARAMS;
+    memset(fsts + i, 0x00, sizeof(fsts[i]));
+    if (names[i] == NULL) {
+      path[0] = '\0';
+      done[i] = TRUE;
+    } else {
+      ftp_fs_abs_path(ftp_fs, names[i], path, MAX_PATH + 1);
+      done[i] = ftp_fs_stat_cache_get(ftp_fs, path, fsts + i, rets + i);
+    }
+  }
+
+  darray_init(&items, 64, (tk_destroy_t)fs_item_destroy, NULL);
+  darray_init(&stats, 64, default_destroy, NULL);
+
+  for (i = 0; i < nr; i++) {
+    ret_t ret = RET_OK;
+    char parent[MAX_PATH + 1] = {0};
+    const char* path = paths + i * (MAX_PATH + 1);
+
+    if (done[i]) {
+      continue;
+    }
+
+    if (s == NULL) {
+      s = ftp_fs_checkout(ftp_fs);
+      if (s == NULL) {
+        break;
+      }
+    }
+
+    darray_clear(&items);
+    darray_clear(&stats);
+    ftp_path_get_parent(path, parent, sizeof(parent));
+    if (parent[0] != '\0') {
+      ret = ftp_session_cmd_list(s, parent, &items, &stats);
+    } else {
+      ret = RET_FAIL;
+    }
+
+    for (j = i; j < nr; j++) {
+      bool_t listed = FALSE;
+      char iter_parent[MAX_PATH + 1] = {0};
+      const char* iter = paths + j * (MAX_PATH + 1);
+
+      if (done[j]) {
+        continue;
+      }
+      ftp_path_get_parent(iter, iter_parent, sizeof(iter_parent));
+      if (!tk_str_eq(iter_parent, parent)) {
+        continue;
+      }
+
+      if (ret == RET_OK) {
+        rets[j] = RET_NOT_FOUND;
+        for (k = 0; k < stats.size; k++) {
+          ftp_stat_entry_t* entry = (ftp_stat_entry_t*)darray_get(&stats, k);
+          if (tk_str_eq(entry->path, iter)) {
+            fsts[j] = entry->info;
+            rets[j] = RET_OK;
+            listed = TRUE;
+            break;
+          }
+        }
+      } else {
+        rets[j] = ftp_session_cmd_stat(s, iter, fsts + j);
+      }
+
+      if (!listed && rets[j] != RET_IO) {
+        ftp_fs_stat_cache_put(ftp_fs, iter, fsts + j, rets[j]);
+      }
+      done[j] = TRUE;
+    }
+
+    if (ret == RET_OK) {
+      for (k = 0; k < stats.size; k++) {
+        ftp_stat_entry_t* entry = (ftp_stat_entry_t*)darray_get(&stats, k);
+        ftp_fs_stat_cache_put(ftp_fs, entry->path, &(entry->info), entry->ret);
+      }
+    }
+
+    if (s->broken) {
+      ftp_fs_checkin(ftp_fs, s);
+      s = NULL;
+    }
+  }
+
+  if (s != NULL) {
+    ftp_fs_checkin(ftp_fs, s);
+  }
+
+  for (i = 0; i < nr; i++) {
+    if (!done[i]) {
+      rets[i] = RET_IO;
+    }
+  }
+
+  darray_deinit(&items);
+  darray_deinit(&stats);
+  TKMEM_FREE(paths);
+  TKMEM_FREE(done);
+
+  return RET_OK;
+}
+
+static ret_t ftp_batch_item_append(ftp_fs_batch_item_t* item, wbuffer_t* wb) {
+  char cmd[FTP_CMD_MAX_SIZE] = {0};
+
+  switch (item->op) {
+    case FTP_FS_BATCH_REMOVE_FILE: {
+      tk_snprintf(cmd, sizeof(cmd), "DELE %s\r\n", item->name);
+      break;
+    }
+    case FTP_FS_BATCH_CREATE_DIR: {
+      tk_snprintf(cmd, sizeof(cmd), "MKD %s\r\n", item->name);
+      break;
+    }
+    case FTP_FS_BATCH_REMOVE_DIR: {
+      tk_snprintf(cmd, sizeof(cmd), "RMD %s\r\n", item->name);
+      break;
+    }
+    case FTP_FS_BATCH_RENAME: {
+      tk_snprintf(cmd, sizeof(cmd), "RNFR %s\r\n", item->name);
+      return_value_if_fail(wbuffer_write_binary(wb, cmd, strlen(cmd)) == RET_OK, RET_OOM);
+      tk_snprintf(cmd, sizeof(cmd), "RNTO %s\r\n", item->new_name);
+      break;
+    }
+    default: {
+      return RET_BAD_PARAMS;
+    }
+  }
+
+  return wbuffer_write_binary(wb, cmd, strlen(cmd));
+}
+
+static ret_t ftp_session_batch_set_error(ftp_session_t* s, int32_t code) {
+  s->last_error_code = code;
+  tk_strncpy(s->last_error_message, (const char*)(s->reply.data),
+             sizeof(s->last_error_message) - 1);
+
+  return RET_OK;
+}
+
+/*一组命令连续写出，然后按顺序读取回复。*/
+static ret_t ftp_session_batch(ftp_session_t* s, ftp_fs_batch_item_t* items, uint32_t nr) {
+  wbuffer_t wb;
+  uint32_t i = 0;
+  ret_t ret = RET_OK;
+
+  wbuffer_init_extendable(&wb);
+  for (i = 0; i < nr; i++) {
+    if (items[i].ret == RET_SKIP) {
+      ret = ftp_batch_item_append(items + i, &wb);
+      break_if_fail(ret == RET_OK);
+    }
+  }
+
+  /*一组命令连续发送，只等待一次。*/
+  if (ret == RET_OK && wb.cursor > 0) {
+    s->round_trips++;
+    if (tk_iostream_write_len(s->ios, wb.data, wb.cursor, 5000) != (int32_t)(wb.cursor)) {
+      s->broken = TRUE;
+      ret = RET_IO;
+    }
+  }
+  wbuffer_deinit(&wb);
+
+  for (i = 0; i < nr; i++) {
+    int32_t code = 0;
+    bool_t rnfr_failed = FALSE;
+    ftp_fs_batch_item_t* item = items + i;
+    if (item->ret != RET_SKIP) {
+      continue;
+    }
+
+    /*连接出错后，已经发出的命令是否执行无法确定。*/
+    if (ret == RET_OK) {
+      ret = ftp_session_read_reply(s, &code);
+    }
+    if (ret == RET_OK && item->op == FTP_FS_BATCH_RENAME) {
+      if (code == 350) {
+        ret = ftp_session_read_reply(s, &code);
+      } else {
+        /*RNFR失败时服务器仍然会回复RNTO(通常是503)，读取后丢弃。*/
+        int32_t rnto_code = 0;
+        rnfr_failed = TRUE;
+        ftp_session_batch_set_error(s, code);
+        ret = ftp_session_read_reply(s, &rnto_code);
+      }
+    }
+
+    if (ret == RET_OK) {
+      item->code = code;
+      if (!rnfr_failed && code >= 100 && code < 400) {
+        item->ret = RET_OK;
+      } else {
+        item->ret = RET_FAIL;
+        if (!rnfr_failed) {
+          ftp_session_batch_set_error(s, code);
+        }
+      }
+    } else {
+      item->ret = RET_IO;
+    }
+  }
+
+  return ret;
+}
+
+ret_t ftp_fs_batch(fs_t* fs, ftp_fs_batch_item_t* items, uint32_t nr, bool_t stop_on_error) {
+  uint32_t i = 0;
+  uint32_t start = 0;
+  uint32_t end = 0;
+  ret_t result = RET_OK;
+  ftp_session_t* s = NULL;
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL && items != NULL, RET_BAD_PARAMS);
+
+  for (i = 0; i < nr; i++) {
+    items[i].code = 0;
+    if (items[i].name == NULL || (items[i].op == FTP_FS_BATCH_RENAME && items[i].new_name == NULL)) {
+      items[i].ret = RET_BAD_PARAMS;
+    } else {
+      items[i].ret = RET_SKIP;
+    }
+  }
+
+  s = ftp_fs_checkout(ftp_fs);
+  return_value_if_fail(s != NULL, RET_IO);
+
+  for (start = 0; start < nr; start = end) {
+    end = tk_min_int(start + FTP_FS_BATCH_WINDOW, nr);
+    if (ftp_session_batch(s, items + start, end - start) != RET_OK) {
+      result = RET_IO;
+      break;
+    }
+
+    for (i = start; i < end; i++) {
+      if (items[i].ret != RET_OK) {
+        result = RET_FAIL;
+      }
+    }
+
+    if (result != RET_OK && stop_on_error) {
+      break;
+    }
+  }
+  ftp_fs_checkin(ftp_fs, s);
+
+  for (i = 0; i < end; i++) {
+    if (items[i].ret == RET_OK) {
+      bool_t created = items[i].op == FTP_FS_BATCH_CREATE_DIR;
+      if (created || items[i].op == FTP_FS_BATCH_REMOVE_DIR || items[i].op == FTP_FS_BATCH_RENAME) {
+        ftp_fs_known_dir_update(ftp_fs, items[i].name, created);
+      }
+    }
+    if (items[i].ret != RET_SKIP && items[i].ret != RET_BAD_PARAMS) {
+      ftp_fs_stat_cache_invalidate(ftp_fs, items[i].name);
+      if (items[i].op == FTP_FS_BATCH_RENAME) {
+        ftp_fs_stat_cache_invalidate(ftp_fs, items[i].new_name);
+      }
+    }
+  }
 
-  return ftp_fs_cmd_stat(ftp_fs, name, fst);
+  return result;
 }
 
 static ret_t fs_ftp_get_cwd(fs_t* fs, char path[MAX_PATH + 1]) {
+  ret_t ret = RET_OK;
+  ftp_session_t* s = NULL;
   ftp_fs_t* ftp_fs = FTP_FS(fs);
   return_value_if_fail(ftp_fs != NULL, RET_BAD_PARAMS);
 
-  return ftp_fs_cmd_get_pwd(ftp_fs, path, MAX_PATH);
+  s = ftp_fs_checkout(ftp_fs);
+  return_value_if_fail(s != NULL, RET_IO);
+
+  ret = ftp_session_cmd_get_pwd(s, path, MAX_PATH);
+  ftp_fs_checkin(ftp_fs, s);
+
+  return ret;
 }
 
 static ret_t fs_ftp_get_exe(fs_t* fs, char path[MAX_PATH + 1]) {
@@ -900,25 +5943,49 @@ static const char* ftp_fs_get_stat_cmd_from_welcome(const char* message) {
 
 fs_t* ftp_fs_create(const char* host, uint32_t port, const char* user, const char* password) {
   ftp_fs_t* ftp_fs = NULL;
+  ftp_session_t* s = NULL;
   char buf[FTP_BUF_MAX_SIZE] = {0};
   return_value_if_fail(port > 0 && user != NULL && password != NULL, NULL);
   ftp_fs = TKMEM_ZALLOC(ftp_fs_t);
   return_value_if_fail(ftp_fs != NULL, NULL);
 
   ftp_fs_init(&ftp_fs->fs);
+  ftp_fs->port = port;
+  ftp_fs->max_sessions = FTP_FS_DEFAULT_MAX_SESSIONS;
+  ftp_fs->transfer_buffer_size = FTP_FS_DEFAULT_TRANSFER_BUFFER_SIZE;
+  ftp_fs->compress_min_size = FTP_FS_DEFAULT_COMPRESS_MIN_SIZE;
+  tk_strncpy(ftp_fs->compress_exts, FTP_FS_DEFAULT_COMPRESS_EXTS, sizeof(ftp_fs->compress_exts) - 1);
   ftp_fs->host = tk_str_copy(ftp_fs->host, host);
   ftp_fs->user = tk_str_copy(ftp_fs->user, user);
   ftp_fs->password = tk_str_copy(ftp_fs->password, password);
-  ftp_fs->ios = tk_iostream_tcp_create_client(host, port);
-
-  goto_error_if_fail(ftp_fs->ios != NULL);
+  darray_init(&ftp_fs->sessions, 4, (tk_destroy_t)ftp_session_destroy, NULL);
+  darray_init(&ftp_fs->stat_cache, 64, default_destroy, NULL);
+  darray_init(&ftp_fs->known_dirs, 64, default_destroy, NULL);
+  darray_init(&ftp_fs->thread_errors, 4, default_destroy, NULL);
+  ftp_fs->mutex = tk_mutex_create();
+  ftp_fs->cond = tk_cond_create();
+  ftp_fs->cache_mutex = tk_mutex_create();
+  ftp_fs->data_mutex = tk_mutex_create();
+  goto_error_if_fail(ftp_fs->mutex != NULL && ftp_fs->cond != NULL && ftp_fs->cache_mutex != NULL);
+  goto_error_if_fail(ftp_fs->data_mutex != NULL);
+
+  /*第一个连接用于检查登录信息和识别服务器类型。*/
+  s = ftp_session_create(ftp_fs, buf, sizeof(buf));
+  goto_error_if_fail(s != NULL);
+  /*支持MLST时stat直接用MLST，欢迎信息只用于猜测不支持MLST的服务器用哪个命令。*/
+  ftp_session_load_features(s);
+  ftp_fs->stat_cmd = ftp_fs_get_stat_cmd_from_welcome(buf);
 
-  /*welcome message*/
-  tk_iostream_read(ftp_fs->ios, buf, sizeof(buf) - 1);
-  log_debug("%s", buf);
+  if (ftp_session_cmd_get_pwd(s, ftp_fs->home, sizeof(ftp_fs->home) - 1) != RET_OK) {
+    tk_strncpy(ftp_fs->home, "/", sizeof(ftp_fs->home) - 1);
+  }
+  tk_strncpy(ftp_fs->cwd, ftp_fs->home, sizeof(ftp_fs->cwd) - 1);
+  tk_strncpy(s->cwd, ftp_fs->home, sizeof(s->cwd) - 1);
 
-  ftp_fs->stat_cmd = ftp_fs_get_stat_cmd_from_welcome(buf);
-  goto_error_if_fail(ftp_fs_login(ftp_fs) == RET_OK);
+  if (darray_push(&ftp_fs->sessions, s) != RET_OK) {
+    ftp_session_destroy(s);
+    goto error;
+  }
 
   return (fs_t*)(ftp_fs);
 error:
@@ -929,6 +5996,159 @@ error:
   return NULL;
 }
 
+ret_t ftp_fs_set_max_sessions(fs_t* fs, uint32_t max_sessions) {
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL && max_sessions > 0, RET_BAD_PARAMS);
+
+  tk_mutex_lock(ftp_fs->mutex);
+  ftp_fs->max_sessions = max_sessions;
+  tk_cond_broadcast(ftp_fs->cond);
+  tk_mutex_unlock(ftp_fs->mutex);
+
+  return RET_OK;
+}
+
+ret_t ftp_fs_set_transfer_buffer_size(fs_t* fs, uint32_t size) {
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL, RET_BAD_PARAMS);
+
+  size = tk_max_int(size, FTP_FS_MIN_TRANSFER_BUFFER_SIZE);
+  size = tk_min_int(size, FTP_FS_MAX_TRANSFER_BUFFER_SIZE);
+  ftp_fs->transfer_buffer_size = size;
+
+  return RET_OK;
+}
+
+ret_t ftp_fs_set_stream_write(fs_t* fs, bool_t stream_write) {
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL, RET_BAD_PARAMS);
+
+  ftp_fs->stream_write = stream_write;
+
+  return RET_OK;
+}
+
+ret_t ftp_fs_set_lazy_read(fs_t* fs, bool_t lazy_read) {
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL, RET_BAD_PARAMS);
+
+  ftp_fs->lazy_read = lazy_read;
+
+  return RET_OK;
+}
+
+ret_t ftp_fs_set_cache(fs_t* fs, const char* dir, uint32_t max_size) {
+  char path[MAX_PATH + 1] = {0};
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL, RET_BAD_PARAMS);
+
+  if (dir == NULL) {
+    return_value_if_fail(fs_get_temp_path(os_fs(), path) == RET_OK, RET_FAIL);
+    path_build(ftp_fs->cache_dir, sizeof(ftp_fs->cache_dir), path, "ftp_fs_cache", NULL);
+  } else {
+    tk_strncpy(ftp_fs->cache_dir, dir, sizeof(ftp_fs->cache_dir) - 1);
+  }
+
+  if (max_size > 0 && !dir_exist(ftp_fs->cache_dir)) {
+    return_value_if_fail(fs_create_dir_r(os_fs(), ftp_fs->cache_dir) == RET_OK, RET_FAIL);
+  }
+  ftp_fs->cache_max_size = max_size;
+
+  return RET_OK;
+}
+
+ret_t ftp_fs_set_stat_cache_ttl(fs_t* fs, uint32_t ttl) {
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL, RET_BAD_PARAMS);
+
+  tk_mutex_lock(ftp_fs->mutex);
+  ftp_fs->stat_cache_ttl = ttl;
+  if (ttl == 0) {
+    darray_clear(&ftp_fs->stat_cache);
+  }
+  tk_mutex_unlock(ftp_fs->mutex);
+
+  return RET_OK;
+}
+
+ret_t ftp_fs_get_last_error(fs_t* fs, int* code, char* message, uint32_t size) {
+  uint32_t i = 0;
+  uint64_t thread_id = tk_thread_self();
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL && code != NULL, RET_BAD_PARAMS);
+
+  *code = 0;
+  if (message != NULL && size > 0) {
+    message[0] = '\0';
+  }
+
+  tk_mutex_lock(ftp_fs->mutex);
+  for (i = 0; i < ftp_fs->thread_errors.size; i++) {
+    ftp_thread_error_t* iter = (ftp_thread_error_t*)darray_get(&ftp_fs->thread_errors, i);
+    if (iter->thread_id == thread_id) {
+      *code = iter->code;
+      if (message != NULL && size > 0) {
+        tk_strncpy(message, iter->message, size - 1);
+      }
+      break;
+    }
+  }
+  tk_mutex_unlock(ftp_fs->mutex);
+
+  return RET_OK;
+}
+
+uint64_t ftp_fs_get_round_trips(fs_t* fs) {
+  uint64_t round_trips = 0;
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL, 0);
+
+  tk_mutex_lock(ftp_fs->mutex);
+  round_trips = ftp_fs->round_trips;
+  tk_mutex_unlock(ftp_fs->mutex);
+
+  return round_trips;
+}
+
+ret_t ftp_fs_set_compress(fs_t* fs, ftp_fs_compress_t compress, const char* exts,
+                          uint32_t min_size) {
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL, RET_BAD_PARAMS);
+
+  ftp_fs->compress = compress;
+  ftp_fs->compress_min_size = min_size;
+  tk_strncpy(ftp_fs->compress_exts, exts != NULL ? exts : FTP_FS_DEFAULT_COMPRESS_EXTS,
+             sizeof(ftp_fs->compress_exts) - 1);
+
+  return RET_OK;
+}
+
+ret_t ftp_fs_set_hash_type(fs_t* fs, ftp_fs_hash_type_t type) {
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL, RET_BAD_PARAMS);
+
+  ftp_fs->hash_type = type;
+
+  return RET_OK;
+}
+
+ret_t ftp_fs_get_remote_hash(fs_t* fs, const char* remote_filename, ftp_fs_hash_type_t type,
+                             char* hash, uint32_t size) {
+  ret_t ret = RET_OK;
+  ftp_session_t* s = NULL;
+  ftp_fs_t* ftp_fs = FTP_FS(fs);
+  return_value_if_fail(ftp_fs != NULL && remote_filename != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(hash != NULL && size > 0 && type != FTP_FS_HASH_NONE, RET_BAD_PARAMS);
+
+  s = ftp_fs_checkout(ftp_fs);
+  return_value_if_fail(s != NULL, RET_IO);
+
+  ret = ftp_session_cmd_hash(s, remote_filename, type, hash, size);
+  ftp_fs_checkin(ftp_fs, s);
+
+  return ret;
+}
+
 ret_t ftp_fs_destroy(fs_t* fs) {
   ftp_fs_t* ftp_fs = FTP_FS(fs);
   return_value_if_fail(ftp_fs != NULL, RET_BAD_PARAMS);
@@ -936,8 +6156,26 @@ ret_t ftp_fs_destroy(fs_t* fs) {
   TKMEM_FREE(ftp_fs->user);
   TKMEM_FREE(ftp_fs->password);
   TKMEM_FREE(ftp_fs->host);
-  TK_OBJECT_UNREF(ftp_fs->ios);
-  TK_OBJECT_UNREF(ftp_fs->data_ios);
+  darray_deinit(&ftp_fs->sessions);
+  darray_deinit(&ftp_fs->stat_cache);
+  darray_deinit(&ftp_fs->known_dirs);
+  darray_deinit(&ftp_fs->thread_errors);
+
+  if (ftp_fs->cond != NULL) {
+    tk_cond_destroy(ftp_fs->cond);
+  }
+
+  if (ftp_fs->mutex != NULL) {
+    tk_mutex_destroy(ftp_fs->mutex);
+  }
+
+  if (ftp_fs->cache_mutex != NULL) {
+    tk_mutex_destroy(ftp_fs->cache_mutex);
+  }
+
+  if (ftp_fs->data_mutex != NULL) {
+    tk_mutex_destroy(ftp_fs->data_mutex);
+  }
 
   TKMEM_FREE(ftp_fs);
   return RET_OK;
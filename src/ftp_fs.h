@@ -23,14 +23,329 @@
 #define TK_FTP_FS_H
 
 #include "tkc/fs.h"
+#include "tkc/cond.h"
+#include "tkc/mutex.h"
+#include "tkc/darray.h"
 #include "tkc/iostream.h"
 
 BEGIN_C_DECLS
 
+/**
+ * @const FTP_FS_DEFAULT_MAX_SESSIONS
+ * 缺省的最大控制连接数。
+ */
+#define FTP_FS_DEFAULT_MAX_SESSIONS 1
+
+/**
+ * @const FTP_FS_MIN_SEGMENT_SIZE
+ * 分段下载时每段的最小长度。
+ */
+#define FTP_FS_MIN_SEGMENT_SIZE (1024 * 1024)
+
+/**
+ * @const FTP_FS_BLOCK_SIZE
+ * 按块读取时每块的大小。
+ */
+#define FTP_FS_BLOCK_SIZE (64 * 1024)
+
+/**
+ * @const FTP_FS_CACHED_BLOCKS
+ * 按块读取时每个文件缓存的块数。
+ */
+#define FTP_FS_CACHED_BLOCKS 8
+
+/**
+ * @const FTP_FS_MAX_DIRTY_RANGES
+ * 修改文件时记录的最多区间数，超过时关闭文件会上传整个文件。
+ */
+#define FTP_FS_MAX_DIRTY_RANGES 64
+
+/**
+ * @const FTP_FS_DEFAULT_TRANSFER_BUFFER_SIZE
+ * 缺省的数据传输缓冲区大小。
+ */
+#define FTP_FS_DEFAULT_TRANSFER_BUFFER_SIZE (64 * 1024)
+
+/**
+ * @const FTP_FS_MIN_TRANSFER_BUFFER_SIZE
+ * 数据传输缓冲区的最小值。
+ */
+#define FTP_FS_MIN_TRANSFER_BUFFER_SIZE (4 * 1024)
+
+/**
+ * @const FTP_FS_MAX_TRANSFER_BUFFER_SIZE
+ * 数据传输缓冲区的最大值。
+ */
+#define FTP_FS_MAX_TRANSFER_BUFFER_SIZE (1024 * 1024)
+
+/**
+ * @const FTP_FS_STAT_CACHE_MAX_SIZE
+ * 文件信息缓存的最大项数。
+ */
+#define FTP_FS_STAT_CACHE_MAX_SIZE 4096
+
+/**
+ * @const FTP_FS_KNOWN_DIRS_MAX_SIZE
+ * 记录的已知存在的远程目录的最大个数(超过时清空重新记录)。
+ */
+#define FTP_FS_KNOWN_DIRS_MAX_SIZE 1024
+
+/**
+ * @const FTP_FS_BATCH_WINDOW
+ * 批量操作时连续发送(不等待回复)的最大命令数。
+ */
+#define FTP_FS_BATCH_WINDOW 64
+
+/**
+ * @const FTP_FS_DEFAULT_COMPRESS_EXTS
+ * FTP_FS_COMPRESS_AUTO时缺省压缩的文件扩展名。
+ */
+#define FTP_FS_DEFAULT_COMPRESS_EXTS "txt,log,json,ini,xml,csv,html,htm,js,css,md,conf,yaml"
+
+/**
+ * @const FTP_FS_DEFAULT_COMPRESS_MIN_SIZE
+ * FTP_FS_COMPRESS_AUTO时缺省压缩的最小文件长度，太小的文件压缩节省不了多少，还要多两次命令往返。
+ */
+#define FTP_FS_DEFAULT_COMPRESS_MIN_SIZE 1024
+
+/**
+ * @enum ftp_fs_batch_op_t
+ * @prefix FTP_FS_BATCH_
+ * 批量操作的类型。
+ */
+typedef enum _ftp_fs_batch_op_t {
+  /**
+   * @const FTP_FS_BATCH_REMOVE_FILE
+   * 删除文件(DELE)。
+   */
+  FTP_FS_BATCH_REMOVE_FILE = 0,
+  /**
+   * @const FTP_FS_BATCH_CREATE_DIR
+   * 创建目录(MKD)。
+   */
+  FTP_FS_BATCH_CREATE_DIR,
+  /**
+   * @const FTP_FS_BATCH_REMOVE_DIR
+   * 删除目录(RMD)。
+   */
+  FTP_FS_BATCH_REMOVE_DIR,
+  /**
+   * @const FTP_FS_BATCH_RENAME
+   * 重命名(RNFR/RNTO)。
+   */
+  FTP_FS_BATCH_RENAME
+} ftp_fs_batch_op_t;
+
+/**
+ * @class ftp_fs_batch_item_t
+ * 批量操作中的一项。
+ */
+typedef struct _ftp_fs_batch_item_t {
+  /**
+   * @property {ftp_fs_batch_op_t} op
+   * 操作类型。
+   */
+  ftp_fs_batch_op_t op;
+  /**
+   * @property {const char*} name
+   * 文件或目录名。
+   */
+  const char* name;
+  /**
+   * @property {const char*} new_name
+   * 新的名称(仅用于FTP_FS_BATCH_RENAME)。
+   */
+  const char* new_name;
+  /**
+   * @property {ret_t} ret
+   * 执行结果(RET_SKIP表示没有执行)。
+   */
+  ret_t ret;
+  /**
+   * @property {int32_t} code
+   * 服务器的回复码。
+   */
+  int32_t code;
+} ftp_fs_batch_item_t;
+
+/**
+ * @method ftp_fs_on_progress_t
+ * 传输进度回调函数。
+ * @param {void*} ctx 回调函数的上下文。
+ * @param {uint64_t} done 已经传输的字节数。
+ * @param {uint64_t} total 总字节数(0表示未知)。
+ *
+ * @return {ret_t} 返回RET_STOP中止传输，其它值继续传输。
+ */
+typedef ret_t (*ftp_fs_on_progress_t)(void* ctx, uint64_t done, uint64_t total);
+
+/**
+ * @method ftp_fs_on_file_done_t
+ * 目录传输中单个文件传输完成的回调函数。
+ * @param {void*} ctx 回调函数的上下文。
+ * @param {const char*} remote_filename 远程文件名。
+ * @param {const char*} local_filename 本地文件名。
+ * @param {ret_t} ret 该文件的传输结果。
+ *
+ * @return {ret_t} 返回RET_OK。
+ */
+typedef ret_t (*ftp_fs_on_file_done_t)(void* ctx, const char* remote_filename,
+                                       const char* local_filename, ret_t ret);
+
+/**
+ * @enum ftp_fs_sync_action_t
+ * @prefix FTP_FS_SYNC_
+ * 同步时对一项执行的操作。
+ */
+typedef enum _ftp_fs_sync_action_t {
+  /**
+   * @const FTP_FS_SYNC_CREATE_DIR
+   * 在目标中创建目录。
+   */
+  FTP_FS_SYNC_CREATE_DIR = 0,
+  /**
+   * @const FTP_FS_SYNC_COPY_NEW
+   * 传输目标中没有的文件。
+   */
+  FTP_FS_SYNC_COPY_NEW,
+  /**
+   * @const FTP_FS_SYNC_COPY_CHANGED
+   * 传输修改过的文件。
+   */
+  FTP_FS_SYNC_COPY_CHANGED,
+  /**
+   * @const FTP_FS_SYNC_REMOVE_FILE
+   * 删除目标中多余的文件。
+   */
+  FTP_FS_SYNC_REMOVE_FILE,
+  /**
+   * @const FTP_FS_SYNC_REMOVE_DIR
+   * 删除目标中多余的目录。
+   */
+  FTP_FS_SYNC_REMOVE_DIR
+} ftp_fs_sync_action_t;
+
+/**
+ * @method ftp_fs_on_sync_plan_t
+ * 同步计划回调函数，在比较完目录树、执行任何操作之前对每个需要执行的操作调用一次。
+ * @param {void*} ctx 回调函数的上下文。
+ * @param {ftp_fs_sync_action_t} action 操作。
+ * @param {const char*} remote_filename 远程文件名。
+ * @param {const char*} local_filename 本地文件名。
+ *
+ * @return {ret_t} 返回RET_SKIP跳过该操作，其它值执行该操作。
+ */
+typedef ret_t (*ftp_fs_on_sync_plan_t)(void* ctx, ftp_fs_sync_action_t action,
+                                       const char* remote_filename, const char* local_filename);
+
+/**
+ * @class ftp_fs_sync_options_t
+ * 同步选项。
+ */
+typedef struct _ftp_fs_sync_options_t {
+  /**
+   * @property {bool_t} upload
+   * TRUE表示把本地目录同步到远程目录，FALSE表示把远程目录同步到本地目录。
+   */
+  bool_t upload;
+  /**
+   * @property {bool_t} remove_extra
+   * 是否删除目标中有而源中没有的文件和目录。
+   */
+  bool_t remove_extra;
+  /**
+   * @property {bool_t} dry_run
+   * 只通过on_plan报告需要执行的操作，不实际执行。
+   */
+  bool_t dry_run;
+  /**
+   * @property {bool_t} size_only
+   * 只比较文件长度，不比较修改时间(服务器的时间不可靠时使用)。
+   */
+  bool_t size_only;
+  /**
+   * @property {uint32_t} workers
+   * 同时传输的文件数。
+   */
+  uint32_t workers;
+  /**
+   * @property {ftp_fs_on_sync_plan_t} on_plan
+   * 同步计划回调函数(可以为NULL)。
+   */
+  ftp_fs_on_sync_plan_t on_plan;
+  /**
+   * @property {ftp_fs_on_progress_t} on_progress
+   * 总进度回调函数(可以为NULL)，返回RET_STOP中止同步。
+   */
+  ftp_fs_on_progress_t on_progress;
+  /**
+   * @property {ftp_fs_on_file_done_t} on_file_done
+   * 单个文件传输或删除完成的回调函数(可以为NULL)。
+   */
+  ftp_fs_on_file_done_t on_file_done;
+  /**
+   * @property {void*} ctx
+   * 回调函数的上下文。
+   */
+  void* ctx;
+} ftp_fs_sync_options_t;
+
+struct _ftp_fs_nb_transfer_t;
+typedef struct _ftp_fs_nb_transfer_t ftp_fs_nb_transfer_t;
+
+/**
+ * @enum ftp_fs_hash_type_t
+ * @prefix FTP_FS_HASH_
+ * 传输时计算的校验值类型。
+ */
+typedef enum _ftp_fs_hash_type_t {
+  /**
+   * @const FTP_FS_HASH_NONE
+   * 不计算校验值。
+   */
+  FTP_FS_HASH_NONE = 0,
+  /**
+   * @const FTP_FS_HASH_CRC32
+   * CRC32(服务器用HASH或XCRC计算)。
+   */
+  FTP_FS_HASH_CRC32,
+  /**
+   * @const FTP_FS_HASH_SHA256
+   * SHA-256(服务器用HASH或XSHA256计算)。
+   */
+  FTP_FS_HASH_SHA256
+} ftp_fs_hash_type_t;
+
+/**
+ * @enum ftp_fs_compress_t
+ * @prefix FTP_FS_COMPRESS_
+ * 数据传输的压缩(MODE Z)策略。
+ */
+typedef enum _ftp_fs_compress_t {
+  /**
+   * @const FTP_FS_COMPRESS_NEVER
+   * 不压缩。
+   */
+  FTP_FS_COMPRESS_NEVER = 0,
+  /**
+   * @const FTP_FS_COMPRESS_ALWAYS
+   * 下载、上传和列目录都压缩。
+   */
+  FTP_FS_COMPRESS_ALWAYS,
+  /**
+   * @const FTP_FS_COMPRESS_AUTO
+   * 列目录以及扩展名在列表中、长度不小于最小长度的文件才压缩。
+   */
+  FTP_FS_COMPRESS_AUTO
+} ftp_fs_compress_t;
+
 /**
  * @class ftp_fs_t
  * 将ftp客户端封装成文件系统。
  *
+ * 内部维护一个已登录的控制连接池，每个操作从池中取出一个连接，用完后放回，
+ * 所以多个线程可以同时通过同一个fs对象访问服务器。
+ *
  */
 typedef struct _ftp_fs_t {
   fs_t fs;
@@ -38,11 +353,13 @@ typedef struct _ftp_fs_t {
   /**
    * @property {int} last_error_code
    * 最后一次错误码。
+   * > 任何线程的操作结束时都会更新，多个线程同时使用时请用ftp_fs_get_last_error获取本线程的错误。
    */
   int last_error_code;
   /**
    * @property {char} last_error_message[256]
    * 最后一次错误信息。
+   * > 同last_error_code，多个线程同时使用时没有意义。
    */
   char last_error_message[256];
 
@@ -50,10 +367,35 @@ typedef struct _ftp_fs_t {
   char* user;
   char* host;
   char* password;
-  tk_iostream_t* ios;
-  tk_iostream_t* data_ios;
-  int data_port;
+  uint32_t port;
   const char* stat_cmd;
+  char home[MAX_PATH + 1];
+  char cwd[MAX_PATH + 1];
+
+  tk_mutex_t* mutex;
+  tk_cond_t* cond;
+  darray_t sessions;
+  uint32_t connecting;
+  uint32_t max_sessions;
+  uint32_t transfer_buffer_size;
+  bool_t lazy_read;
+  bool_t stream_write;
+  char cache_dir[MAX_PATH + 1];
+  tk_mutex_t* cache_mutex;
+  tk_mutex_t* data_mutex;
+  uint32_t cache_max_size;
+  uint32_t stat_cache_ttl;
+  darray_t stat_cache;
+  darray_t known_dirs;
+  darray_t thread_errors;
+  uint32_t temp_seq;
+  uint32_t features;
+  bool_t features_loaded;
+  ftp_fs_hash_type_t hash_type;
+  ftp_fs_compress_t compress;
+  char compress_exts[128];
+  uint32_t compress_min_size;
+  uint64_t round_trips;
 } ftp_fs_t;
 
 /**
@@ -79,9 +421,102 @@ fs_t* ftp_fs_create(const char* host, uint32_t port, const char* user, const cha
  */ 
 ret_t ftp_fs_download_file(fs_t* fs, const char* remote_filename, const char* local_filename);
 
+/**
+ * @method ftp_fs_download_file_ex
+ * 下载文件，每收到一块数据调用一次进度回调。
+ * 回调返回RET_STOP时，关闭数据连接并发送ABOR，读走服务器的回复后立即释放控制连接。
+ * > 总字节数取自RETR回复中的"(N bytes)"，服务器没有给出时为0。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {const char*} remote_filename 远程文件名。
+ * @param {const char*} local_filename 本地文件名。
+ * @param {ftp_fs_on_progress_t} on_progress 进度回调函数(在当前线程中调用，可以为NULL)。
+ * @param {void*} ctx 回调函数的上下文。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，RET_STOP表示被中止，否则表示失败。
+ */
+ret_t ftp_fs_download_file_ex(fs_t* fs, const char* remote_filename, const char* local_filename,
+                              ftp_fs_on_progress_t on_progress, void* ctx);
+
+/**
+ * @method ftp_fs_download_file_parallel
+ * 分段并行下载文件。
+ * 先用SIZE获取文件大小，然后把文件分成多段，每段用一个控制连接通过REST+RETR下载，
+ * 直接写到预先分配的本地文件的对应位置。
+ * > 需要用ftp_fs_set_max_sessions设置足够的连接数，才能真正并行。
+ * > 服务器不支持SIZE或文件太小时，退化为普通下载。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {const char*} remote_filename 远程文件名。
+ * @param {const char*} local_filename 本地文件名。
+ * @param {uint32_t} segments 最大分段数。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_fs_download_file_parallel(fs_t* fs, const char* remote_filename,
+                                    const char* local_filename, uint32_t segments);
+
+/**
+ * @method ftp_fs_download_file_resume
+ * 断点续传下载文件。
+ * 从本地文件当前的长度开始，用REST+RETR取回剩下的数据追加到本地文件。
+ * 如果verify_size不为0，先取回重叠的verify_size个字节和本地文件的末尾比较，
+ * 不一致(远程文件已经变化)或者服务器不支持REST时，重新下载整个文件。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {const char*} remote_filename 远程文件名。
+ * @param {const char*} local_filename 本地文件名。
+ * @param {uint32_t} verify_size 需要校验的重叠字节数(0表示不校验)。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_fs_download_file_resume(fs_t* fs, const char* remote_filename,
+                                  const char* local_filename, uint32_t verify_size);
+
+/**
+ * @method ftp_fs_open_istream
+ * 打开远程文件的输入流。
+ * 数据直接从RETR的数据连接读取，不使用临时文件，也不需要先下载整个文件。
+ * 定位时重新用REST+RETR从新的位置开始读取。
+ * > 输入流在销毁之前独占一个控制连接，销毁ftp文件系统之前需要先销毁它。
+ * > 打开时不等待空闲连接，连接都在使用中时返回NULL。
+ * 输入流打开期间还需要其它操作(如获取同目录下其它文件的信息)时，用ftp_fs_set_max_sessions把连接数设置为2以上。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {const char*} name 远程文件名。
+ * @param {uint64_t} offset 开始读取的位置。
+ *
+ * @return {tk_istream_t*} 返回输入流对象，失败返回NULL。
+ */
+tk_istream_t* ftp_fs_open_istream(fs_t* fs, const char* name, uint64_t offset);
+
+/**
+ * @method ftp_fs_open_ostream
+ * 打开远程文件的输出流。
+ * 立即发出STOR(append为TRUE时用APPE)，写入的数据直接发送到数据连接，不使用临时文件。
+ * 输出流只能顺序写，写完后用ftp_fs_close_ostream结束并检查服务器的回复。
+ * > 输出流在关闭之前独占一个控制连接，销毁ftp文件系统之前需要先销毁它。
+ * > 打开时不等待空闲连接，连接都在使用中时返回NULL。
+ * 输出流打开期间还需要其它操作时，用ftp_fs_set_max_sessions把连接数设置为2以上。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {const char*} name 远程文件名。
+ * @param {bool_t} append 是否追加到文件末尾。
+ *
+ * @return {tk_ostream_t*} 返回输出流对象，失败返回NULL。
+ */
+tk_ostream_t* ftp_fs_open_ostream(fs_t* fs, const char* name, bool_t append);
+
+/**
+ * @method ftp_fs_close_ostream
+ * 结束ftp_fs_open_ostream打开的输出流。
+ * 关闭数据连接并检查服务器的226回复，然后释放控制连接。之后仍然需要用TK_OBJECT_UNREF销毁流对象。
+ * > 没有调用本函数就销毁流对象时，会自动结束，但是无法得到结果。
+ * @param {tk_ostream_t*} stream 输出流对象。
+ *
+ * @return {ret_t} 返回RET_OK表示上传成功，否则表示失败。
+ */
+ret_t ftp_fs_close_ostream(tk_ostream_t* stream);
+
 /**
  * @method ftp_fs_upload_file
  * 上传文件。
+ * > 不预先检查远程目录，服务器因为上级目录不存在而拒绝时，创建上级目录后重新上传。
  * @param {fs_t*} fs ftp文件系统对象。
  * @param {const char*} local_filename 本地文件名。
  * @param {const char*} remote_filename 远程文件名。
@@ -90,6 +525,330 @@ ret_t ftp_fs_download_file(fs_t* fs, const char* remote_filename, const char* lo
  */
 ret_t ftp_fs_upload_file(fs_t* fs, const char* local_filename, const char* remote_filename);
 
+/**
+ * @method ftp_fs_upload_file_ex
+ * 上传文件，每发送一块数据调用一次进度回调。
+ * 回调返回RET_STOP时，关闭数据连接并发送ABOR，读走服务器的回复后立即释放控制连接。
+ * > 被中止时服务器上可能留下不完整的文件，可以用ftp_fs_upload_file_resume继续上传。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {const char*} local_filename 本地文件名。
+ * @param {const char*} remote_filename 远程文件名。
+ * @param {ftp_fs_on_progress_t} on_progress 进度回调函数(在当前线程中调用，可以为NULL)。
+ * @param {void*} ctx 回调函数的上下文。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，RET_STOP表示被中止，否则表示失败。
+ */
+ret_t ftp_fs_upload_file_ex(fs_t* fs, const char* local_filename, const char* remote_filename,
+                            ftp_fs_on_progress_t on_progress, void* ctx);
+
+/**
+ * @method ftp_fs_abort_transfer
+ * 中止ftp_fs_download_file_ex/ftp_fs_upload_file_ex正在进行的传输。
+ * 在其它线程中调用，关闭传输正在使用的数据连接，让阻塞在读写上的传输马上返回失败。
+ * 调用者需要同时让进度回调返回RET_STOP，否则数据连接还没有建立时传输不会停止。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {void*} ctx 传输的进度回调的上下文。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，RET_NOT_FOUND表示没有正在传输数据的连接。
+ */
+ret_t ftp_fs_abort_transfer(fs_t* fs, void* ctx);
+
+/**
+ * @method ftp_fs_upload_file_resume
+ * 断点续传上传文件。
+ * 用SIZE获取远程文件的长度，然后用APPE(不支持时用REST+STOR)上传本地文件剩下的部分。
+ * 如果verify_size不为0，先取回远程文件末尾的verify_size个字节和本地文件比较，
+ * 不一致时重新上传整个文件。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {const char*} local_filename 本地文件名。
+ * @param {const char*} remote_filename 远程文件名。
+ * @param {uint32_t} verify_size 需要校验的重叠字节数(0表示不校验)。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_fs_upload_file_resume(fs_t* fs, const char* local_filename,
+                                const char* remote_filename, uint32_t verify_size);
+
+/**
+ * @method ftp_fs_nb_transfer_create
+ * 创建非阻塞的传输(下载或上传)。
+ * 创建后反复调用ftp_fs_nb_transfer_step推进传输，每次只处理已经到达的回复和数据，不会等待网络，
+ * 适合没有线程的单线程环境，可以在AWTK的idle/timer中驱动多个传输同时进行。
+ * > 建立新的控制连接(TCP连接和登录)和数据连接时仍然会短暂阻塞，所有连接都在使用时会在下一步重试。
+ * > 上传时远程目录必须已经存在。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {bool_t} upload TRUE表示上传，FALSE表示下载。
+ * @param {const char*} remote_filename 远程文件名。
+ * @param {const char*} local_filename 本地文件名。
+ * @param {ftp_fs_on_progress_t} on_progress 进度回调函数(在ftp_fs_nb_transfer_step中调用，可以为NULL)。
+ * @param {void*} ctx 回调函数的上下文。
+ *
+ * @return {ftp_fs_nb_transfer_t*} 返回传输对象，失败返回NULL。
+ */
+ftp_fs_nb_transfer_t* ftp_fs_nb_transfer_create(fs_t* fs, bool_t upload,
+                                                const char* remote_filename,
+                                                const char* local_filename,
+                                                ftp_fs_on_progress_t on_progress, void* ctx);
+
+/**
+ * @method ftp_fs_nb_transfer_step
+ * 推进传输一步，最多收发max_bytes个字节。
+ * @param {ftp_fs_nb_transfer_t*} t 传输对象。
+ * @param {uint32_t} max_bytes 本次最多收发的字节数。
+ *
+ * @return {ret_t} 返回RET_BUSY表示还没有结束，RET_OK表示成功，RET_STOP表示被取消，否则表示失败。
+ */
+ret_t ftp_fs_nb_transfer_step(ftp_fs_nb_transfer_t* t, uint32_t max_bytes);
+
+/**
+ * @method ftp_fs_nb_transfer_cancel
+ * 取消传输。下一次ftp_fs_nb_transfer_step时关闭数据连接，并丢弃控制连接(不等待服务器的回复)。
+ * @param {ftp_fs_nb_transfer_t*} t 传输对象。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_fs_nb_transfer_cancel(ftp_fs_nb_transfer_t* t);
+
+/**
+ * @method ftp_fs_nb_transfer_destroy
+ * 销毁传输对象，没有结束的传输会被取消。
+ * @param {ftp_fs_nb_transfer_t*} t 传输对象。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_fs_nb_transfer_destroy(ftp_fs_nb_transfer_t* t);
+
+/**
+ * @method ftp_fs_download_dir
+ * 下载整个目录树。
+ * 先用MLSD(不支持时用LIST)列出所有文件并创建本地目录，然后由workers个线程并行下载，
+ * 每个线程使用自己的控制连接，所以需要用ftp_fs_set_max_sessions设置足够的连接数。
+ * > 回调函数可能在不同的线程中调用，但不会同时调用。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {const char*} remote_dir 远程目录。
+ * @param {const char*} local_dir 本地目录(不存在时自动创建)。
+ * @param {uint32_t} workers 同时传输的文件数。
+ * @param {ftp_fs_on_progress_t} on_progress 总进度回调函数(可以为NULL)，返回RET_STOP中止所有传输。
+ * @param {ftp_fs_on_file_done_t} on_file_done 单个文件完成的回调函数(可以为NULL)。
+ * @param {void*} ctx 回调函数的上下文。
+ *
+ * @return {ret_t} 返回RET_OK表示全部成功，RET_STOP表示被中止，否则返回最后一个失败文件的结果。
+ */
+ret_t ftp_fs_download_dir(fs_t* fs, const char* remote_dir, const char* local_dir,
+                          uint32_t workers, ftp_fs_on_progress_t on_progress,
+                          ftp_fs_on_file_done_t on_file_done, void* ctx);
+
+/**
+ * @method ftp_fs_upload_dir
+ * 上传整个目录树。
+ * 先用批量MKD创建所有的远程目录，然后由workers个线程并行上传，
+ * 每个线程使用自己的控制连接，所以需要用ftp_fs_set_max_sessions设置足够的连接数。
+ * > 回调函数可能在不同的线程中调用，但不会同时调用。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {const char*} local_dir 本地目录。
+ * @param {const char*} remote_dir 远程目录(不存在时自动创建)。
+ * @param {uint32_t} workers 同时传输的文件数。
+ * @param {ftp_fs_on_progress_t} on_progress 总进度回调函数(可以为NULL)，返回RET_STOP中止所有传输。
+ * @param {ftp_fs_on_file_done_t} on_file_done 单个文件完成的回调函数(可以为NULL)。
+ * @param {void*} ctx 回调函数的上下文。
+ *
+ * @return {ret_t} 返回RET_OK表示全部成功，RET_STOP表示被中止，否则返回最后一个失败文件的结果。
+ */
+ret_t ftp_fs_upload_dir(fs_t* fs, const char* local_dir, const char* remote_dir,
+                        uint32_t workers, ftp_fs_on_progress_t on_progress,
+                        ftp_fs_on_file_done_t on_file_done, void* ctx);
+
+/**
+ * @method ftp_fs_sync
+ * 增量同步目录树。
+ * 列出两边的目录树(远程用MLSD，不支持时用LIST)，按相对路径对应起来，
+ * 只传输目标中没有的文件，以及长度不同或者源文件比目标文件新的文件，传输的方式同ftp_fs_download_dir/ftp_fs_upload_dir。
+ * 所有传输都成功后才删除目标中多余的项。
+ * > 目标目录不存在时自动创建，源目录必须存在。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {const char*} local_dir 本地目录。
+ * @param {const char*} remote_dir 远程目录。
+ * @param {const ftp_fs_sync_options_t*} options 同步选项。
+ *
+ * @return {ret_t} 返回RET_OK表示全部成功，RET_STOP表示被中止，否则表示有操作失败。
+ */
+ret_t ftp_fs_sync(fs_t* fs, const char* local_dir, const char* remote_dir,
+                  const ftp_fs_sync_options_t* options);
+
+/**
+ * @method ftp_fs_stat_many
+ * 批量获取文件信息。
+ * 按上级目录分组，每个目录只用一次MLSD(不支持时用LIST)取回所有文件的信息，
+ * 无法列出的目录才逐个用XSTAT/STAT获取。启用了文件信息缓存时，结果会放入缓存。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {const char**} names 文件名数组。
+ * @param {uint32_t} nr 文件名个数。
+ * @param {fs_stat_info_t*} fsts 用于返回文件信息(nr个)。
+ * @param {ret_t*} rets 用于返回每个文件的结果(nr个，RET_NOT_FOUND表示文件不存在)。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_fs_stat_many(fs_t* fs, const char** names, uint32_t nr, fs_stat_info_t* fsts,
+                       ret_t* rets);
+
+/**
+ * @method ftp_fs_batch
+ * 批量执行删除文件、创建目录、删除目录和重命名操作。
+ * 命令每FTP_FS_BATCH_WINDOW个一组连续发送，然后按顺序匹配回复，每项的结果保存在item的ret和code中。
+ * > 同一组的命令已经发出，stop_on_error只能阻止后续分组的执行，没有执行的项结果为RET_SKIP。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {ftp_fs_batch_item_t*} items 操作数组。
+ * @param {uint32_t} nr 操作个数。
+ * @param {bool_t} stop_on_error 出错时是否停止执行后续的操作。
+ *
+ * @return {ret_t} 返回RET_OK表示全部成功，否则表示有操作失败或没有执行。
+ */
+ret_t ftp_fs_batch(fs_t* fs, ftp_fs_batch_item_t* items, uint32_t nr, bool_t stop_on_error);
+
+/**
+ * @method ftp_fs_set_max_sessions
+ * 设置最大控制连接数。
+ * 连接在需要时才建立，缺省为FTP_FS_DEFAULT_MAX_SESSIONS。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {uint32_t} max_sessions 最大控制连接数。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_fs_set_max_sessions(fs_t* fs, uint32_t max_sessions);
+
+/**
+ * @method ftp_fs_set_transfer_buffer_size
+ * 设置数据传输缓冲区的大小。
+ * 每个控制连接有一个自己的缓冲区，在第一次传输时分配。
+ * 在Linux下，上传和下载文件优先使用sendfile/splice，此时它决定每次系统调用传输的最大字节数。
+ * > 定义FTP_FS_WITHOUT_ZERO_COPY可以禁用sendfile/splice。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {uint32_t} size 缓冲区大小(FTP_FS_MIN_TRANSFER_BUFFER_SIZE到FTP_FS_MAX_TRANSFER_BUFFER_SIZE之间)。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_fs_set_transfer_buffer_size(fs_t* fs, uint32_t size);
+
+/**
+ * @method ftp_fs_set_lazy_read
+ * 设置只读方式打开文件时是否按块读取。
+ * 启用后，以只读方式打开的文件不再先下载整个文件，读取和定位时只用REST+RETR取回用到的块，
+ * 顺序读取时自动预读。缺省不启用。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {bool_t} lazy_read 是否按块读取。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_fs_set_lazy_read(fs_t* fs, bool_t lazy_read);
+
+/**
+ * @method ftp_fs_set_stream_write
+ * 设置以只写方式("w"/"wb"/"a"/"ab")打开文件时是否直接写入数据连接。
+ * 启用后，打开文件时立即发出STOR/APPE，写入的数据直接发送给服务器，关闭文件时检查结果，
+ * 不再先下载原文件到临时文件，关闭时再上传。此时文件只能顺序写，不能读取和随机定位。缺省不启用。
+ * > 这样打开的文件在关闭之前独占一个控制连接，没有空闲连接时打开失败(不会等待)。
+ * 文件打开期间还需要打开其它文件或者调用fs_stat等函数时，用ftp_fs_set_max_sessions把连接数设置为2以上。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {bool_t} stream_write 是否直接写入数据连接。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_fs_set_stream_write(fs_t* fs, bool_t stream_write);
+
+/**
+ * @method ftp_fs_set_cache
+ * 设置本地文件缓存。
+ * 启用后，以只读方式打开的文件会保存在缓存目录中，下次打开时用SIZE和MDTM检查远程文件，
+ * 没有变化就直接使用缓存。缓存总大小超过max_size时删除最久没有使用的文件。
+ * > 服务器不支持MDTM时不使用缓存。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {const char*} dir 缓存目录(为NULL时使用临时目录下的ftp_fs_cache)。
+ * @param {uint32_t} max_size 缓存的最大字节数(0表示不使用缓存)。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_fs_set_cache(fs_t* fs, const char* dir, uint32_t max_size);
+
+/**
+ * @method ftp_fs_set_stat_cache_ttl
+ * 设置文件信息缓存的有效时间。
+ * 启用后，stat/file_exist/dir_exist/get_file_size的结果(包括文件不存在)在有效时间内直接从缓存中返回。
+ * 通过本对象删除、改名、创建目录和上传文件时，相应的缓存会被清除。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {uint32_t} ttl 有效时间(毫秒，0表示不缓存)。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_fs_set_stat_cache_ttl(fs_t* fs, uint32_t ttl);
+
+/**
+ * @method ftp_fs_get_last_error
+ * 获取当前线程最后一次操作的服务器错误(其它线程的操作不会影响结果)。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {int*} code 返回错误码(最后一次操作成功或者本线程还没有操作时为0)。
+ * @param {char*} message 返回错误信息(可以为NULL)。
+ * @param {uint32_t} size message的大小。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_fs_get_last_error(fs_t* fs, int* code, char* message, uint32_t size);
+
+/**
+ * @method ftp_fs_get_round_trips
+ * 获取控制连接上命令往返的总次数(批量操作中连续发送的一组命令算一次)。
+ * 正在使用中的连接的次数在放回连接池时才计入。
+ * @param {fs_t*} fs ftp文件系统对象。
+ *
+ * @return {uint64_t} 返回命令往返的总次数。
+ */
+uint64_t ftp_fs_get_round_trips(fs_t* fs);
+
+/**
+ * @method ftp_fs_set_compress
+ * 设置数据传输的压缩策略。
+ * 服务器支持MODE Z时，下载(RETR)、上传(STOR)和列目录(MLSD/LIST)按策略压缩传输，
+ * 按位置传输的操作(断点续传、分段下载、只上传修改的块等)总是不压缩。
+ * > 下载前不知道文件的长度，FTP_FS_COMPRESS_AUTO只按扩展名判断。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {ftp_fs_compress_t} compress 压缩策略。
+ * @param {const char*} exts FTP_FS_COMPRESS_AUTO时压缩的扩展名(用逗号分隔，NULL表示FTP_FS_DEFAULT_COMPRESS_EXTS)。
+ * @param {uint32_t} min_size FTP_FS_COMPRESS_AUTO时压缩的最小文件长度。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_fs_set_compress(fs_t* fs, ftp_fs_compress_t compress, const char* exts,
+                          uint32_t min_size);
+
+/**
+ * @method ftp_fs_set_hash_type
+ * 设置上传下载文件时使用的校验值。
+ * 服务器支持对应的HASH/XCRC/XSHA256命令时：
+ *
+ * * 本地文件和远程文件长度相同、校验值也相同时跳过传输(目录传输和同步也一样)。
+ * * 传输时同步计算校验值(不再使用零拷贝)，完成后和服务器计算的结果比较，不一致时返回RET_CRC。
+ *
+ * 服务器不支持时和不设置一样。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {ftp_fs_hash_type_t} type 校验值类型(FTP_FS_HASH_NONE表示不使用)。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_fs_set_hash_type(fs_t* fs, ftp_fs_hash_type_t type);
+
+/**
+ * @method ftp_fs_get_remote_hash
+ * 让服务器计算远程文件的校验值。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {const char*} remote_filename 远程文件名。
+ * @param {ftp_fs_hash_type_t} type 校验值类型。
+ * @param {char*} hash 用于返回校验值(小写十六进制字符串)。
+ * @param {uint32_t} size hash的大小(SHA-256需要65个字节)。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，RET_NOT_IMPL表示服务器不支持。
+ */
+ret_t ftp_fs_get_remote_hash(fs_t* fs, const char* remote_filename, ftp_fs_hash_type_t type,
+                             char* hash, uint32_t size);
+
 /**
  * @method ftp_fs_destroy
  * 销毁ftp文件系统。
@@ -0,0 +1,227 @@
+/**
+ * File:   ftp_scheduler.c
+ * Author: AWTK Develop Team
+ * Brief:  ftp transfer scheduler
+ *
+ * Copyright (c) 2026 - 2026  Guangzhou ZHIYUAN Electronics Co.,Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * License file for more details.
+ *
+ */
+
+/**
+ * History:
+ * ================================================================
+ * 2026-10-17 AWTK Develop Team created
+ *
+ */
+
+#include "tkc/mem.h"
+#include "tkc/utils.h"
+#include "awtk_global.h"
+
+#include "ftp_scheduler.h"
+
+/*
+ * 调用者占用了一个并发名额，用它开始排队中优先级最高的传输，没有可以开始的传输时归还名额。
+ * 归还名额之后调度器可能马上被销毁，所以那是最后一次访问调度器。
+ */
+static ret_t ftp_scheduler_run_next(ftp_scheduler_t* scheduler) {
+  while (TRUE) {
+    bool_t started = FALSE;
+    bool_t destroyed = FALSE;
+    ftp_transfer_t* transfer = NULL;
+
+    tk_mutex_lock(scheduler->mutex);
+    if (scheduler->active > scheduler->max_active || scheduler->pending.size == 0) {
+      scheduler->active--;
+      tk_mutex_unlock(scheduler->mutex);
+      return RET_DONE;
+    }
+    transfer = (ftp_transfer_t*)darray_head(&(scheduler->pending));
+    darray_remove_index(&(scheduler->pending), 0);
+    tk_mutex_unlock(scheduler->mutex);
+
+    tk_mutex_lock(transfer->mutex);
+    destroyed = transfer->destroyed;
+    tk_mutex_unlock(transfer->mutex);
+
+    if (!destroyed) {
+      started = ftp_transfer_start(transfer) == RET_OK;
+      if (!started) {
+        log_warn("start transfer of %s failed\n", transfer->remote_filename);
+      }
+    }
+    ftp_transfer_unref(transfer);
+
+    if (started) {
+      return RET_OK;
+    }
+  }
+
+  return RET_OK;
+}
+
+/*在并发数没有达到上限时开始排队中的传输。*/
+static ret_t ftp_scheduler_dispatch(ftp_scheduler_t* scheduler) {
+  while (TRUE) {
+    bool_t has_slot = FALSE;
+
+    tk_mutex_lock(scheduler->mutex);
+    if (scheduler->active < scheduler->max_active && scheduler->pending.size > 0) {
+      scheduler->active++;
+      has_slot = TRUE;
+    }
+    tk_mutex_unlock(scheduler->mutex);
+
+    if (!has_slot || ftp_scheduler_run_next(scheduler) != RET_OK) {
+      break;
+    }
+  }
+
+  return RET_OK;
+}
+
+static ret_t ftp_scheduler_on_ui_run_next(void* ctx) {
+  ftp_scheduler_run_next((ftp_scheduler_t*)ctx);
+
+  return RET_OK;
+}
+
+/*
+ * 在传输的工作线程(非阻塞模式下在定时器)中调用，结束的传输把名额直接交给下一个传输。
+ * 下一个传输可能是非阻塞的，它的定时器只能在主循环中添加，所以工作线程把交接投递到主循环。
+ * 投递期间名额仍然被占用，调度器不会被销毁。
+ */
+static ret_t ftp_scheduler_on_finished(void* ctx, ftp_transfer_t* transfer) {
+  ftp_scheduler_t* scheduler = (ftp_scheduler_t*)ctx;
+
+  if (!transfer->non_blocking) {
+    if (tk_run_in_ui_thread(ftp_scheduler_on_ui_run_next, scheduler, FALSE) == RET_OK) {
+      return RET_OK;
+    }
+    log_warn("post to ui thread failed, start next transfer in worker thread\n");
+  }
+
+  return ftp_scheduler_run_next(scheduler);
+}
+
+ftp_scheduler_t* ftp_scheduler_create(uint32_t max_active) {
+  ftp_scheduler_t* scheduler = TKMEM_ZALLOC(ftp_scheduler_t);
+  return_value_if_fail(scheduler != NULL, NULL);
+
+  scheduler->max_active = tk_max(max_active, 1);
+  scheduler->mutex = tk_mutex_create();
+  darray_init(&(scheduler->pending), 10, NULL, NULL);
+  ftp_rate_limit_init(&(scheduler->rate_limit), TRUE);
+  goto_error_if_fail(scheduler->mutex != NULL && scheduler->rate_limit.mutex != NULL);
+
+  return scheduler;
+error:
+  if (scheduler->mutex != NULL) {
+    tk_mutex_destroy(scheduler->mutex);
+  }
+  ftp_rate_limit_deinit(&(scheduler->rate_limit));
+  darray_deinit(&(scheduler->pending));
+  TKMEM_FREE(scheduler);
+
+  return NULL;
+}
+
+ret_t ftp_scheduler_set_max_active(ftp_scheduler_t* scheduler, uint32_t max_active) {
+  return_value_if_fail(scheduler != NULL, RET_BAD_PARAMS);
+
+  tk_mutex_lock(scheduler->mutex);
+  scheduler->max_active = tk_max(max_active, 1);
+  tk_mutex_unlock(scheduler->mutex);
+
+  return ftp_scheduler_dispatch(scheduler);
+}
+
+ret_t ftp_scheduler_set_rate_limit(ftp_scheduler_t* scheduler, uint32_t rate) {
+  return_value_if_fail(scheduler != NULL, RET_BAD_PARAMS);
+
+  return ftp_rate_limit_set_rate(&(scheduler->rate_limit), rate);
+}
+
+ret_t ftp_scheduler_submit(ftp_scheduler_t* scheduler, ftp_transfer_t* transfer, int32_t priority) {
+  uint32_t i = 0;
+  ret_t ret = RET_OK;
+  return_value_if_fail(scheduler != NULL && transfer != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(transfer->thread == NULL && transfer->nb == NULL, RET_BUSY);
+
+  transfer->priority = priority;
+  transfer->shared_rate_limit = &(scheduler->rate_limit);
+  transfer->on_finished = ftp_scheduler_on_finished;
+  transfer->on_finished_ctx = scheduler;
+  ftp_transfer_ref(transfer);
+
+  tk_mutex_lock(scheduler->mutex);
+  for (i = 0; i < scheduler->pending.size; i++) {
+    ftp_transfer_t* iter = (ftp_transfer_t*)darray_get(&(scheduler->pending), i);
+    if (iter->priority < priority) {
+      break;
+    }
+  }
+  ret = darray_insert(&(scheduler->pending), i, transfer);
+  tk_mutex_unlock(scheduler->mutex);
+
+  if (ret != RET_OK) {
+    ftp_transfer_unref(transfer);
+    return ret;
+  }
+
+  return ftp_scheduler_dispatch(scheduler);
+}
+
+uint32_t ftp_scheduler_get_pending_count(ftp_scheduler_t* scheduler) {
+  uint32_t count = 0;
+  return_value_if_fail(scheduler != NULL, 0);
+
+  tk_mutex_lock(scheduler->mutex);
+  count = scheduler->pending.size;
+  tk_mutex_unlock(scheduler->mutex);
+
+  return count;
+}
+
+uint32_t ftp_scheduler_get_active_count(ftp_scheduler_t* scheduler) {
+  uint32_t count = 0;
+  return_value_if_fail(scheduler != NULL, 0);
+
+  tk_mutex_lock(scheduler->mutex);
+  count = scheduler->active;
+  tk_mutex_unlock(scheduler->mutex);
+
+  return count;
+}
+
+ret_t ftp_scheduler_destroy(ftp_scheduler_t* scheduler) {
+  uint32_t i = 0;
+  return_value_if_fail(scheduler != NULL, RET_BAD_PARAMS);
+
+  tk_mutex_lock(scheduler->mutex);
+  if (scheduler->active > 0) {
+    tk_mutex_unlock(scheduler->mutex);
+    log_warn("%u transfers are still running\n", scheduler->active);
+    return RET_BUSY;
+  }
+
+  for (i = 0; i < scheduler->pending.size; i++) {
+    ftp_transfer_t* iter = (ftp_transfer_t*)darray_get(&(scheduler->pending), i);
+    iter->on_finished = NULL;
+    iter->shared_rate_limit = NULL;
+    ftp_transfer_unref(iter);
+  }
+  darray_deinit(&(scheduler->pending));
+  tk_mutex_unlock(scheduler->mutex);
+
+  ftp_rate_limit_deinit(&(scheduler->rate_limit));
+  tk_mutex_destroy(scheduler->mutex);
+  TKMEM_FREE(scheduler);
+
+  return RET_OK;
+}
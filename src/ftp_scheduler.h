@@ -0,0 +1,145 @@
+/**
+ * File:   ftp_scheduler.h
+ * Author: AWTK Develop Team
+ * Brief:  ftp transfer scheduler
+ *
+ * Copyright (c) 2026 - 2026  Guangzhou ZHIYUAN Electronics Co.,Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * License file for more details.
+ *
+ */
+
+/**
+ * History:
+ * ================================================================
+ * 2026-10-17 AWTK Develop Team created
+ *
+ */
+
+#ifndef TK_FTP_SCHEDULER_H
+#define TK_FTP_SCHEDULER_H
+
+#include "tkc/darray.h"
+#include "ftp_transfer.h"
+
+BEGIN_C_DECLS
+
+/**
+ * @const FTP_SCHEDULER_PRIORITY_BULK
+ * 批量传输(如同步、上传日志)的优先级。
+ */
+#define FTP_SCHEDULER_PRIORITY_BULK 0
+
+/**
+ * @const FTP_SCHEDULER_PRIORITY_NORMAL
+ * 普通传输的优先级。
+ */
+#define FTP_SCHEDULER_PRIORITY_NORMAL 50
+
+/**
+ * @const FTP_SCHEDULER_PRIORITY_INTERACTIVE
+ * 交互操作(如用户打开文件)的优先级。
+ */
+#define FTP_SCHEDULER_PRIORITY_INTERACTIVE 100
+
+/**
+ * @class ftp_scheduler_t
+ * 传输调度器。
+ *
+ * 提交的传输按优先级排队(优先级相同时先提交的先开始)，同时进行的传输(数据连接)不超过max_active个，
+ * 一个传输结束后立即开始队列中优先级最高的传输。
+ * 除了每个传输自己的限速(ftp_transfer_set_rate_limit)，还可以限制所有传输的总速度。
+ *
+ * > 传输开始后不会被抢占，需要为交互操作留出连接时，可以让批量传输使用单独的调度器并限制并发数。
+ */
+typedef struct _ftp_scheduler_t {
+  /**
+   * @property {uint32_t} max_active
+   * 同时进行的最大传输数。
+   */
+  uint32_t max_active;
+
+  /*private*/
+  tk_mutex_t* mutex;
+  darray_t pending;
+  uint32_t active;
+  ftp_rate_limit_t rate_limit;
+} ftp_scheduler_t;
+
+/**
+ * @method ftp_scheduler_create
+ * 创建传输调度器。
+ * @param {uint32_t} max_active 同时进行的最大传输数(一般不超过ftp_fs_set_max_sessions设置的连接数)。
+ *
+ * @return {ftp_scheduler_t*} 返回调度器对象，失败返回NULL。
+ */
+ftp_scheduler_t* ftp_scheduler_create(uint32_t max_active);
+
+/**
+ * @method ftp_scheduler_set_max_active
+ * 设置同时进行的最大传输数。
+ * @param {ftp_scheduler_t*} scheduler 调度器对象。
+ * @param {uint32_t} max_active 同时进行的最大传输数。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_scheduler_set_max_active(ftp_scheduler_t* scheduler, uint32_t max_active);
+
+/**
+ * @method ftp_scheduler_set_rate_limit
+ * 设置所有传输每秒最多传输的总字节数。
+ * @param {ftp_scheduler_t*} scheduler 调度器对象。
+ * @param {uint32_t} rate 每秒最多传输的字节数(0表示不限速)。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_scheduler_set_rate_limit(ftp_scheduler_t* scheduler, uint32_t rate);
+
+/**
+ * @method ftp_scheduler_submit
+ * 提交一个还没有开始的传输。
+ * 调度器持有传输对象直到它开始，调用者仍然需要在完成后用ftp_transfer_destroy销毁它。
+ * 排队时被销毁的传输不会开始，也不会回调完成函数。
+ * 阻塞模式的传输结束后，由主循环开始下一个排队的传输，所以需要运行主循环。
+ * @param {ftp_scheduler_t*} scheduler 调度器对象。
+ * @param {ftp_transfer_t*} transfer 传输对象。
+ * @param {int32_t} priority 优先级(数值越大越先开始)。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_scheduler_submit(ftp_scheduler_t* scheduler, ftp_transfer_t* transfer, int32_t priority);
+
+/**
+ * @method ftp_scheduler_get_pending_count
+ * 获取排队中的传输数。
+ * @param {ftp_scheduler_t*} scheduler 调度器对象。
+ *
+ * @return {uint32_t} 返回排队中的传输数。
+ */
+uint32_t ftp_scheduler_get_pending_count(ftp_scheduler_t* scheduler);
+
+/**
+ * @method ftp_scheduler_get_active_count
+ * 获取正在进行的传输数。
+ * @param {ftp_scheduler_t*} scheduler 调度器对象。
+ *
+ * @return {uint32_t} 返回正在进行的传输数。
+ */
+uint32_t ftp_scheduler_get_active_count(ftp_scheduler_t* scheduler);
+
+/**
+ * @method ftp_scheduler_destroy
+ * 销毁调度器。排队中的传输被丢弃(不会开始)。
+ * > 正在进行的传输结束时会通知调度器，所以必须等它们都结束(或被销毁)后才能销毁调度器。
+ * @param {ftp_scheduler_t*} scheduler 调度器对象。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，RET_BUSY表示还有传输没有结束。
+ */
+ret_t ftp_scheduler_destroy(ftp_scheduler_t* scheduler);
+
+END_C_DECLS
+
+#endif /*TK_FTP_SCHEDULER_H*/
@@ -0,0 +1,616 @@
+/**
+ * File:   ftp_transfer.c
+ * Author: AWTK Develop Team
+ * Brief:  asynchronous ftp transfer
+ *
+ * Copyright (c) 2026 - 2026  Guangzhou ZHIYUAN Electronics Co.,Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * License file for more details.
+ *
+ */
+
+/**
+ * History:
+ * ================================================================
+ * 2026-10-17 AWTK Develop Team created
+ *
+ */
+
+#include "tkc/mem.h"
+#include "tkc/utils.h"
+#include "tkc/mutex.h"
+#include "tkc/platform.h"
+#include "tkc/time_now.h"
+#include "awtk_global.h"
+#include "base/timer.h"
+
+#include "ftp_transfer.h"
+
+#define FTP_TRANSFER_MAX_SLEEP 100
+
+ftp_rate_limit_t* ftp_rate_limit_init(ftp_rate_limit_t* limit, bool_t shared) {
+  return_value_if_fail(limit != NULL, NULL);
+
+  memset(limit, 0x00, sizeof(*limit));
+  if (shared) {
+    limit->mutex = tk_mutex_create();
+  }
+
+  return limit;
+}
+
+/*不共享的限速器没有锁。*/
+static ret_t ftp_rate_limit_lock(ftp_rate_limit_t* limit) {
+  return limit->mutex != NULL ? tk_mutex_lock(limit->mutex) : RET_OK;
+}
+
+static ret_t ftp_rate_limit_unlock(ftp_rate_limit_t* limit) {
+  return limit->mutex != NULL ? tk_mutex_unlock(limit->mutex) : RET_OK;
+}
+
+ret_t ftp_rate_limit_set_rate(ftp_rate_limit_t* limit, uint32_t rate) {
+  return_value_if_fail(limit != NULL, RET_BAD_PARAMS);
+
+  ftp_rate_limit_lock(limit);
+  limit->rate = rate;
+  limit->tokens = rate;
+  limit->last_time = time_now_ms();
+  ftp_rate_limit_unlock(limit);
+
+  return RET_OK;
+}
+
+/*调用者需要持有锁。*/
+static ret_t ftp_rate_limit_refill(ftp_rate_limit_t* limit) {
+  uint64_t now = time_now_ms();
+
+  if (now > limit->last_time) {
+    limit->tokens += (int64_t)(now - limit->last_time) * limit->rate / 1000;
+    limit->tokens = tk_min(limit->tokens, (int64_t)(limit->rate));
+    limit->last_time = now;
+  }
+
+  return RET_OK;
+}
+
+uint32_t ftp_rate_limit_consume(ftp_rate_limit_t* limit, uint32_t size) {
+  uint32_t wait = 0;
+  return_value_if_fail(limit != NULL, 0);
+
+  ftp_rate_limit_lock(limit);
+  if (limit->rate > 0) {
+    ftp_rate_limit_refill(limit);
+    limit->tokens -= size;
+    if (limit->tokens < 0) {
+      wait = (uint32_t)(-limit->tokens * 1000 / limit->rate);
+    }
+  }
+  ftp_rate_limit_unlock(limit);
+
+  return wait;
+}
+
+uint32_t ftp_rate_limit_get_available(ftp_rate_limit_t* limit, uint32_t max_size) {
+  uint32_t available = max_size;
+  return_value_if_fail(limit != NULL, max_size);
+
+  ftp_rate_limit_lock(limit);
+  if (limit->rate > 0) {
+    ftp_rate_limit_refill(limit);
+    available = limit->tokens > 0 ? (uint32_t)tk_min(limit->tokens, (int64_t)max_size) : 0;
+  }
+  ftp_rate_limit_unlock(limit);
+
+  return available;
+}
+
+ret_t ftp_rate_limit_deinit(ftp_rate_limit_t* limit) {
+  return_value_if_fail(limit != NULL, RET_BAD_PARAMS);
+
+  if (limit->mutex != NULL) {
+    tk_mutex_destroy(limit->mutex);
+    limit->mutex = NULL;
+  }
+
+  return RET_OK;
+}
+
+static bool_t ftp_transfer_is_cancelled(ftp_transfer_t* transfer) {
+  bool_t cancelled = FALSE;
+
+  tk_mutex_lock(transfer->mutex);
+  cancelled = transfer->cancelled;
+  tk_mutex_unlock(transfer->mutex);
+
+  return cancelled;
+}
+
+/*按自己和调度器的限速扣除这次传输的字节数，返回需要等待的毫秒数。*/
+static uint32_t ftp_transfer_consume(ftp_transfer_t* transfer, uint64_t done) {
+  uint32_t wait = 0;
+  uint32_t size = (uint32_t)(done - transfer->last_done);
+
+  transfer->last_done = done;
+  wait = ftp_rate_limit_consume(&(transfer->rate_limit), size);
+  if (transfer->shared_rate_limit != NULL) {
+    wait = tk_max(wait, ftp_rate_limit_consume(transfer->shared_rate_limit, size));
+  }
+
+  return wait;
+}
+
+static ret_t ftp_transfer_join(ftp_transfer_t* transfer) {
+  bool_t join = FALSE;
+
+  tk_mutex_lock(transfer->mutex);
+  join = transfer->thread != NULL && !transfer->joined;
+  transfer->joined = TRUE;
+  tk_mutex_unlock(transfer->mutex);
+
+  if (join) {
+    tk_thread_join(transfer->thread);
+  }
+
+  return RET_OK;
+}
+
+ftp_transfer_t* ftp_transfer_ref(ftp_transfer_t* transfer) {
+  return_value_if_fail(transfer != NULL, NULL);
+
+  tk_mutex_lock(transfer->mutex);
+  transfer->refcount++;
+  tk_mutex_unlock(transfer->mutex);
+
+  return transfer;
+}
+
+ret_t ftp_transfer_unref(ftp_transfer_t* transfer) {
+  int32_t refcount = 0;
+  return_value_if_fail(transfer != NULL, RET_BAD_PARAMS);
+
+  tk_mutex_lock(transfer->mutex);
+  refcount = --transfer->refcount;
+  tk_mutex_unlock(transfer->mutex);
+
+  if (refcount == 0) {
+    if (transfer->thread != NULL) {
+      /*工作线程的引用在主循环中释放，只有投递失败时最后的引用才在工作线程中释放，这时不能等待自己。*/
+      if (tk_thread_self() != transfer->thread_id) {
+        ftp_transfer_join(transfer);
+        tk_thread_destroy(transfer->thread);
+      } else {
+        log_warn("transfer released in its own thread, thread object leaked\n");
+      }
+    }
+    if (transfer->nb != NULL) {
+      ftp_fs_nb_transfer_destroy(transfer->nb);
+    }
+    ftp_rate_limit_deinit(&(transfer->rate_limit));
+    tk_mutex_destroy(transfer->mutex);
+    TKMEM_FREE(transfer->remote_filename);
+    TKMEM_FREE(transfer->local_filename);
+    TKMEM_FREE(transfer);
+  }
+
+  return RET_OK;
+}
+
+static ret_t ftp_transfer_call_on_progress(ftp_transfer_t* transfer) {
+  ret_t ret = RET_OK;
+  ftp_transfer_on_event_t on_progress = NULL;
+
+  tk_mutex_lock(transfer->mutex);
+  transfer->progress_pending = FALSE;
+  if (!transfer->destroyed) {
+    on_progress = transfer->on_progress;
+  }
+  tk_mutex_unlock(transfer->mutex);
+
+  if (on_progress != NULL) {
+    ret = on_progress(transfer->on_progress_ctx, transfer);
+    if (ret == RET_STOP) {
+      ftp_transfer_cancel(transfer);
+    }
+  }
+
+  return ret;
+}
+
+static ret_t ftp_transfer_call_on_done(ftp_transfer_t* transfer) {
+  ftp_transfer_on_event_t on_done = NULL;
+
+  tk_mutex_lock(transfer->mutex);
+  if (!transfer->destroyed) {
+    on_done = transfer->on_done;
+  }
+  tk_mutex_unlock(transfer->mutex);
+
+  if (on_done != NULL) {
+    on_done(transfer->on_done_ctx, transfer);
+  }
+
+  return RET_OK;
+}
+
+static ret_t ftp_transfer_on_ui_progress(void* ctx) {
+  ftp_transfer_t* transfer = (ftp_transfer_t*)ctx;
+
+  ftp_transfer_call_on_progress(transfer);
+  ftp_transfer_unref(transfer);
+
+  return RET_OK;
+}
+
+static ret_t ftp_transfer_on_ui_release(void* ctx) {
+  return ftp_transfer_unref((ftp_transfer_t*)ctx);
+}
+
+static ret_t ftp_transfer_on_ui_done(void* ctx) {
+  ftp_transfer_t* transfer = (ftp_transfer_t*)ctx;
+
+  ftp_transfer_call_on_done(transfer);
+  ftp_transfer_unref(transfer);
+
+  return RET_OK;
+}
+
+/*投递到主循环的事件持有一个引用，保证执行时对象仍然存在。*/
+static ret_t ftp_transfer_post(ftp_transfer_t* transfer, tk_callback_t func) {
+  ftp_transfer_ref(transfer);
+
+  if (tk_run_in_ui_thread(func, transfer, FALSE) != RET_OK) {
+    ftp_transfer_unref(transfer);
+    return RET_FAIL;
+  }
+
+  return RET_OK;
+}
+
+static ret_t ftp_transfer_on_fs_progress(void* ctx, uint64_t done, uint64_t total) {
+  uint32_t wait = 0;
+  bool_t post = FALSE;
+  bool_t notify = FALSE;
+  ftp_transfer_t* transfer = (ftp_transfer_t*)ctx;
+
+  tk_mutex_lock(transfer->mutex);
+  transfer->done = done;
+  transfer->total = total;
+  notify = transfer->on_progress != NULL;
+  if (notify && transfer->post_to_ui) {
+    /*前一个进度事件还没有执行时不再投递，执行时读取最新的进度。*/
+    post = !transfer->progress_pending;
+    transfer->progress_pending = TRUE;
+  }
+  tk_mutex_unlock(transfer->mutex);
+
+  if (post) {
+    ftp_transfer_post(transfer, ftp_transfer_on_ui_progress);
+  } else if (notify && !transfer->post_to_ui) {
+    ftp_transfer_call_on_progress(transfer);
+  }
+
+  /*超过限速时在工作线程中等待，分段等待以便及时响应取消。*/
+  wait = ftp_transfer_consume(transfer, done);
+  while (wait > 0 && !ftp_transfer_is_cancelled(transfer)) {
+    uint32_t ms = tk_min(wait, FTP_TRANSFER_MAX_SLEEP);
+    sleep_ms(ms);
+    wait -= ms;
+  }
+
+  return ftp_transfer_is_cancelled(transfer) ? RET_STOP : RET_OK;
+}
+
+static void* ftp_transfer_thread_entry(void* args) {
+  ret_t ret = RET_STOP;
+  bool_t cancelled = FALSE;
+  ftp_transfer_t* transfer = (ftp_transfer_t*)args;
+
+  tk_mutex_lock(transfer->mutex);
+  cancelled = transfer->cancelled;
+  transfer->thread_id = tk_thread_self();
+  transfer->state = FTP_TRANSFER_RUNNING;
+  tk_mutex_unlock(transfer->mutex);
+
+  if (!cancelled) {
+    transfer->last_done = 0;
+    if (transfer->type == FTP_TRANSFER_DOWNLOAD) {
+      ret = ftp_fs_download_file_ex(transfer->fs, transfer->remote_filename,
+                                    transfer->local_filename, ftp_transfer_on_fs_progress,
+                                    transfer);
+    } else {
+      ret = ftp_fs_upload_file_ex(transfer->fs, transfer->local_filename,
+                                  transfer->remote_filename, ftp_transfer_on_fs_progress,
+                                  transfer);
+    }
+  }
+
+  tk_mutex_lock(transfer->mutex);
+  /*取消时数据连接被关闭，读写可能以连接结束或者IO错误返回。*/
+  transfer->ret = transfer->cancelled ? RET_STOP : ret;
+  transfer->state = FTP_TRANSFER_DONE;
+  tk_mutex_unlock(transfer->mutex);
+
+  if (transfer->on_finished != NULL) {
+    transfer->on_finished(transfer->on_finished_ctx, transfer);
+  }
+
+  if (transfer->post_to_ui) {
+    ftp_transfer_post(transfer, ftp_transfer_on_ui_done);
+  } else {
+    ftp_transfer_call_on_done(transfer);
+  }
+
+  /*释放ftp_transfer_start为工作线程增加的引用，最后一个引用需要在其它线程中等待本线程退出。*/
+  if (tk_run_in_ui_thread(ftp_transfer_on_ui_release, transfer, FALSE) != RET_OK) {
+    ftp_transfer_unref(transfer);
+  }
+
+  return NULL;
+}
+
+static ret_t ftp_transfer_on_nb_progress(void* ctx, uint64_t done, uint64_t total) {
+  ftp_transfer_t* transfer = (ftp_transfer_t*)ctx;
+
+  tk_mutex_lock(transfer->mutex);
+  transfer->done = done;
+  transfer->total = total;
+  tk_mutex_unlock(transfer->mutex);
+
+  /*非阻塞模式下不能等待，透支的令牌让后面的定时器少传一些。*/
+  ftp_transfer_consume(transfer, done);
+
+  /*定时器就在主循环中执行，直接回调。*/
+  ftp_transfer_call_on_progress(transfer);
+
+  return transfer->cancelled ? RET_STOP : RET_OK;
+}
+
+static ret_t ftp_transfer_on_timer(const timer_info_t* info) {
+  ret_t ret = RET_OK;
+  uint32_t max_bytes = 0;
+  ftp_transfer_t* transfer = (ftp_transfer_t*)(info->ctx);
+
+  if (transfer->cancelled) {
+    ftp_fs_nb_transfer_cancel(transfer->nb);
+  }
+
+  max_bytes = ftp_rate_limit_get_available(&(transfer->rate_limit), FTP_TRANSFER_TICK_BYTES);
+  if (transfer->shared_rate_limit != NULL) {
+    max_bytes = ftp_rate_limit_get_available(transfer->shared_rate_limit, max_bytes);
+  }
+
+  ret = ftp_fs_nb_transfer_step(transfer->nb, max_bytes);
+  if (ret == RET_BUSY) {
+    return RET_REPEAT;
+  }
+
+  tk_mutex_lock(transfer->mutex);
+  transfer->ret = ret;
+  transfer->state = FTP_TRANSFER_DONE;
+  transfer->timer_id = TK_INVALID_ID;
+  tk_mutex_unlock(transfer->mutex);
+
+  if (transfer->on_finished != NULL) {
+    transfer->on_finished(transfer->on_finished_ctx, transfer);
+  }
+
+  /*完成回调中可能销毁传输对象，之后不能再访问它。*/
+  ftp_transfer_call_on_done(transfer);
+
+  return RET_REMOVE;
+}
+
+static ret_t ftp_transfer_start_non_blocking(ftp_transfer_t* transfer) {
+  transfer->nb = ftp_fs_nb_transfer_create(
+      transfer->fs, transfer->type == FTP_TRANSFER_UPLOAD, transfer->remote_filename,
+      transfer->local_filename, ftp_transfer_on_nb_progress, transfer);
+  return_value_if_fail(transfer->nb != NULL, RET_OOM);
+
+  transfer->state = FTP_TRANSFER_RUNNING;
+  transfer->timer_id = timer_add(ftp_transfer_on_timer, transfer, FTP_TRANSFER_TICK_INTERVAL);
+  if (transfer->timer_id == TK_INVALID_ID) {
+    ftp_fs_nb_transfer_destroy(transfer->nb);
+    transfer->nb = NULL;
+    transfer->state = FTP_TRANSFER_PENDING;
+    return RET_FAIL;
+  }
+
+  return RET_OK;
+}
+
+ftp_transfer_t* ftp_transfer_create(fs_t* fs, ftp_transfer_type_t type,
+                                    const char* remote_filename, const char* local_filename) {
+  ftp_transfer_t* transfer = NULL;
+  return_value_if_fail(FTP_FS(fs) != NULL, NULL);
+  return_value_if_fail(remote_filename != NULL && local_filename != NULL, NULL);
+
+  transfer = TKMEM_ZALLOC(ftp_transfer_t);
+  return_value_if_fail(transfer != NULL, NULL);
+
+  transfer->fs = fs;
+  transfer->type = type;
+  transfer->refcount = 1;
+  transfer->ret = RET_BUSY;
+  transfer->state = FTP_TRANSFER_PENDING;
+  transfer->mutex = tk_mutex_create();
+  /*传输过程中也可以修改限速，工作线程同时在扣除令牌，所以限速器需要加锁。*/
+  ftp_rate_limit_init(&(transfer->rate_limit), TRUE);
+  transfer->remote_filename = tk_strdup(remote_filename);
+  transfer->local_filename = tk_strdup(local_filename);
+  goto_error_if_fail(transfer->mutex != NULL && transfer->rate_limit.mutex != NULL);
+  goto_error_if_fail(transfer->remote_filename != NULL && transfer->local_filename != NULL);
+
+  return transfer;
+error:
+  if (transfer->mutex != NULL) {
+    tk_mutex_destroy(transfer->mutex);
+  }
+  ftp_rate_limit_deinit(&(transfer->rate_limit));
+  TKMEM_FREE(transfer->remote_filename);
+  TKMEM_FREE(transfer->local_filename);
+  TKMEM_FREE(transfer);
+
+  return NULL;
+}
+
+ret_t ftp_transfer_set_on_progress(ftp_transfer_t* transfer, ftp_transfer_on_event_t on_progress,
+                                   void* ctx) {
+  return_value_if_fail(transfer != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(transfer->thread == NULL && transfer->nb == NULL, RET_BUSY);
+
+  transfer->on_progress = on_progress;
+  transfer->on_progress_ctx = ctx;
+
+  return RET_OK;
+}
+
+ret_t ftp_transfer_set_on_done(ftp_transfer_t* transfer, ftp_transfer_on_event_t on_done,
+                               void* ctx) {
+  return_value_if_fail(transfer != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(transfer->thread == NULL && transfer->nb == NULL, RET_BUSY);
+
+  transfer->on_done = on_done;
+  transfer->on_done_ctx = ctx;
+
+  return RET_OK;
+}
+
+ret_t ftp_transfer_set_post_to_ui(ftp_transfer_t* transfer, bool_t post_to_ui) {
+  return_value_if_fail(transfer != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(transfer->thread == NULL && transfer->nb == NULL, RET_BUSY);
+
+  transfer->post_to_ui = post_to_ui;
+
+  return RET_OK;
+}
+
+ret_t ftp_transfer_set_non_blocking(ftp_transfer_t* transfer, bool_t non_blocking) {
+  return_value_if_fail(transfer != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(transfer->thread == NULL && transfer->nb == NULL, RET_BUSY);
+
+  transfer->non_blocking = non_blocking;
+
+  return RET_OK;
+}
+
+ret_t ftp_transfer_set_rate_limit(ftp_transfer_t* transfer, uint32_t rate) {
+  return_value_if_fail(transfer != NULL, RET_BAD_PARAMS);
+
+  return ftp_rate_limit_set_rate(&(transfer->rate_limit), rate);
+}
+
+ret_t ftp_transfer_start(ftp_transfer_t* transfer) {
+  return_value_if_fail(transfer != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(transfer->thread == NULL && transfer->nb == NULL, RET_BUSY);
+
+  if (transfer->non_blocking) {
+    return ftp_transfer_start_non_blocking(transfer);
+  }
+
+  transfer->thread = tk_thread_create(ftp_transfer_thread_entry, transfer);
+  return_value_if_fail(transfer->thread != NULL, RET_OOM);
+
+  /*工作线程持有一个引用，销毁时不用等待它退出。*/
+  ftp_transfer_ref(transfer);
+  tk_thread_set_name(transfer->thread, "ftp_transfer");
+  if (tk_thread_start(transfer->thread) != RET_OK) {
+    tk_thread_destroy(transfer->thread);
+    transfer->thread = NULL;
+    ftp_transfer_unref(transfer);
+    return RET_FAIL;
+  }
+
+  return RET_OK;
+}
+
+ret_t ftp_transfer_cancel(ftp_transfer_t* transfer) {
+  bool_t running = FALSE;
+  return_value_if_fail(transfer != NULL, RET_BAD_PARAMS);
+
+  tk_mutex_lock(transfer->mutex);
+  transfer->cancelled = TRUE;
+  running = transfer->thread != NULL && transfer->state == FTP_TRANSFER_RUNNING;
+  tk_mutex_unlock(transfer->mutex);
+
+  /*关闭工作线程正在使用的数据连接，阻塞的读写马上返回。*/
+  if (running) {
+    ftp_fs_abort_transfer(transfer->fs, transfer);
+  }
+
+  return RET_OK;
+}
+
+ret_t ftp_transfer_wait(ftp_transfer_t* transfer) {
+  return_value_if_fail(transfer != NULL && transfer->thread != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(!transfer->non_blocking, RET_NOT_IMPL);
+
+  ftp_transfer_join(transfer);
+
+  return ftp_transfer_get_result(transfer);
+}
+
+ftp_transfer_state_t ftp_transfer_get_state(ftp_transfer_t* transfer) {
+  ftp_transfer_state_t state = FTP_TRANSFER_PENDING;
+  return_value_if_fail(transfer != NULL, FTP_TRANSFER_PENDING);
+
+  tk_mutex_lock(transfer->mutex);
+  state = transfer->state;
+  tk_mutex_unlock(transfer->mutex);
+
+  return state;
+}
+
+ret_t ftp_transfer_get_progress(ftp_transfer_t* transfer, uint64_t* done, uint64_t* total) {
+  return_value_if_fail(transfer != NULL && done != NULL && total != NULL, RET_BAD_PARAMS);
+
+  tk_mutex_lock(transfer->mutex);
+  *done = transfer->done;
+  *total = transfer->total;
+  tk_mutex_unlock(transfer->mutex);
+
+  return RET_OK;
+}
+
+ret_t ftp_transfer_get_result(ftp_transfer_t* transfer) {
+  ret_t ret = RET_BUSY;
+  return_value_if_fail(transfer != NULL, RET_BAD_PARAMS);
+
+  tk_mutex_lock(transfer->mutex);
+  ret = transfer->ret;
+  tk_mutex_unlock(transfer->mutex);
+
+  return ret;
+}
+
+ret_t ftp_transfer_destroy(ftp_transfer_t* transfer) {
+  return_value_if_fail(transfer != NULL, RET_BAD_PARAMS);
+
+  tk_mutex_lock(transfer->mutex);
+  transfer->destroyed = TRUE;
+  tk_mutex_unlock(transfer->mutex);
+  ftp_transfer_cancel(transfer);
+
+  if (transfer->timer_id != TK_INVALID_ID) {
+    timer_remove(transfer->timer_id);
+    transfer->timer_id = TK_INVALID_ID;
+
+    /*正在进行的非阻塞传输不会再从定时器中结束，在这里释放连接并通知调度器归还名额。*/
+    ftp_fs_nb_transfer_destroy(transfer->nb);
+    transfer->nb = NULL;
+
+    tk_mutex_lock(transfer->mutex);
+    transfer->ret = RET_STOP;
+    transfer->state = FTP_TRANSFER_DONE;
+    tk_mutex_unlock(transfer->mutex);
+
+    if (transfer->on_finished != NULL) {
+      transfer->on_finished(transfer->on_finished_ctx, transfer);
+    }
+  }
+
+  /*不等待工作线程，它持有自己的引用，退出后释放。*/
+  return ftp_transfer_unref(transfer);
+}
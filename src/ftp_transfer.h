@@ -0,0 +1,395 @@
+/**
+ * File:   ftp_transfer.h
+ * Author: AWTK Develop Team
+ * Brief:  asynchronous ftp transfer
+ *
+ * Copyright (c) 2026 - 2026  Guangzhou ZHIYUAN Electronics Co.,Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * License file for more details.
+ *
+ */
+
+/**
+ * History:
+ * ================================================================
+ * 2026-10-17 AWTK Develop Team created
+ *
+ */
+
+#ifndef TK_FTP_TRANSFER_H
+#define TK_FTP_TRANSFER_H
+
+#include "tkc/mutex.h"
+#include "tkc/thread.h"
+#include "ftp_fs.h"
+
+BEGIN_C_DECLS
+
+/**
+ * @const FTP_TRANSFER_TICK_INTERVAL
+ * 非阻塞模式下推进传输的定时器间隔(毫秒)。
+ */
+#define FTP_TRANSFER_TICK_INTERVAL 10
+
+/**
+ * @const FTP_TRANSFER_TICK_BYTES
+ * 非阻塞模式下每次定时器最多收发的字节数。
+ */
+#define FTP_TRANSFER_TICK_BYTES (32 * 1024)
+
+/**
+ * @enum ftp_transfer_type_t
+ * @prefix FTP_TRANSFER_
+ * 传输的类型。
+ */
+typedef enum _ftp_transfer_type_t {
+  /**
+   * @const FTP_TRANSFER_DOWNLOAD
+   * 下载。
+   */
+  FTP_TRANSFER_DOWNLOAD = 0,
+  /**
+   * @const FTP_TRANSFER_UPLOAD
+   * 上传。
+   */
+  FTP_TRANSFER_UPLOAD
+} ftp_transfer_type_t;
+
+/**
+ * @enum ftp_transfer_state_t
+ * @prefix FTP_TRANSFER_
+ * 传输的状态。
+ */
+typedef enum _ftp_transfer_state_t {
+  /**
+   * @const FTP_TRANSFER_PENDING
+   * 还没有开始。
+   */
+  FTP_TRANSFER_PENDING = 0,
+  /**
+   * @const FTP_TRANSFER_RUNNING
+   * 正在传输。
+   */
+  FTP_TRANSFER_RUNNING,
+  /**
+   * @const FTP_TRANSFER_DONE
+   * 已经结束(成功、失败或被取消，结果用ftp_transfer_get_result获取)。
+   */
+  FTP_TRANSFER_DONE
+} ftp_transfer_state_t;
+
+/**
+ * @class ftp_rate_limit_t
+ * 令牌桶限速器。
+ *
+ * 每秒补充rate个令牌，最多积累rate个(允许1秒的突发)，每传输一个字节消耗一个令牌。
+ */
+typedef struct _ftp_rate_limit_t {
+  /**
+   * @property {uint32_t} rate
+   * 每秒最多传输的字节数(0表示不限速)。
+   */
+  uint32_t rate;
+
+  /*private*/
+  int64_t tokens;
+  uint64_t last_time;
+  tk_mutex_t* mutex;
+} ftp_rate_limit_t;
+
+/**
+ * @method ftp_rate_limit_init
+ * 初始化限速器。
+ * @param {ftp_rate_limit_t*} limit 限速器对象。
+ * @param {bool_t} shared 是否被多个线程共享(共享时内部加锁)。
+ *
+ * @return {ftp_rate_limit_t*} 返回限速器对象。
+ */
+ftp_rate_limit_t* ftp_rate_limit_init(ftp_rate_limit_t* limit, bool_t shared);
+
+/**
+ * @method ftp_rate_limit_set_rate
+ * 设置每秒最多传输的字节数。
+ * @param {ftp_rate_limit_t*} limit 限速器对象。
+ * @param {uint32_t} rate 每秒最多传输的字节数(0表示不限速)。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_rate_limit_set_rate(ftp_rate_limit_t* limit, uint32_t rate);
+
+/**
+ * @method ftp_rate_limit_consume
+ * 消耗size个令牌，令牌不够时允许透支。
+ * @param {ftp_rate_limit_t*} limit 限速器对象。
+ * @param {uint32_t} size 传输的字节数。
+ *
+ * @return {uint32_t} 返回还清透支需要等待的毫秒数。
+ */
+uint32_t ftp_rate_limit_consume(ftp_rate_limit_t* limit, uint32_t size);
+
+/**
+ * @method ftp_rate_limit_get_available
+ * 获取当前可以传输的字节数。
+ * @param {ftp_rate_limit_t*} limit 限速器对象。
+ * @param {uint32_t} max_size 最大值(不限速时返回它)。
+ *
+ * @return {uint32_t} 返回可以传输的字节数。
+ */
+uint32_t ftp_rate_limit_get_available(ftp_rate_limit_t* limit, uint32_t max_size);
+
+/**
+ * @method ftp_rate_limit_deinit
+ * 释放限速器的资源。
+ * @param {ftp_rate_limit_t*} limit 限速器对象。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_rate_limit_deinit(ftp_rate_limit_t* limit);
+
+struct _ftp_transfer_t;
+typedef struct _ftp_transfer_t ftp_transfer_t;
+
+/**
+ * @method ftp_transfer_on_event_t
+ * 传输事件(进度和完成)的回调函数。
+ * @param {void*} ctx 回调函数的上下文。
+ * @param {ftp_transfer_t*} transfer 传输对象。
+ *
+ * @return {ret_t} 进度回调返回RET_STOP时取消传输，其它返回值被忽略。
+ */
+typedef ret_t (*ftp_transfer_on_event_t)(void* ctx, ftp_transfer_t* transfer);
+
+/**
+ * @class ftp_transfer_t
+ * 异步传输。
+ *
+ * 在一个工作线程中下载或上传一个文件，调用者不会被阻塞。
+ * 进度和完成事件可以在工作线程中直接回调，也可以投递到AWTK的主循环(UI线程)中回调。
+ * 取消时，工作线程在收发下一块数据后中止传输，向服务器发送ABOR，然后立即把控制连接放回连接池。
+ *
+ * 没有线程的环境可以用ftp_transfer_set_non_blocking切换到非阻塞模式：不创建工作线程，
+ * 由主循环中的定时器每次推进一小步，多个传输可以同时进行，回调都在主循环中执行。
+ *
+ * ```c
+ * ftp_transfer_t* transfer = ftp_transfer_create(fs, FTP_TRANSFER_DOWNLOAD, "a.bin", "/tmp/a.bin");
+ * ftp_transfer_set_on_progress(transfer, on_progress, win);
+ * ftp_transfer_set_on_done(transfer, on_done, win);
+ * ftp_transfer_set_post_to_ui(transfer, TRUE);
+ * ftp_transfer_start(transfer);
+ * ```
+ */
+struct _ftp_transfer_t {
+  /**
+   * @property {ftp_transfer_type_t} type
+   * 传输的类型。
+   */
+  ftp_transfer_type_t type;
+  /**
+   * @property {char*} remote_filename
+   * 远程文件名。
+   */
+  char* remote_filename;
+  /**
+   * @property {char*} local_filename
+   * 本地文件名。
+   */
+  char* local_filename;
+
+  /*private*/
+  fs_t* fs;
+  tk_thread_t* thread;
+  uint64_t thread_id;
+  bool_t joined;
+  tk_mutex_t* mutex;
+  int32_t refcount;
+  ftp_transfer_state_t state;
+  uint64_t done;
+  uint64_t total;
+  ret_t ret;
+  bool_t cancelled;
+  bool_t destroyed;
+  bool_t post_to_ui;
+  bool_t progress_pending;
+  bool_t non_blocking;
+  uint32_t timer_id;
+  ftp_fs_nb_transfer_t* nb;
+  ftp_transfer_on_event_t on_progress;
+  void* on_progress_ctx;
+  ftp_transfer_on_event_t on_done;
+  void* on_done_ctx;
+  uint64_t last_done;
+  ftp_rate_limit_t rate_limit;
+
+  /*由调度器设置。*/
+  int32_t priority;
+  ftp_rate_limit_t* shared_rate_limit;
+  ftp_transfer_on_event_t on_finished;
+  void* on_finished_ctx;
+};
+
+/**
+ * @method ftp_transfer_create
+ * 创建异步传输对象。创建后需要调用ftp_transfer_start开始传输。
+ * @param {fs_t*} fs ftp文件系统对象。
+ * @param {ftp_transfer_type_t} type 传输的类型。
+ * @param {const char*} remote_filename 远程文件名。
+ * @param {const char*} local_filename 本地文件名。
+ *
+ * @return {ftp_transfer_t*} 返回传输对象，失败返回NULL。
+ */
+ftp_transfer_t* ftp_transfer_create(fs_t* fs, ftp_transfer_type_t type,
+                                    const char* remote_filename, const char* local_filename);
+
+/**
+ * @method ftp_transfer_set_on_progress
+ * 设置进度回调函数。每收发一块数据回调一次，投递到主循环时多个进度会合并成一次回调。
+ * @param {ftp_transfer_t*} transfer 传输对象。
+ * @param {ftp_transfer_on_event_t} on_progress 回调函数。
+ * @param {void*} ctx 回调函数的上下文。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_transfer_set_on_progress(ftp_transfer_t* transfer, ftp_transfer_on_event_t on_progress,
+                                   void* ctx);
+
+/**
+ * @method ftp_transfer_set_on_done
+ * 设置完成回调函数。无论成功、失败还是被取消，都回调一次。
+ * @param {ftp_transfer_t*} transfer 传输对象。
+ * @param {ftp_transfer_on_event_t} on_done 回调函数。
+ * @param {void*} ctx 回调函数的上下文。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_transfer_set_on_done(ftp_transfer_t* transfer, ftp_transfer_on_event_t on_done,
+                               void* ctx);
+
+/**
+ * @method ftp_transfer_set_post_to_ui
+ * 设置是否把进度和完成事件投递到AWTK的主循环中回调。
+ * 缺省在工作线程中直接回调，此时不能在回调函数中销毁传输对象。
+ * @param {ftp_transfer_t*} transfer 传输对象。
+ * @param {bool_t} post_to_ui 是否投递到主循环。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_transfer_set_post_to_ui(ftp_transfer_t* transfer, bool_t post_to_ui);
+
+/**
+ * @method ftp_transfer_set_non_blocking
+ * 设置是否使用非阻塞模式。
+ * 非阻塞模式下用ftp_fs_nb_transfer_t实现传输，由AWTK主循环中的定时器驱动，
+ * 每FTP_TRANSFER_TICK_INTERVAL毫秒最多收发FTP_TRANSFER_TICK_BYTES个字节。
+ * 必须在主循环所在的线程中启动和销毁，不能用ftp_transfer_wait等待。
+ * @param {ftp_transfer_t*} transfer 传输对象。
+ * @param {bool_t} non_blocking 是否使用非阻塞模式。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_transfer_set_non_blocking(ftp_transfer_t* transfer, bool_t non_blocking);
+
+/**
+ * @method ftp_transfer_set_rate_limit
+ * 设置这个传输每秒最多传输的字节数，传输过程中也可以调用。
+ * @param {ftp_transfer_t*} transfer 传输对象。
+ * @param {uint32_t} rate 每秒最多传输的字节数(0表示不限速)。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_transfer_set_rate_limit(ftp_transfer_t* transfer, uint32_t rate);
+
+/**
+ * @method ftp_transfer_start
+ * 启动工作线程(非阻塞模式下为定时器)开始传输。
+ * @param {ftp_transfer_t*} transfer 传输对象。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_transfer_start(ftp_transfer_t* transfer);
+
+/**
+ * @method ftp_transfer_cancel
+ * 取消传输。本函数不等待，传输结束时仍然会回调完成函数(结果为RET_STOP)。
+ * 工作线程正在读写数据连接时，关闭数据连接让它马上返回。
+ * @param {ftp_transfer_t*} transfer 传输对象。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_transfer_cancel(ftp_transfer_t* transfer);
+
+/**
+ * @method ftp_transfer_wait
+ * 等待传输结束。
+ * > 投递到主循环时，不要在UI线程中调用本函数等待，否则事件回调无法执行。
+ * @param {ftp_transfer_t*} transfer 传输对象。
+ *
+ * @return {ret_t} 返回传输的结果(RET_STOP表示被取消)。
+ */
+ret_t ftp_transfer_wait(ftp_transfer_t* transfer);
+
+/**
+ * @method ftp_transfer_get_state
+ * 获取传输的状态。
+ * @param {ftp_transfer_t*} transfer 传输对象。
+ *
+ * @return {ftp_transfer_state_t} 返回传输的状态。
+ */
+ftp_transfer_state_t ftp_transfer_get_state(ftp_transfer_t* transfer);
+
+/**
+ * @method ftp_transfer_get_progress
+ * 获取传输的进度。
+ * @param {ftp_transfer_t*} transfer 传输对象。
+ * @param {uint64_t*} done 用于返回已经传输的字节数。
+ * @param {uint64_t*} total 用于返回总字节数(0表示未知)。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_transfer_get_progress(ftp_transfer_t* transfer, uint64_t* done, uint64_t* total);
+
+/**
+ * @method ftp_transfer_get_result
+ * 获取传输的结果。
+ * @param {ftp_transfer_t*} transfer 传输对象。
+ *
+ * @return {ret_t} 返回传输的结果，还没有结束时返回RET_BUSY。
+ */
+ret_t ftp_transfer_get_result(ftp_transfer_t* transfer);
+
+/**
+ * @method ftp_transfer_ref
+ * 增加引用计数(供调度器等持有传输对象时使用)。
+ * @param {ftp_transfer_t*} transfer 传输对象。
+ *
+ * @return {ftp_transfer_t*} 返回传输对象。
+ */
+ftp_transfer_t* ftp_transfer_ref(ftp_transfer_t* transfer);
+
+/**
+ * @method ftp_transfer_unref
+ * 减少引用计数，为0时释放传输对象。
+ * @param {ftp_transfer_t*} transfer 传输对象。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_transfer_unref(ftp_transfer_t* transfer);
+
+/**
+ * @method ftp_transfer_destroy
+ * 销毁传输对象。还没有结束的传输会被取消。
+ * 本函数不等待工作线程退出，工作线程持有自己的引用，结束后在主循环中释放。
+ * > 工作线程退出前仍然使用ftp_fs对象，需要销毁ftp_fs时，先用ftp_transfer_cancel和ftp_transfer_wait等待传输结束。
+ * 已经投递到主循环但还没有执行的事件不再回调。
+ * 通过调度器提交的传输在销毁时归还并发名额，队列中的下一个传输随即开始。
+ * @param {ftp_transfer_t*} transfer 传输对象。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t ftp_transfer_destroy(ftp_transfer_t* transfer);
+
+END_C_DECLS
+
+#endif /*TK_FTP_TRANSFER_H*/